@@ -0,0 +1,157 @@
+/**
+ * The rows of the tables arrive in the order of the ids, so the rows
+ * rendered for one bounding box and date are scattered over the whole heap
+ * of a table, and the GiST index is built from unordered input. With
+ * clustering, the rows of a table are sorted before they are copied into
+ * it: by the position of the center of their geometry on a Hilbert curve,
+ * and by their valid_from inside of each cell of the curve. Rows close to
+ * each other in space and time then end up on the same pages, which is
+ * also what makes BRIN indexes useful.
+ *
+ * The rows themselves are of variable length, so they are spilled into a
+ * temporary file as they arrive, and only fixed-size keys pointing into
+ * that file are sorted by the ExternalSorter. After sorting, the rows are
+ * read back in the order of their keys.
+ */
+
+#ifndef IMPORTER_CLUSTERSORTER_HPP
+#define IMPORTER_CLUSTERSORTER_HPP
+
+#include "externalsorter.hpp"
+
+/**
+ * Sorts rows by a Hilbert cell and their valid_from
+ */
+class ClusterSorter {
+public:
+    /**
+     * the number of bits of each axis of the curve, 2^16 cells of about
+     * 600 meters at the equator
+     */
+    const static int HILBERT_ORDER = 16;
+
+    /**
+     * the cell for rows without a geometry, sorted behind all others
+     */
+    const static uint32_t NO_CELL = 0xFFFFFFFF;
+
+    /**
+     * the position of the grid cell x/y (0 <= x,y < 2^HILBERT_ORDER) on the
+     * Hilbert curve
+     */
+    static uint32_t hilbert(uint32_t x, uint32_t y) {
+        uint32_t d = 0;
+        for(uint32_t s = 1 << (HILBERT_ORDER - 1); s > 0; s >>= 1) {
+            uint32_t rx = (x & s) > 0;
+            uint32_t ry = (y & s) > 0;
+            d += s * s * ((3 * rx) ^ ry);
+
+            // rotate the quadrant
+            if(ry == 0) {
+                if(rx == 1) {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
+    }
+
+    /**
+     * the Hilbert cell of a position inside of the extent
+     * minx/miny - maxx/maxy
+     */
+    static uint32_t cell(double x, double y, double minx, double miny, double maxx, double maxy) {
+        const double cells = 1 << HILBERT_ORDER;
+        double gx = (x - minx) / (maxx - minx) * cells;
+        double gy = (y - miny) / (maxy - miny) * cells;
+        gx = std::max(0.0, std::min(cells - 1, gx));
+        gy = std::max(0.0, std::min(cells - 1, gy));
+        return hilbert((uint32_t)gx, (uint32_t)gy);
+    }
+
+private:
+    /**
+     * the sort key of a row and where it is stored in the row file
+     */
+    struct Key {
+        uint32_t cell;
+        uint32_t length;
+        int64_t valid_from;
+        uint64_t offset;
+
+        bool operator<(const Key& other) const {
+            if(cell != other.cell) return cell < other.cell;
+            if(valid_from != other.valid_from) return valid_from < other.valid_from;
+            return offset < other.offset;
+        }
+    };
+
+    TempFile m_rows;
+    uint64_t m_offset;
+    ExternalSorter<Key> m_keys;
+
+    std::vector<char> m_buffer;
+
+    // not copyable
+    ClusterSorter(const ClusterSorter&);
+    ClusterSorter& operator=(const ClusterSorter&);
+
+public:
+    /**
+     * sort in the directory tmpdir, using about memoryLimit bytes of
+     * memory for the keys
+     */
+    ClusterSorter(const std::string& tmpdir, size_t memoryLimit) : m_rows(), m_offset(0), m_keys(tmpdir, memoryLimit), m_buffer() {
+        m_rows.open(tmpdir);
+    }
+
+    /**
+     * add a row in the cell which is valid from valid_from
+     */
+    void add(uint32_t cell, time_t valid_from, const std::string& data) {
+        Key key;
+        key.cell = cell;
+        key.length = data.size();
+        key.valid_from = valid_from;
+        key.offset = m_offset;
+
+        m_rows.write(data.data(), data.size());
+        m_offset += data.size();
+        m_keys.add(key);
+    }
+
+    /**
+     * the number of rows added
+     */
+    size_t size() const {
+        return m_keys.size();
+    }
+
+    /**
+     * sort the rows, they can be read with next afterwards
+     */
+    void sort() {
+        m_rows.flush();
+        m_keys.sort();
+    }
+
+    /**
+     * read the next row in the sorted order, returns false after the last
+     */
+    bool next(time_t& valid_from, std::string& data) {
+        Key key;
+        if(!m_keys.next(key)) {
+            return false;
+        }
+
+        m_buffer.resize(std::max((size_t)1, (size_t)key.length));
+        m_rows.readAt(&m_buffer[0], key.length, key.offset);
+        data.assign(&m_buffer[0], key.length);
+        valid_from = key.valid_from;
+        return true;
+    }
+};
+
+#endif // IMPORTER_CLUSTERSORTER_HPP
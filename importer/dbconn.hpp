@@ -99,6 +99,48 @@ public:
         PQclear(res);
     }
 
+    /**
+     * send one or more sql statements without waiting for them to finish,
+     * so several connections can work at the same time. wait() needs to
+     * be called before the connection is used again.
+     */
+    void send(const std::string& cmd) {
+        // send the command
+        if(!PQsendQuery(conn, cmd.c_str()))
+        {
+            // show the error message, close the connection and throw out
+            std::cerr << PQerrorMessage(conn) << std::endl;
+            PQfinish(conn);
+            throw std::runtime_error("sending command failed");
+        }
+    }
+
+    /**
+     * wait for the statements sent with send() to finish
+     */
+    void wait() {
+        bool failed = false;
+
+        // each statement has its own result
+        PGresult *res;
+        while((res = PQgetResult(conn)) != NULL) {
+            ExecStatusType status = PQresultStatus(res);
+            if(status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK)
+            {
+                std::cerr << PQresultErrorMessage(res) << std::endl;
+                failed = true;
+            }
+            PQclear(res);
+        }
+
+        if(failed)
+        {
+            // close the connection and throw out
+            PQfinish(conn);
+            throw std::runtime_error("command failed");
+        }
+    }
+
     /**
      * read a .sql-file and execute it
      */
@@ -0,0 +1,31 @@
+/**
+ * The importer can print lots of debug messages and store errors, but
+ * checking whether it should do so costs time in the innermost loops of
+ * the nodestores and the geometry building, which are run for every node
+ * version.
+ *
+ * The classes in those loops are therefore templated on a debug policy.
+ * With DebugDisabled all checks are false at compile time and the
+ * compiler removes the debug code completely, with DebugEnabled the
+ * runtime flags (--debug, --store-errors) decide which messages are
+ * printed.
+ */
+
+#ifndef IMPORTER_DEBUGPOLICY_HPP
+#define IMPORTER_DEBUGPOLICY_HPP
+
+/**
+ * debug policy for imports without --debug and --store-errors
+ */
+struct DebugDisabled {
+    static const bool enabled = false;
+};
+
+/**
+ * debug policy for imports with --debug or --store-errors
+ */
+struct DebugEnabled {
+    static const bool enabled = true;
+};
+
+#endif // IMPORTER_DEBUGPOLICY_HPP
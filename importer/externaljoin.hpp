@@ -0,0 +1,394 @@
+/**
+ * Every nodestore keeps the complete node history in memory (or at least
+ * in the address space). For inputs that do not fit, the external join
+ * builds the way geometries without a nodestore, using mostly sequential
+ * disk i/o and a bounded amount of memory:
+ *
+ *  1. while reading the nodes, all visible node versions are spilled into
+ *     a temporary file. The input is sorted, so this file is sorted by
+ *     node-id, too.
+ *  2. while reading the ways, they are spilled into a second temporary
+ *     file. All versions of a way form a group; for each group the
+ *     referenced node-ids are spilled as (node-id, group) references.
+ *  3. after the ways, the references are sorted by node-id and
+ *     merge-joined against the node versions. The result is sorted again
+ *     by group.
+ *  4. the groups are read back one after the other, together with the
+ *     versions of all nodes referenced by them. These are recorded into a
+ *     small stl-nodestore, which is then used to build the geometries the
+ *     same way it would be done with a nodestore holding all nodes.
+ *
+ * The coordinates are spilled as fixed-point integers, so the result is
+ * identical to an import using the sparse nodestore. When the nodes are
+ * projected before they are recorded, the mercator coordinates are
+ * spilled in centimeters, like the sparse nodestore stores them.
+ */
+
+#ifndef IMPORTER_EXTERNALJOIN_HPP
+#define IMPORTER_EXTERNALJOIN_HPP
+
+#include "externalsorter.hpp"
+#include "nodestore.hpp"
+#include "nodestore/stl.hpp"
+
+/**
+ * Joins ways against node versions using temporary files instead of a
+ * nodestore.
+ */
+class ExternalJoin {
+private:
+    /**
+     * one node version
+     */
+    struct NodeRecord {
+        int64_t id;
+        uint32_t t;
+        osm_user_id_t uid;
+        int32_t lat;
+        int32_t lon;
+    };
+
+    /**
+     * reference from a way-group to a node
+     */
+    struct RefRecord {
+        int64_t node;
+        uint64_t group;
+
+        bool operator<(const RefRecord& other) const {
+            return node < other.node || (node == other.node && group < other.group);
+        }
+    };
+
+    /**
+     * a node version needed by a way-group
+     */
+    struct JoinedRecord {
+        uint64_t group;
+        NodeRecord node;
+
+        bool operator<(const JoinedRecord& other) const {
+            if(group != other.group)
+                return group < other.group;
+            if(node.id != other.node.id)
+                return node.id < other.node.id;
+            return node.t < other.node.t;
+        }
+    };
+
+    std::string m_tmpdir;
+    size_t m_memoryLimit;
+
+    /**
+     * are the recorded coordinates projected to mercator?
+     */
+    bool m_mercator;
+
+    TempFile m_nodes, m_ways;
+    ExternalSorter<RefRecord> *m_refs;
+    ExternalSorter<JoinedRecord> *m_joined;
+
+    /**
+     * current group while spilling the ways, and the id of its way
+     */
+    uint64_t m_group;
+    osm_object_id_t m_groupWayId;
+    bool m_hasGroup;
+
+    /**
+     * node-ids referenced by the current group
+     */
+    std::vector<osm_object_id_t> m_groupRefs;
+
+    /**
+     * lookahead way and its group while reading back the spilled ways
+     */
+    shared_ptr<Osmium::OSM::Way> m_wayHead;
+    uint64_t m_wayHeadGroup;
+    bool m_hasWayHead;
+
+    /**
+     * lookahead record while reading back the joined node versions
+     */
+    JoinedRecord m_joinedHead;
+    bool m_hasJoinedHead;
+
+    // not copyable
+    ExternalJoin(const ExternalJoin&);
+    ExternalJoin& operator=(const ExternalJoin&);
+
+    void flushGroupRefs() {
+        std::sort(m_groupRefs.begin(), m_groupRefs.end());
+        m_groupRefs.erase(std::unique(m_groupRefs.begin(), m_groupRefs.end()), m_groupRefs.end());
+
+        std::vector<osm_object_id_t>::const_iterator end = m_groupRefs.end();
+        for(std::vector<osm_object_id_t>::const_iterator it = m_groupRefs.begin(); it != end; ++it) {
+            RefRecord ref = {*it, m_group};
+            m_refs->add(ref);
+        }
+        m_groupRefs.clear();
+    }
+
+    void writeString(const char *str) {
+        uint32_t len = strlen(str);
+        m_ways.write(&len, sizeof(len));
+        m_ways.write(str, len);
+    }
+
+    bool readString(std::string& str) {
+        uint32_t len;
+        if(!m_ways.read(&len, sizeof(len)))
+            return false;
+
+        str.resize(len);
+        return len == 0 || m_ways.read(&str[0], len);
+    }
+
+    /**
+     * read one way from the spilled ways, together with the group it
+     * belongs to
+     */
+    bool readWay(uint64_t& group, shared_ptr<Osmium::OSM::Way>& way) {
+        int64_t id, timestamp;
+        uint32_t version, tagCount, nodeCount;
+        osm_user_id_t uid;
+        char visible;
+        std::string user, key, value;
+
+        if(!m_ways.read(&group, sizeof(group)))
+            return false;
+
+        if(!m_ways.read(&id, sizeof(id)) ||
+           !m_ways.read(&version, sizeof(version)) ||
+           !m_ways.read(&timestamp, sizeof(timestamp)) ||
+           !m_ways.read(&uid, sizeof(uid)) ||
+           !m_ways.read(&visible, sizeof(visible)) ||
+           !readString(user) ||
+           !m_ways.read(&tagCount, sizeof(tagCount))) {
+            throw std::runtime_error("spilled ways are truncated");
+        }
+
+        way = make_shared<Osmium::OSM::Way>();
+        way->set_id(id);
+        way->set_version(version);
+        way->set_timestamp(timestamp);
+        way->set_uid(uid);
+        way->set_user(user.c_str());
+        way->set_visible(visible);
+
+        for(uint32_t i = 0; i < tagCount; i++) {
+            if(!readString(key) || !readString(value))
+                throw std::runtime_error("spilled ways are truncated");
+
+            way->tags().add(key.c_str(), value.c_str());
+        }
+
+        if(!m_ways.read(&nodeCount, sizeof(nodeCount)))
+            throw std::runtime_error("spilled ways are truncated");
+
+        for(uint32_t i = 0; i < nodeCount; i++) {
+            int64_t ref;
+            if(!m_ways.read(&ref, sizeof(ref)))
+                throw std::runtime_error("spilled ways are truncated");
+
+            way->add_node(ref);
+        }
+
+        return true;
+    }
+
+public:
+    /**
+     * create a join that spills into tmpdir and uses about memoryLimit
+     * bytes of memory for sorting. the references are still read while
+     * the joined node versions are collected, so each of the two sorters
+     * gets half of it.
+     */
+    ExternalJoin(const std::string& tmpdir, size_t memoryLimit) :
+            m_tmpdir(tmpdir),
+            m_memoryLimit(memoryLimit),
+            m_mercator(false),
+            m_nodes(),
+            m_ways(),
+            m_refs(new ExternalSorter<RefRecord>(tmpdir, memoryLimit / 2)),
+            m_joined(NULL),
+            m_group(0),
+            m_groupWayId(0),
+            m_hasGroup(false),
+            m_groupRefs(),
+            m_wayHead(),
+            m_wayHeadGroup(0),
+            m_hasWayHead(false),
+            m_joinedHead(),
+            m_hasJoinedHead(false) {
+
+        m_nodes.open(m_tmpdir);
+        m_ways.open(m_tmpdir);
+    }
+
+    ~ExternalJoin() {
+        delete m_refs;
+        delete m_joined;
+    }
+
+    /**
+     * are the recorded coordinates mercator coordinates
+     */
+    bool isStoringMercator() {
+        return m_mercator;
+    }
+
+    /**
+     * should the recorded coordinates be treated as mercator coordinates
+     * instead of lon/lat?
+     */
+    void storeMercator(bool shouldStoreMercator) {
+        m_mercator = shouldStoreMercator;
+    }
+
+    /**
+     * spill a node version, nodes need to be recorded in ascending id order
+     */
+    void recordNode(osm_object_id_t id, osm_user_id_t uid, time_t t, double lon, double lat) {
+        NodeRecord node = {id, (uint32_t)t, uid, Nodestore::toFix(lat, m_mercator), Nodestore::toFix(lon, m_mercator)};
+        m_nodes.write(&node, sizeof(node));
+    }
+
+    /**
+     * spill a way version, ways need to be recorded in ascending id and
+     * version order
+     */
+    void recordWay(const shared_ptr<Osmium::OSM::Way const>& way) {
+        if(!m_hasGroup || m_groupWayId != way->id()) {
+            if(m_hasGroup) {
+                flushGroupRefs();
+                m_group++;
+            }
+
+            m_groupWayId = way->id();
+            m_hasGroup = true;
+        }
+
+        int64_t id = way->id(), timestamp = way->timestamp();
+        uint32_t version = way->version();
+        osm_user_id_t uid = way->uid();
+        char visible = way->visible();
+
+        m_ways.write(&m_group, sizeof(m_group));
+        m_ways.write(&id, sizeof(id));
+        m_ways.write(&version, sizeof(version));
+        m_ways.write(&timestamp, sizeof(timestamp));
+        m_ways.write(&uid, sizeof(uid));
+        m_ways.write(&visible, sizeof(visible));
+        writeString(way->user());
+
+        uint32_t tagCount = way->tags().size();
+        m_ways.write(&tagCount, sizeof(tagCount));
+        for(Osmium::OSM::TagList::const_iterator it = way->tags().begin(); it != way->tags().end(); ++it) {
+            writeString(it->key());
+            writeString(it->value());
+        }
+
+        uint32_t nodeCount = way->nodes().size();
+        m_ways.write(&nodeCount, sizeof(nodeCount));
+        Osmium::OSM::WayNodeList::const_iterator end = way->nodes().end();
+        for(Osmium::OSM::WayNodeList::const_iterator it = way->nodes().begin(); it != end; ++it) {
+            int64_t ref = it->ref();
+            m_ways.write(&ref, sizeof(ref));
+            m_groupRefs.push_back(ref);
+        }
+    }
+
+    /**
+     * join the spilled references against the spilled node versions and
+     * sort the result by way-group
+     */
+    void join() {
+        if(m_hasGroup) {
+            flushGroupRefs();
+        }
+
+        std::cerr << "sorting " << m_refs->size() << " node references..." << std::endl;
+        m_refs->sort();
+
+        m_joined = new ExternalSorter<JoinedRecord>(m_tmpdir, m_memoryLimit / 2);
+        m_nodes.rewind();
+
+        std::cerr << "joining node references with node versions..." << std::endl;
+
+        // versions of the node currently joined
+        std::vector<NodeRecord> versions;
+        NodeRecord node;
+        bool hasNode = m_nodes.read(&node, sizeof(node));
+
+        RefRecord ref;
+        while(m_refs->next(ref)) {
+            if(versions.empty() || versions.front().id != ref.node) {
+                versions.clear();
+
+                // skip nodes that are not referenced
+                while(hasNode && node.id < ref.node) {
+                    hasNode = m_nodes.read(&node, sizeof(node));
+                }
+
+                // collect all versions of the referenced node
+                while(hasNode && node.id == ref.node) {
+                    versions.push_back(node);
+                    hasNode = m_nodes.read(&node, sizeof(node));
+                }
+            }
+
+            std::vector<NodeRecord>::const_iterator end = versions.end();
+            for(std::vector<NodeRecord>::const_iterator it = versions.begin(); it != end; ++it) {
+                JoinedRecord joined = {ref.group, *it};
+                m_joined->add(joined);
+            }
+        }
+
+        // the references and the node versions are not needed anymore
+        delete m_refs;
+        m_refs = NULL;
+        m_nodes.close();
+
+        std::cerr << "sorting " << m_joined->size() << " joined node versions by way..." << std::endl;
+        m_joined->sort();
+
+        m_ways.rewind();
+        m_hasWayHead = readWay(m_wayHeadGroup, m_wayHead);
+        m_hasJoinedHead = m_joined->next(m_joinedHead);
+    }
+
+    /**
+     * read all versions of the next way from the spilled ways and record
+     * the versions of all nodes referenced by them into store. returns
+     * false when all ways have been read.
+     */
+    template <class TNodestore>
+    bool nextGroup(std::vector< shared_ptr<Osmium::OSM::Way const> >& versions, TNodestore *store) {
+        versions.clear();
+
+        if(!m_hasWayHead)
+            return false;
+
+        uint64_t group = m_wayHeadGroup;
+        while(m_hasWayHead && m_wayHeadGroup == group) {
+            versions.push_back(m_wayHead);
+            m_hasWayHead = readWay(m_wayHeadGroup, m_wayHead);
+        }
+
+        // skip versions joined for groups that were not read
+        while(m_hasJoinedHead && m_joinedHead.group < group) {
+            m_hasJoinedHead = m_joined->next(m_joinedHead);
+        }
+
+        while(m_hasJoinedHead && m_joinedHead.group == group) {
+            const NodeRecord& node = m_joinedHead.node;
+            store->record(node.id, node.uid, node.t, Nodestore::fromFix(node.lon, m_mercator), Nodestore::fromFix(node.lat, m_mercator));
+            m_hasJoinedHead = m_joined->next(m_joinedHead);
+        }
+
+        return true;
+    }
+};
+
+#endif // IMPORTER_EXTERNALJOIN_HPP
@@ -0,0 +1,484 @@
+/**
+ * Some import modes handle more data than fits into memory. They spill
+ * fixed-size records into temporary files and sort them with a bounded
+ * amount of memory: records are collected in memory until the memory
+ * limit is reached, then the collected records are sorted and written
+ * to a temporary file (a run). When all records have been added, the
+ * runs are merged while reading them back in.
+ *
+ * Half of the memory limit holds the collected records, the other half
+ * the buffers of the runs merged at the same time. Runs only hold a buffer
+ * while they are written or read, and as soon as there are as many runs
+ * of the same size as can be merged at once, they are merged into a
+ * larger one. So neither the memory nor the number of open files grows
+ * with the size of the input.
+ *
+ * If all records fit into memory, no temporary file is written at all.
+ */
+
+#ifndef IMPORTER_EXTERNALSORTER_HPP
+#define IMPORTER_EXTERNALSORTER_HPP
+
+#include <cstdio>
+#include <cstring>
+#include <queue>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <errno.h>
+
+/**
+ * An anonymous temporary file. It is removed from the directory right
+ * after it has been created, so it vanishes as soon as it is closed, even
+ * if the importer crashes.
+ */
+class TempFile {
+private:
+    FILE *m_file;
+
+    // not copyable
+    TempFile(const TempFile&);
+    TempFile& operator=(const TempFile&);
+
+public:
+    TempFile() : m_file(NULL) {}
+
+    ~TempFile() {
+        close();
+    }
+
+    /**
+     * create an anonymous file in the directory dir and return its
+     * descriptor
+     */
+    static int create(const std::string& dir) {
+        std::string pattern = dir + "/osm-history-importer-XXXXXX";
+        std::vector<char> name(pattern.begin(), pattern.end());
+        name.push_back('\0');
+
+        int fd = mkstemp(&name[0]);
+        if(fd == -1) {
+            std::cerr << "can't create temporary file in " << dir << std::endl;
+            throw std::runtime_error("creating temporary file failed");
+        }
+
+        unlink(&name[0]);
+        return fd;
+    }
+
+    /**
+     * create the temporary file in the directory dir, using a stdio buffer
+     * of bufferSize bytes
+     */
+    void open(const std::string& dir, size_t bufferSize = 1 << 20) {
+        m_file = fdopen(create(dir), "w+b");
+        setvbuf(m_file, NULL, _IOFBF, bufferSize);
+    }
+
+    void write(const void *data, size_t size) {
+        if(size > 0 && 1 != fwrite(data, size, 1, m_file))
+            throw std::runtime_error("writing temporary file failed");
+    }
+
+    /**
+     * read size bytes, returns false at the end of the file
+     */
+    bool read(void *data, size_t size) {
+        return size == 0 || 1 == fread(data, size, 1, m_file);
+    }
+
+    /**
+     * read size bytes at the offset, independent of the current position.
+     * flush() needs to be called after writing before.
+     */
+    void readAt(void *data, size_t size, uint64_t offset) {
+        if(size > 0 && (ssize_t)size != pread(fileno(m_file), data, size, offset))
+            throw std::runtime_error("reading temporary file failed");
+    }
+
+    /**
+     * write all buffered data to the file
+     */
+    void flush() {
+        fflush(m_file);
+    }
+
+    /**
+     * flush all written data and start reading from the beginning
+     */
+    void rewind() {
+        fflush(m_file);
+        ::rewind(m_file);
+    }
+
+    void close() {
+        if(!m_file)
+            return;
+
+        fclose(m_file);
+        m_file = NULL;
+    }
+};
+
+/**
+ * A run of sorted records in an anonymous temporary file. The file is
+ * first written, then read back from the beginning. Unlike a TempFile it
+ * only holds a buffer while it is written or read, so the runs waiting
+ * for their merge don't use any memory.
+ */
+class RunFile {
+private:
+    int m_fd;
+    size_t m_bufferSize;
+
+    /**
+     * while writing, the data from 0 to m_fill is not yet in the file.
+     * while reading, the data from m_pos to m_fill has not been returned yet.
+     */
+    std::vector<char> m_buffer;
+    size_t m_pos, m_fill;
+
+    /**
+     * the position in the file the next data is read from
+     */
+    uint64_t m_offset;
+
+    // not copyable
+    RunFile(const RunFile&);
+    RunFile& operator=(const RunFile&);
+
+    void writeAll(const char *data, size_t size) {
+        while(size > 0) {
+            ssize_t written = ::write(m_fd, data, size);
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written <= 0)
+                throw std::runtime_error("writing temporary file failed");
+
+            data += written;
+            size -= written;
+        }
+    }
+
+    /**
+     * keep the data not returned yet and fill up the buffer behind it
+     */
+    void fill() {
+        if(m_fill > m_pos) {
+            memmove(&m_buffer[0], &m_buffer[m_pos], m_fill - m_pos);
+        }
+        m_fill -= m_pos;
+        m_pos = 0;
+
+        while(m_fill < m_buffer.size()) {
+            ssize_t got = pread(m_fd, &m_buffer[m_fill], m_buffer.size() - m_fill, m_offset);
+            if(got < 0 && errno == EINTR)
+                continue;
+            if(got < 0)
+                throw std::runtime_error("reading temporary file failed");
+            if(got == 0)
+                break;
+
+            m_fill += got;
+            m_offset += got;
+        }
+    }
+
+    void release() {
+        std::vector<char>().swap(m_buffer);
+        m_pos = m_fill = 0;
+    }
+
+public:
+    RunFile() : m_fd(-1), m_bufferSize(0), m_buffer(), m_pos(0), m_fill(0), m_offset(0) {}
+
+    ~RunFile() {
+        close();
+    }
+
+    /**
+     * create the file in the directory dir, using a buffer of bufferSize
+     * bytes while writing and reading
+     */
+    void open(const std::string& dir, size_t bufferSize) {
+        m_fd = TempFile::create(dir);
+        m_bufferSize = bufferSize;
+    }
+
+    void write(const void *data, size_t size) {
+        if(m_fill + size > m_bufferSize && m_fill > 0) {
+            writeAll(&m_buffer[0], m_fill);
+            m_fill = 0;
+        }
+
+        if(size >= m_bufferSize) {
+            writeAll((const char*)data, size);
+            return;
+        }
+
+        if(m_buffer.empty()) {
+            m_buffer.resize(m_bufferSize);
+        }
+        memcpy(&m_buffer[m_fill], data, size);
+        m_fill += size;
+    }
+
+    /**
+     * write the buffered data and release the buffer, the run is read
+     * from the beginning afterwards
+     */
+    void finish() {
+        if(m_fill > 0) {
+            writeAll(&m_buffer[0], m_fill);
+        }
+        release();
+        m_offset = 0;
+    }
+
+    /**
+     * read size bytes, returns false at the end of the file
+     */
+    bool read(void *data, size_t size) {
+        if(m_fill - m_pos < size) {
+            if(m_buffer.size() < std::max(m_bufferSize, size)) {
+                m_buffer.resize(std::max(m_bufferSize, size));
+            }
+            fill();
+
+            if(m_fill < size) {
+                return false;
+            }
+        }
+
+        memcpy(data, &m_buffer[m_pos], size);
+        m_pos += size;
+        return true;
+    }
+
+    void close() {
+        release();
+        if(m_fd == -1)
+            return;
+
+        ::close(m_fd);
+        m_fd = -1;
+    }
+};
+
+/**
+ * Sorts fixed-size records with a bounded amount of memory. TRecord
+ * needs to be a plain struct with an operator<.
+ */
+template <class TRecord>
+class ExternalSorter {
+private:
+    /**
+     * a record read from a run, ordered so that the smallest record is
+     * on top of a std::priority_queue
+     */
+    struct RunHead {
+        TRecord record;
+        size_t run;
+
+        bool operator<(const RunHead& other) const {
+            return other.record < record;
+        }
+    };
+
+    /**
+     * buffer size of one run, as many runs are read at the same time this
+     * is smaller then the default
+     */
+    const static size_t RUN_BUFFER_SIZE = 256 * 1024;
+
+    std::string m_tmpdir;
+    size_t m_maxRecords, m_maxRuns, m_count;
+
+    std::vector<TRecord> m_buffer;
+    size_t m_bufferPos;
+
+    /**
+     * the runs and how often the records in each of them have been merged
+     * already. the levels never increase towards the end.
+     */
+    std::vector<RunFile*> m_runs;
+    std::vector<unsigned int> m_levels;
+    std::priority_queue<RunHead> m_heads;
+
+    // not copyable
+    ExternalSorter(const ExternalSorter&);
+    ExternalSorter& operator=(const ExternalSorter&);
+
+    void writeRun() {
+        std::sort(m_buffer.begin(), m_buffer.end());
+
+        RunFile *run = new RunFile();
+        run->open(m_tmpdir, RUN_BUFFER_SIZE);
+        run->write(&m_buffer[0], m_buffer.size() * sizeof(TRecord));
+        run->finish();
+        m_runs.push_back(run);
+        m_levels.push_back(0);
+
+        m_buffer.clear();
+
+        // merge the last runs as soon as there are as many of the same
+        // level as can be merged at once
+        while(m_runs.size() >= m_maxRuns && m_levels[m_runs.size() - m_maxRuns] == m_levels.back()) {
+            merge(m_runs.size() - m_maxRuns);
+        }
+    }
+
+    /**
+     * merge the runs from first up to the last one into a single run
+     */
+    void merge(size_t first) {
+        RunFile *merged = new RunFile();
+        merged->open(m_tmpdir, RUN_BUFFER_SIZE);
+
+        std::priority_queue<RunHead> heads;
+        for(size_t i = first; i < m_runs.size(); i++) {
+            RunHead head;
+            head.run = i;
+            if(m_runs[i]->read(&head.record, sizeof(TRecord))) {
+                heads.push(head);
+            }
+        }
+
+        while(!heads.empty()) {
+            RunHead head = heads.top();
+            heads.pop();
+            merged->write(&head.record, sizeof(TRecord));
+
+            if(m_runs[head.run]->read(&head.record, sizeof(TRecord))) {
+                heads.push(head);
+            }
+        }
+        merged->finish();
+
+        unsigned int level = m_levels[first] + 1;
+        for(size_t i = first; i < m_runs.size(); i++) {
+            delete m_runs[i];
+        }
+        m_runs.resize(first);
+        m_levels.resize(first);
+
+        m_runs.push_back(merged);
+        m_levels.push_back(level);
+    }
+
+    void readHead(size_t run) {
+        RunHead head;
+        head.run = run;
+        if(m_runs[run]->read(&head.record, sizeof(TRecord))) {
+            m_heads.push(head);
+        } else {
+            m_runs[run]->close();
+        }
+    }
+
+public:
+    /**
+     * create a sorter that spills into tmpdir and uses about memoryLimit
+     * bytes of memory
+     */
+    ExternalSorter(const std::string& tmpdir, size_t memoryLimit) :
+            m_tmpdir(tmpdir),
+            m_maxRecords(std::max(memoryLimit / 2 / sizeof(TRecord), (size_t)1024)),
+            m_maxRuns(std::max(memoryLimit / 2 / RUN_BUFFER_SIZE, (size_t)2)),
+            m_count(0),
+            m_buffer(),
+            m_bufferPos(0),
+            m_runs(),
+            m_levels(),
+            m_heads() {}
+
+    ~ExternalSorter() {
+        for(size_t i = 0; i < m_runs.size(); i++) {
+            delete m_runs[i];
+        }
+    }
+
+    /**
+     * add a record to the sorter
+     */
+    void add(const TRecord& record) {
+        m_buffer.push_back(record);
+        m_count++;
+
+        if(m_buffer.size() >= m_maxRecords) {
+            writeRun();
+        }
+    }
+
+    /**
+     * number of records added to the sorter
+     */
+    size_t size() const {
+        return m_count;
+    }
+
+    /**
+     * number of runs written to disk
+     */
+    size_t runs() const {
+        return m_runs.size();
+    }
+
+    /**
+     * sort all records added so far and prepare for reading them back
+     */
+    void sort() {
+        if(m_runs.empty()) {
+            // everything fits into memory
+            std::sort(m_buffer.begin(), m_buffer.end());
+            m_bufferPos = 0;
+            return;
+        }
+
+        if(!m_buffer.empty()) {
+            writeRun();
+        }
+
+        // release the memory of the buffer
+        std::vector<TRecord>().swap(m_buffer);
+
+        // merge the smallest runs until the rest can be merged at once
+        while(m_runs.size() > m_maxRuns) {
+            merge(m_runs.size() - m_maxRuns);
+        }
+
+        for(size_t i = 0; i < m_runs.size(); i++) {
+            readHead(i);
+        }
+    }
+
+    /**
+     * read the next record in sorted order, returns false if all records
+     * have been read
+     */
+    bool next(TRecord& record) {
+        if(m_runs.empty()) {
+            if(m_bufferPos >= m_buffer.size()) {
+                // release the memory of the drained buffer
+                std::vector<TRecord>().swap(m_buffer);
+                m_bufferPos = 0;
+                return false;
+            }
+
+            record = m_buffer[m_bufferPos++];
+            return true;
+        }
+
+        if(m_heads.empty())
+            return false;
+
+        RunHead head = m_heads.top();
+        m_heads.pop();
+        record = head.record;
+
+        readHead(head.run);
+        return true;
+    }
+};
+
+#endif // IMPORTER_EXTERNALSORTER_HPP
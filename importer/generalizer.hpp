@@ -0,0 +1,332 @@
+/**
+ * Low zoom renderings (an animation of a whole country, for example) don't
+ * need the full detail of every line and polygon, but pull all of it
+ * through the views. A Generalizer writes a second, generalized copy of
+ * the line-, roads- and polygon-table for one zoom level, eg. hist_line_z8,
+ * hist_roads_z8 and hist_polygon_z8.
+ *
+ * The geometries are simplified with a tolerance of half a pixel at that
+ * zoom level, polygons smaller then a pixel are left out. Many versions of
+ * a way only differ in details that disappear by the simplification, so a
+ * row identical to the previous row of the same way (same tags and same
+ * simplified geometry) is not written, instead the previous row stays
+ * valid until the end of the dropped one. To do so, the last row of each
+ * table (or of each part of a multipolygon) is held back until the next
+ * one is known.
+ *
+ * The generalized tables have the columns of the full tables, so with
+ * --validity-range they get the tsrange column and its index, too.
+ */
+
+#ifndef IMPORTER_GENERALIZER_HPP
+#define IMPORTER_GENERALIZER_HPP
+
+#include <memory>
+
+#include <geos/simplify/TopologyPreservingSimplifier.h>
+
+/**
+ * Writes the generalized tables of one zoom level
+ */
+class Generalizer {
+private:
+    /**
+     * a row of a generalized table
+     */
+    struct Row {
+        osm_object_id_t id;
+        osm_version_t version, minor;
+        size_t part;
+        osm_user_id_t user_id;
+        std::string user_name;
+        time_t valid_from, valid_to;
+        std::string tags;
+        long z_order;
+        double area;
+        std::string geom, center;
+    };
+
+    /**
+     * a generalized table and the rows held back for it, one per part of
+     * the current way or relation
+     */
+    struct Table {
+        const char *base;
+        bool polygon;
+        DbCopyConn conn;
+        std::map<size_t, Row> pending;
+    };
+
+    int m_zoom;
+    std::string m_prefix;
+    bool m_validityRange;
+
+    enum { LINE, ROADS, POLYGON, TABLES };
+    Table m_tables[TABLES];
+
+    geos::io::WKBWriter m_wkb;
+
+    uint64_t m_written, m_dropped, m_small;
+
+    /**
+     * write a held back row of a table
+     */
+    void flush(Table& table, const Row& row) {
+        std::stringstream line;
+        line << std::setprecision(8) <<
+            row.id << '\t' <<
+            row.version << '\t' <<
+            row.minor << '\t' <<
+            't' << '\t' <<
+            row.user_id << '\t' <<
+            DbCopyConn::escape_string(row.user_name) << '\t' <<
+            Timestamp::formatDb(row.valid_from) << '\t' <<
+            Timestamp::formatDb(row.valid_to) << '\t' <<
+            row.tags << '\t' <<
+            row.z_order << '\t';
+
+        if(table.polygon) {
+            line << row.area << '\t' << row.part << '\t' << row.geom << '\t' << row.center;
+        } else {
+            line << row.geom;
+        }
+
+        // like PartitionedCopyConn, the range is the last column
+        if(m_validityRange) {
+            line << "\t[" << Timestamp::format(row.valid_from) << ',' << (row.valid_to ? Timestamp::format(row.valid_to) : "") << ')';
+        }
+
+        line << '\n';
+
+        table.conn.copy(line.str());
+        m_written++;
+    }
+
+    /**
+     * write all held back rows of a table
+     */
+    void flush(Table& table) {
+        for(std::map<size_t, Row>::const_iterator it = table.pending.begin(); it != table.pending.end(); ++it) {
+            flush(table, it->second);
+        }
+        table.pending.clear();
+    }
+
+    /**
+     * hold back the row, or merge it into the held back one if that one is
+     * the previous row of the same part of the same way and looks the same
+     */
+    void add(Table& table, const Row& row) {
+        if(!table.pending.empty() && table.pending.begin()->second.id != row.id) {
+            flush(table);
+        }
+
+        std::map<size_t, Row>::iterator it = table.pending.find(row.part);
+        if(it != table.pending.end()) {
+            Row& pending = it->second;
+            if(pending.valid_to == row.valid_from && pending.tags == row.tags && pending.geom == row.geom) {
+                pending.valid_to = row.valid_to;
+                m_dropped++;
+                return;
+            }
+
+            flush(table, pending);
+        }
+
+        table.pending[row.part] = row;
+    }
+
+public:
+    Generalizer(int zoom) : m_zoom(zoom), m_prefix(), m_validityRange(false), m_wkb(), m_written(0), m_dropped(0), m_small(0) {
+        const char *bases[] = {"line", "roads", "polygon"};
+        for(int i = 0; i < TABLES; i++) {
+            m_tables[i].base = bases[i];
+            m_tables[i].polygon = (i == POLYGON);
+        }
+
+        m_wkb.setIncludeSRID(true);
+    }
+
+    int zoom() const {
+        return m_zoom;
+    }
+
+    bool hasValidityRange() const {
+        return m_validityRange;
+    }
+
+    /**
+     * append the validity as a tsrange column to each row, needs to be
+     * set if the full tables have that column
+     */
+    void validityRange(bool shouldWriteRange) {
+        m_validityRange = shouldWriteRange;
+    }
+
+    /**
+     * the size of a pixel in projected meters at the zoom level, with
+     * tiles of 256x256 pixels
+     */
+    double pixelSize() const {
+        return 2 * M_PI * 6378137.0 / 256 / pow(2.0, m_zoom);
+    }
+
+    /**
+     * the tolerance the geometries are simplified with
+     */
+    double tolerance() const {
+        return pixelSize() / 2;
+    }
+
+    /**
+     * name of a generalized table, without the prefix
+     */
+    std::string table(const std::string& base) const {
+        std::stringstream name;
+        name << base << "_z" << m_zoom;
+        return name.str();
+    }
+
+    /**
+     * (re-)create the generalized tables with the layout of the full
+     * tables, which need to exist already
+     */
+    void create(DbConn& conn, const std::string& prefix) {
+        m_prefix = prefix;
+
+        for(int i = 0; i < TABLES; i++) {
+            std::string full = prefix + m_tables[i].base;
+            std::string generalized = prefix + table(m_tables[i].base);
+
+            std::stringstream cmd;
+            // the geometry column keeps the type modifier (PostGIS 2) or the
+            // constraints (PostGIS 1) of the full table, Populate_Geometry_Columns
+            // registers it from those
+            cmd << "DROP TABLE IF EXISTS " << generalized << " CASCADE;" <<
+                "CREATE TABLE " << generalized << " (LIKE " << full << " INCLUDING DEFAULTS INCLUDING CONSTRAINTS);" <<
+                "SELECT Populate_Geometry_Columns('" << generalized << "'::regclass);";
+
+            conn.exec(cmd.str());
+        }
+    }
+
+    /**
+     * open the COPY pipes into the generalized tables
+     */
+    void open(const std::string& dsn) {
+        for(int i = 0; i < TABLES; i++) {
+            m_tables[i].conn.open(dsn, m_prefix, table(m_tables[i].base));
+        }
+    }
+
+    /**
+     * write the held back rows and close the COPY pipes
+     */
+    void close() {
+        for(int i = 0; i < TABLES; i++) {
+            flush(m_tables[i]);
+            m_tables[i].conn.close();
+        }
+    }
+
+    /**
+     * create the primary keys and indexes of the generalized tables, like
+     * 99-after.sql does for the full tables
+     */
+    void index(DbConn& conn) {
+        for(int i = 0; i < TABLES; i++) {
+            std::string generalized = m_prefix + table(m_tables[i].base);
+
+            std::stringstream cmd;
+            cmd << "ALTER TABLE " << generalized << " ADD PRIMARY KEY (id, version, minor" << (m_tables[i].polygon ? ", part" : "") << ");" <<
+                "CREATE INDEX " << generalized << "_geom_and_time_index ON " << generalized << " USING GIST (geom, valid_from, valid_to);";
+
+            // like 99-after-range.sql
+            if(m_validityRange) {
+                cmd << "CREATE INDEX " << generalized << "_geom_and_validity_index ON " << generalized << " USING GIST (geom, validity);";
+            }
+
+            conn.exec(cmd.str());
+        }
+    }
+
+    /**
+     * simplify and write a visible way version. tags are already in the
+     * hstore format, area and center are those of the full geometry.
+     * lines with the lowzoom flag are written to the roads-table, too.
+     * the polygons of a multipolygon are written as separate parts.
+     */
+    void write(
+        osm_object_id_t id,
+        osm_version_t version,
+        osm_version_t minor,
+        size_t part,
+        osm_user_id_t user_id,
+        const char* user_name,
+        time_t valid_from,
+        time_t valid_to,
+        const std::string& tags,
+        long z_order,
+        bool lowzoom,
+        const geos::geom::Geometry* geom,
+        double area,
+        const std::string& center
+    ) {
+        bool polygon = geom->getGeometryTypeId() == geos::geom::GEOS_POLYGON;
+
+        // a polygon smaller then a pixel would not be visible at all
+        if(polygon && area < pixelSize() * pixelSize()) {
+            m_small++;
+            return;
+        }
+
+        std::auto_ptr<geos::geom::Geometry> simplified;
+        try {
+            simplified = geos::simplify::TopologyPreservingSimplifier::simplify(geom, tolerance());
+        } catch(geos::util::GEOSException e) {
+            std::cerr << "error simplifying way " << id << 'v' << version << '.' << minor << ": " << e.what() << std::endl;
+            return;
+        }
+
+        if(!simplified.get() || simplified->isEmpty()) {
+            m_small++;
+            return;
+        }
+
+        Row row;
+        row.id = id;
+        row.version = version;
+        row.minor = minor;
+        row.part = part;
+        row.user_id = user_id;
+        row.user_name = user_name;
+        row.valid_from = valid_from;
+        row.valid_to = valid_to;
+        row.tags = tags;
+        row.z_order = z_order;
+        row.area = area;
+        row.center = center;
+
+        std::stringstream hex;
+        m_wkb.writeHEX(*simplified, hex);
+        row.geom = hex.str();
+
+        if(polygon) {
+            add(m_tables[POLYGON], row);
+        } else {
+            add(m_tables[LINE], row);
+            if(lowzoom) {
+                add(m_tables[ROADS], row);
+            }
+        }
+    }
+
+    /**
+     * print how many rows were written and dropped
+     */
+    void printStatistics() {
+        std::cerr << "zoom " << m_zoom << ": wrote " << m_written << " generalized rows, merged " << m_dropped << " rows identical to the previous one after simplification, left out " << m_small << " geometries smaller then a pixel" << std::endl;
+    }
+};
+
+#endif // IMPORTER_GENERALIZER_HPP
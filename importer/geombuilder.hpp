@@ -3,6 +3,9 @@
  * This class builds a geos geometry from this information, depending
  * on the tags, a way could possibly be a polygon. This information is
  * added additionally when building a portugal.
+ *
+ * The GeomBuilder is templated on the type of the nodestore and on a
+ * debug policy, so the lookups in its inner loop can be inlined.
  */
 
 #ifndef IMPORTER_GEOMBUILDER_HPP
@@ -10,23 +13,34 @@
 
 #include "project.hpp"
 
+template <class TNodestore, class TDebug>
 class GeomBuilder {
 private:
-    Nodestore *m_nodestore;
+    TNodestore *m_nodestore;
     DbAdapter *m_adapter;
     bool m_isupdate, m_keepLatLng;
     bool m_debug, m_showerrors;
 
+    /**
+     * coordinates of the nodes found in the store, reused between the ways
+     * so they are projected in one batch without allocating memory
+     */
+    std::vector<double> m_lon, m_lat;
+
 protected:
-    GeomBuilder(Nodestore *nodestore, DbAdapter *adapter, bool isUpdate): m_nodestore(nodestore), m_adapter(adapter), m_isupdate(isUpdate), m_debug(false), m_showerrors(false) {}
+    GeomBuilder(TNodestore *nodestore, DbAdapter *adapter, bool isUpdate): m_nodestore(nodestore), m_adapter(adapter), m_isupdate(isUpdate), m_debug(false), m_showerrors(false), m_lon(), m_lat() {}
 
 public:
-    geos::geom::Geometry* forWay(const Osmium::OSM::WayNodeList &nodes, time_t t, bool looksLikePolygon) {
-        // shorthand to the geometry factory
-        geos::geom::GeometryFactory *f = Osmium::Geometry::geos_geometry_factory();
+    /**
+     * do the coordinates from the nodestore need to be projected?
+     */
+    bool isProjecting() {
+        return !m_keepLatLng && !m_nodestore->isStoringMercator();
+    }
 
-        // pointer to coordinate vector
-        std::vector<geos::geom::Coordinate> *c = new std::vector<geos::geom::Coordinate>();
+    geos::geom::Geometry* forWay(const Osmium::OSM::WayNodeList &nodes, time_t t, bool looksLikePolygon) {
+        m_lon.clear();
+        m_lat.clear();
 
         // iterate over all nodes
         Osmium::OSM::WayNodeList::const_iterator end = nodes.end();
@@ -42,24 +56,47 @@ public:
             if(!found)
                 continue;
 
-            double lon = info.lon, lat = info.lat;
-
-            if(m_debug) {
-                std::cerr << "node #" << id << " at tstamp " << t << " references node at POINT(" << std::setprecision(8) << lon << ' ' << lat << ')' << std::endl;
+            if(TDebug::enabled && m_debug) {
+                std::cerr << "node #" << id << " at tstamp " << t << " references node at POINT(" << std::setprecision(8) << info.lon << ' ' << info.lat << ')' << std::endl;
             }
 
-            // create a coordinate-object and add it to the vector
-            if(!m_keepLatLng) {
-                if(!Project::toMercator(&lon, &lat))
-                    continue;
-            }
-            c->push_back(geos::geom::Coordinate(lon, lat, DoubleNotANumber));
+            m_lon.push_back(info.lon);
+            m_lat.push_back(info.lat);
+        }
+
+        // project all coordinates at once, unless the nodestore already
+        // contains projected coordinates
+        if(isProjecting() && !m_lon.empty()) {
+            Project::toMercator(&m_lon[0], &m_lat[0], m_lon.size());
+        }
+
+        return m_lon.empty() ? forCoordinates(NULL, NULL, 0, looksLikePolygon) : forCoordinates(&m_lon[0], &m_lat[0], m_lon.size(), looksLikePolygon);
+    }
+
+    /**
+     * build the geometry from count already projected coordinates,
+     * coordinates that could not be projected are NaN and skipped
+     */
+    geos::geom::Geometry* forCoordinates(const double *lon, const double *lat, size_t count, bool looksLikePolygon) {
+        // shorthand to the geometry factory
+        geos::geom::GeometryFactory *f = Osmium::Geometry::geos_geometry_factory();
+
+        // pointer to coordinate vector
+        std::vector<geos::geom::Coordinate> *c = new std::vector<geos::geom::Coordinate>();
+        c->reserve(count);
+
+        // create a coordinate-object for each node and add it to the vector
+        for(size_t i = 0; i < count; i++) {
+            if(lon[i] != lon[i])
+                continue;
+
+            c->push_back(geos::geom::Coordinate(lon[i], lat[i], DoubleNotANumber));
         }
 
         // if less then 2 nodes could be found in the store, no valid way
         // can be assembled and we need to skip it
         if(c->size() < 2) {
-            if(m_showerrors) {
+            if(TDebug::enabled && m_showerrors) {
                 std::cerr << "found only " << c->size() << " valid coordinates, skipping way" << std::endl;
             }
             delete c;
@@ -88,7 +125,7 @@ public:
                 );
             }
         } catch(geos::util::GEOSException e) {
-            if(m_showerrors) {
+            if(TDebug::enabled && m_showerrors) {
                 std::cerr << "error creating polygon: " << e.what() << std::endl;
             }
             delete c;
@@ -103,6 +140,13 @@ public:
         return geom;
     }
 
+    /**
+     * change the nodestore the geometries are built from
+     */
+    void nodestore(TNodestore *nodestore) {
+        m_nodestore = nodestore;
+    }
+
     bool isKeepingLatLng() {
         return m_keepLatLng;
     }
@@ -126,14 +170,16 @@ public:
     }
 };
 
-class ImportGeomBuilder : public GeomBuilder {
+template <class TNodestore, class TDebug>
+class ImportGeomBuilder : public GeomBuilder<TNodestore, TDebug> {
 public:
-    ImportGeomBuilder(Nodestore *nodestore, DbAdapter *adapter) : GeomBuilder(nodestore, adapter, false) {}
+    ImportGeomBuilder(TNodestore *nodestore, DbAdapter *adapter) : GeomBuilder<TNodestore, TDebug>(nodestore, adapter, false) {}
 };
 
-class UpdateGeomBuilder : public GeomBuilder {
+template <class TNodestore, class TDebug>
+class UpdateGeomBuilder : public GeomBuilder<TNodestore, TDebug> {
 public:
-    UpdateGeomBuilder(Nodestore *nodestore, DbAdapter *adapter) : GeomBuilder(nodestore, adapter, true) {}
+    UpdateGeomBuilder(TNodestore *nodestore, DbAdapter *adapter) : GeomBuilder<TNodestore, TDebug>(nodestore, adapter, true) {}
 };
 
 #endif // IMPORTER_GEOMBUILDER_HPP
@@ -0,0 +1,124 @@
+/**
+ * By default a minor way version is written for every second in which a
+ * node of the way changed. Renderings that only show one state per day or
+ * per month don't need that many versions. The granularity buckets the
+ * minor times into intervals of a second, minute, hour, day, month,
+ * quarter or year (in UTC), and only the last minor time of each bucket
+ * is kept.
+ */
+
+#ifndef IMPORTER_GRANULARITY_HPP
+#define IMPORTER_GRANULARITY_HPP
+
+#include <ctime>
+
+/**
+ * Maps timestamps to the start of the interval they belong to
+ */
+class Granularity {
+public:
+    enum Unit {
+        SECOND,
+        MINUTE,
+        HOUR,
+        DAY,
+        MONTH,
+        QUARTER,
+        YEAR
+    };
+
+    /**
+     * parse the name of a granularity, returns false if it is unknown
+     */
+    static bool parse(const std::string& name, Unit &unit) {
+        if(name == "second") {
+            unit = SECOND;
+        } else if(name == "minute") {
+            unit = MINUTE;
+        } else if(name == "hour") {
+            unit = HOUR;
+        } else if(name == "day") {
+            unit = DAY;
+        } else if(name == "month") {
+            unit = MONTH;
+        } else if(name == "quarter") {
+            unit = QUARTER;
+        } else if(name == "year") {
+            unit = YEAR;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * the start of the interval the timestamp t belongs to
+     */
+    static time_t bucket(time_t t, Unit unit) {
+        switch(unit) {
+            case SECOND:
+                return t;
+
+            case MINUTE:
+                return t - t % 60;
+
+            case HOUR:
+                return t - t % 3600;
+
+            case DAY:
+                return t - t % 86400;
+
+            case MONTH:
+            case QUARTER:
+            case YEAR: {
+                struct tm tm;
+                gmtime_r(&t, &tm);
+                if(unit == QUARTER) {
+                    tm.tm_mon -= tm.tm_mon % 3;
+                } else if(unit == YEAR) {
+                    tm.tm_mon = 0;
+                }
+                tm.tm_mday = 1;
+                tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+                return timegm(&tm);
+            }
+        }
+
+        return t;
+    }
+
+    /**
+     * the start of the interval following the one the timestamp t
+     * belongs to
+     */
+    static time_t next(time_t t, Unit unit) {
+        time_t start = bucket(t, unit);
+        switch(unit) {
+            case SECOND:
+                return start + 1;
+
+            case MINUTE:
+                return start + 60;
+
+            case HOUR:
+                return start + 3600;
+
+            case DAY:
+                return start + 86400;
+
+            case MONTH:
+            case QUARTER:
+            case YEAR: {
+                // timegm normalizes the overflowing month
+                struct tm tm;
+                gmtime_r(&start, &tm);
+                tm.tm_mon += (unit == MONTH ? 1 : unit == QUARTER ? 3 : 12);
+                return timegm(&tm);
+            }
+        }
+
+        return start + 1;
+    }
+};
+
+#endif // IMPORTER_GRANULARITY_HPP
@@ -11,14 +11,19 @@
 
 #include <geos/algorithm/InteriorPointArea.h>
 #include <geos/io/WKBWriter.h>
+#include <geos/geom/CoordinateFilter.h>
 
 #include "dbconn.hpp"
 #include "dbcopyconn.hpp"
+#include "partitionedcopyconn.hpp"
+#include "parallelexec.hpp"
+#include "clustersorter.hpp"
 #include "dbadapter.hpp"
 
 #include "nodestore.hpp"
 #include "nodestore/stl.hpp"
 #include "nodestore/sparse.hpp"
+#include "nodestore/adaptive.hpp"
 
 #include "entitytracker.hpp"
 #include "polygonidentifyer.hpp"
@@ -26,43 +31,154 @@
 #include "hstore.hpp"
 #include "timestamp.hpp"
 #include "geombuilder.hpp"
-#include "minortimescalculator.hpp"
+#include "nodestorecache.hpp"
+#include "minorsweep.hpp"
+#include "timewindow.hpp"
 #include "sorttest.hpp"
+#include "debugpolicy.hpp"
 #include "project.hpp"
-
-
+#include "idset.hpp"
+#include "externaljoin.hpp"
+#include "generalizer.hpp"
+#include "polygonsplitter.hpp"
+#include "memberways.hpp"
+#include "multipolygonbuilder.hpp"
+
+
+/**
+ * The ImportHandler is templated on the type of the nodestore and on a
+ * debug policy (see debugpolicy.hpp), so the nodestore lookups in the
+ * innermost loops can be inlined and the debug code is compiled out
+ * unless debug messages have been requested.
+ */
+template <class TNodestore, class TDebug>
 class ImportHandler : public Osmium::Handler::Base {
 private:
     Osmium::Handler::Progress m_progress;
     EntityTracker<Osmium::OSM::Node> m_node_tracker;
     EntityTracker<Osmium::OSM::Way> m_way_tracker;
+    EntityTracker<Osmium::OSM::Relation> m_relation_tracker;
+
+    TNodestore *m_store;
+
+    /**
+     * the geometries and minor times are built from the nodes cached for
+     * the current way
+     */
+    typedef NodestoreCache<TNodestore, TDebug> cache_t;
+    cache_t m_cache;
 
-    Nodestore *m_store;
     DbAdapter m_adapter;
-    ImportGeomBuilder m_geom;
-    ImportMinorTimesCalculator m_mtimes;
+    ImportGeomBuilder<cache_t, TDebug> m_geom;
+    MinorSweep<cache_t, TDebug> m_sweep;
     SortTest m_sorttest;
 
     DbConn m_general;
-    DbCopyConn m_point, m_line, m_polygon;
+    PartitionedCopyConn m_point, m_line, m_roads, m_polygon;
+    DbCopyConn m_way;
+
+    /**
+     * number of connections the indexes of the partitions are built with
+     */
+    size_t m_indexJobs;
+
+    /**
+     * are the rows sorted by their Hilbert cell before copying, and are
+     * the tables indexed with BRIN instead of GiST?
+     */
+    bool m_clustered, m_brin;
+
+    /**
+     * the tables with lon/lat geometries written with --latlng-tables
+     */
+    DbCopyConn m_point4326, m_line4326, m_roads4326, m_polygon4326;
+
+    /**
+     * the tables with the versions still valid written with
+     * --current-tables, and the time of the last change in the data
+     */
+    DbCopyConn m_currentPoint, m_currentLine, m_currentRoads, m_currentPolygon;
+    bool m_currentTables;
+    time_t m_lastTimestamp;
 
     geos::io::WKBWriter wkb;
 
     std::string m_dsn, m_prefix;
-    bool m_debug, m_storeerrors, m_interior, m_keepLatLng;
+    bool m_debug, m_storeerrors, m_interior, m_keepLatLng, m_projectNodes, m_lazy, m_latlngTables;
+
+    std::string m_writeSnapshot, m_readSnapshot;
+
+    IdSet *m_referencedNodes;
+
+    /**
+     * the nodes and ways belonging to the region the import is restricted
+     * to, NULL if it is not
+     */
+    IdSet *m_regionNodes, *m_regionWays;
+
+    /**
+     * the window of time the import is restricted to
+     */
+    TimeWindow m_window;
+
+    ExternalJoin *m_join;
+
+    /**
+     * one generalizer for each zoom level generalized tables are written for
+     */
+    std::vector<Generalizer*> m_generalizers;
+
+    /**
+     * splits large polygons into several rows
+     */
+    PolygonSplitter m_splitter;
+
+    /**
+     * the coordinates of the ways that are members of multipolygon
+     * relations and the builder assembling the relations from them. NULL
+     * if relations are not imported.
+     */
+    MemberWays *m_memberWays;
+    MultipolygonBuilder *m_multipolygon;
+
+    /**
+     * id and version of the last major way version written and whether
+     * a valid geometry was built for it and if it was a polygon. used to
+     * decide between line and area for a deleted way without building
+     * the geometry of the previous version again.
+     */
+    osm_object_id_t m_lastMajorId;
+    osm_version_t m_lastMajorVersion;
+    bool m_lastMajorValid, m_lastMajorPolygon;
 
     std::map<osm_user_id_t, std::string> m_username_map;
     typedef std::pair<osm_user_id_t, std::string> username_pair_t;
 
+    /**
+     * should debug messages be printed? always false with DebugDisabled
+     */
+    bool debug() {
+        return TDebug::enabled && m_debug;
+    }
+
+    /**
+     * should store errors be printed? always false with DebugDisabled
+     */
+    bool storeErrors() {
+        return TDebug::enabled && m_storeerrors;
+    }
+
 
     void write_node() {
         const shared_ptr<Osmium::OSM::Node const> next = m_node_tracker.next();
         const shared_ptr<Osmium::OSM::Node const> cur = m_node_tracker.cur();
 
-        if(m_debug) {
+        if(debug()) {
             std::cout << "node n" << cur->id() << 'v' << cur->version() << " at tstamp " << cur->timestamp() << " (" << Timestamp::format(cur->timestamp()) << ")" << std::endl;
         }
 
+        m_lastTimestamp = std::max(m_lastTimestamp, cur->timestamp());
+
         std::string valid_from(cur->timestamp_as_string());
         std::string valid_to("\\N");
 
@@ -76,6 +192,18 @@ private:
             valid_to = valid_from;
         }
 
+        // the version is only needed to build geometries if it is valid inside of the time window
+        time_t window_from = cur->timestamp();
+        time_t window_to = m_node_tracker.next_is_same_entity() ? next->timestamp() : (cur->visible() ? 0 : window_from);
+        bool needed = m_window.overlaps(window_from, window_to);
+
+        // and written to the point-table with the validity clipped to the window
+        bool written = m_window.clip(window_from, window_to);
+        if(written && m_window.isRestricting()) {
+            valid_from = Timestamp::format(window_from);
+            valid_to = Timestamp::formatDb(window_to);
+        }
+
         // some xml-writers write deleted nodes without corrdinates, some write 0/0 as coorinate
         // default to 0/0 for those input nodes which dosn't carry corrdinates with them
         double lon = 0, lat = 0;
@@ -85,20 +213,43 @@ private:
             lat = cur->lat();
         }
 
+        // the coordinates written to the point-table, lon and lat are written
+        // to the lon/lat point-table
+        double x = lon, y = lat;
+        double pointLon = lon, pointLat = lat;
+        bool projected = true;
+        if(!m_keepLatLng) {
+            projected = Project::toMercator(&x, &y);
+        }
+
+        // when the nodestore stores projected coordinates, record those. nodes
+        // that can't be projected would be skipped by the GeomBuilder anyway
+        if(m_projectNodes) {
+            lon = x;
+            lat = y;
+        }
+
         // if this node is not-deleted (ie visible), write it to the nodestore
         // some osm-writers write invisible nodes with 0/0 coordinates which would screw up rendering, if not ignored in the nodestore
         // see https://github.com/MaZderMind/osm-history-renderer/issues/8
-        if(cur->visible())
+        // when the nodestore was read from a snapshot, it already contains this node
+        // when only nodes referenced by ways are stored, all others are not needed to build geometries
+        // in the external join mode, the node is spilled to disk instead of being recorded in the nodestore
+        // versions outside of the time window are not needed at all
+        if(cur->visible() && needed && (!m_referencedNodes || m_referencedNodes->test(cur->id())) && (projected || !m_projectNodes))
         {
-            m_store->record(cur->id(), cur->uid(), cur->timestamp(), lon, lat);
+            if(m_join) {
+                m_join->recordNode(cur->id(), cur->uid(), cur->timestamp(), lon, lat);
+            }
+            else if(m_readSnapshot.empty()) {
+                m_store->record(cur->id(), cur->uid(), cur->timestamp(), lon, lat);
+            }
         }
 
         m_username_map.insert( username_pair_t(cur->uid(), std::string(cur->user()) ) );
 
-        if(!m_keepLatLng) {
-            if(!Project::toMercator(&lon, &lat))
-                return;
-        }
+        if(!projected || !written)
+            return;
 
         // SPEED: sum up 64k of data, before sending them to the database
         // SPEED: instead of stringstream, which does dynamic allocation, use a fixed buffer and snprintf
@@ -113,41 +264,95 @@ private:
             valid_to << '\t' <<
             HStore::format(cur->tags()) << '\t';
 
+        std::string meta = line.str();
+
         if(cur->visible()) {
-            line << "SRID=900913;POINT(" << lon << ' ' << lat << ')';
+            line << "SRID=900913;POINT(" << x << ' ' << y << ')';
         } else {
             line << "\\N";
         }
 
         line << '\n';
-        m_point.copy(line.str());
+        m_point.copy(window_from, window_to, cur->visible() ? cluster_cell(x, y) : ClusterSorter::NO_CELL, line.str());
+
+        if(m_latlngTables) {
+            std::stringstream latlng;
+            latlng << std::setprecision(10) << meta;
+
+            if(cur->visible()) {
+                latlng << "SRID=4326;POINT(" << pointLon << ' ' << pointLat << ')';
+            } else {
+                latlng << "\\N";
+            }
+
+            latlng << '\n';
+            m_point4326.copy(latlng.str());
+        }
+
+        if(m_currentTables && cur->visible() && window_to == 0) {
+            std::stringstream current;
+            current << std::setprecision(8) <<
+                cur->id() << '\t' <<
+                HStore::format(cur->tags()) << '\t' <<
+                "SRID=900913;POINT(" << x << ' ' << y << ")\n";
+            m_currentPoint.copy(current.str());
+        }
     }
 
     void write_way() {
         const shared_ptr<Osmium::OSM::Way const> next = m_way_tracker.next();
         const shared_ptr<Osmium::OSM::Way const> cur = m_way_tracker.cur();
 
-        if(m_debug) {
+        if(debug()) {
             std::cout << "way w" << cur->id() << 'v' << cur->version() << " at tstamp " << cur->timestamp() << " (" << Timestamp::format(cur->timestamp()) << ")" << std::endl;
         }
 
+        m_lastTimestamp = std::max(m_lastTimestamp, cur->timestamp());
+
+        if(m_lazy) {
+            write_lazy_way();
+            return;
+        }
+
         time_t valid_from = cur->timestamp();
         time_t valid_to = 0;
 
-        std::vector<MinorTimesCalculator::MinorTimesInfo> *minor_times = NULL;
+        // the part of the version inside of the time window, the geometries
+        // are only built in there
+        time_t window_from = cur->timestamp();
+        time_t window_to = m_way_tracker.next_is_same_entity() ? next->timestamp() : (cur->visible() ? 0 : window_from);
+        if(m_window.isRestricting()) {
+            if(!m_window.overlaps(window_from, window_to)) {
+                return;
+            }
+
+            if(window_from < m_window.since()) {
+                window_from = valid_from = m_window.since();
+            }
+            if(m_window.until() != 0 && (window_to == 0 || window_to > m_window.until())) {
+                window_to = m_window.until();
+            }
+        }
+
+        // keep the cached nodes while writing versions of the same way
+        m_cache.way(cur->id());
+
+        const std::vector<MinorTimesInfo> *minor_times = NULL;
         if(cur->visible()) {
             if(m_way_tracker.next_is_same_entity()) {
                 if(cur->timestamp() > next->timestamp()) {
-                    if(m_storeerrors) {
+                    if(storeErrors()) {
                         std::cerr << "inverse timestamp-order in way " << cur->id() << " between v" << cur->version() << " and v" << next->version() << ", skipping minor ways" << std::endl;
                     }
                 } else {
                     // collect minor ways between current and next
-                    minor_times = m_mtimes.forWay(cur->nodes(), cur->timestamp(), next->timestamp());
+                    m_sweep.start(cur->nodes(), window_from, window_to, m_geom.isProjecting());
+                    minor_times = &m_sweep.times();
                 }
             } else {
                 // collect minor ways between current and the end
-                minor_times = m_mtimes.forWay(cur->nodes(), cur->timestamp());
+                m_sweep.start(cur->nodes(), window_from, window_to, m_geom.isProjecting());
+                minor_times = &m_sweep.times();
             }
         }
 
@@ -174,7 +379,7 @@ private:
             cur->visible(),
             cur->uid(),
             cur->user(),
-            cur->timestamp(),
+            window_from,
             valid_from,
             valid_to,
             cur->tags(),
@@ -182,11 +387,13 @@ private:
         );
 
         if(minor_times) {
+            bool looksLikePolygon = PolygonIdentifyer::looksLikePolygon(cur->tags());
+
             // write the minor way versions of current between current & next
             int minor = 1;
-            std::vector<MinorTimesCalculator::MinorTimesInfo>::const_iterator end = minor_times->end();
-            for(std::vector<MinorTimesCalculator::MinorTimesInfo>::const_iterator it = minor_times->begin(); it != end; it++) {
-                if(m_debug) {
+            std::vector<MinorTimesInfo>::const_iterator end = minor_times->end();
+            for(std::vector<MinorTimesInfo>::const_iterator it = minor_times->begin(); it != end; it++) {
+                if(debug()) {
                     std::cout << "minor way w" << cur->id() << 'v' << cur->version() << '.' << minor << " at tstamp " << (*it).t << " (" << Timestamp::format( (*it).t ) << ")" << std::endl;
                 }
 
@@ -205,26 +412,186 @@ private:
                 osm_user_id_t uid = (*it).uid;
                 const char* user = m_username_map[ uid ].c_str();
 
-                write_way_to_db(
-                    cur->id(),
-                    cur->version(),
-                    minor,
-                    true,
-                    uid,
-                    user,
-                    t,
-                    valid_from,
-                    valid_to,
-                    cur->tags(),
-                    cur->nodes()
-                );
+                // apply the node changes of this minor version to the coordinates of the previous one
+                m_sweep.advance(t);
+
+                // no need to build the geometry of a minor version outside of the time window
+                if(!m_window.keeps(valid_from, valid_to)) {
+                    minor++;
+                    continue;
+                }
+
+                geos::geom::Geometry* geom = m_geom.forCoordinates(m_sweep.lon(), m_sweep.lat(), m_sweep.size(), looksLikePolygon);
+
+                if(geom) {
+                    write_geom_to_db(
+                        cur->id(),
+                        cur->version(),
+                        minor,
+                        true,
+                        uid,
+                        user,
+                        valid_from,
+                        valid_to,
+                        cur->tags(),
+                        geom
+                    );
+                } else if(debug()) {
+                    std::cerr << "no valid geometry for way " << cur->id() << 'v' << cur->version() << '.' << minor << " at tstamp " << t << std::endl;
+                }
 
                 minor++;
             }
-            delete minor_times;
         }
     }
 
+    /**
+     * in the lazy mode, only the node list of a way version is written,
+     * together with the bounding box of all positions its nodes take while
+     * it is valid. the geometries are assembled from the node history in
+     * the database when they are queried (see scheme/99-after-lazy.sql).
+     */
+    void write_lazy_way() {
+        const shared_ptr<Osmium::OSM::Way const> next = m_way_tracker.next();
+        const shared_ptr<Osmium::OSM::Way const> cur = m_way_tracker.cur();
+
+        time_t valid_from = cur->timestamp();
+        time_t valid_to = 0;
+
+        // if this is another version of the same entity, the end-timestamp of the current entity is the timestamp of the next one
+        if(m_way_tracker.next_is_same_entity()) {
+            valid_to = next->timestamp();
+        }
+
+        // if the current version is deleted, it's end-timestamp is the same as its creation-timestamp
+        else if(!cur->visible()) {
+            valid_to = valid_from;
+        }
+
+        if(!m_window.clip(valid_from, valid_to)) {
+            return;
+        }
+
+        std::stringstream line;
+        line << std::setprecision(8) <<
+            cur->id() << '\t' <<
+            cur->version() << '\t' <<
+            (cur->visible() ? 't' : 'f') << '\t' <<
+            cur->uid() << '\t' <<
+            DbCopyConn::escape_string(cur->user()) << '\t' <<
+            Timestamp::formatDb(valid_from) << '\t' <<
+            Timestamp::formatDb(valid_to) << '\t' <<
+            HStore::format(cur->tags()) << '\t' <<
+            ZOrderCalculator::calculateZOrder(cur->tags()) << '\t' <<
+            (PolygonIdentifyer::looksLikePolygon(cur->tags()) ? 't' : 'f') << '\t';
+
+        // the node list as a postgres array
+        line << '{';
+        Osmium::OSM::WayNodeList::const_iterator end = cur->nodes().end();
+        for(Osmium::OSM::WayNodeList::const_iterator it = cur->nodes().begin(); it != end; ++it) {
+            if(it != cur->nodes().begin()) {
+                line << ',';
+            }
+            line << it->ref();
+        }
+        line << "}\t";
+
+        // the bounding box of the nodes over the whole validity of the version
+        double minx, miny, maxx, maxy;
+        bool bounded = false;
+        if(cur->visible() && m_way_tracker.next_is_same_entity() && cur->timestamp() > next->timestamp()) {
+            if(storeErrors()) {
+                std::cerr << "inverse timestamp-order in way " << cur->id() << " between v" << cur->version() << " and v" << next->version() << std::endl;
+            }
+        } else if(cur->visible()) {
+            m_cache.way(cur->id());
+            m_sweep.start(cur->nodes(), valid_from, valid_to, m_geom.isProjecting());
+            bounded = m_sweep.bounds(minx, miny, maxx, maxy);
+        }
+
+        if(bounded) {
+            line << "SRID=900913;POLYGON((" <<
+                minx << ' ' << miny << ',' <<
+                maxx << ' ' << miny << ',' <<
+                maxx << ' ' << maxy << ',' <<
+                minx << ' ' << maxy << ',' <<
+                minx << ' ' << miny << "))";
+        } else {
+            line << "\\N";
+        }
+
+        line << '\n';
+        m_way.copy(line.str());
+    }
+
+    /**
+     * run one of the sql files in the scheme directory
+     */
+    void exec_scheme(const std::string& name) {
+        if(debug()) {
+            std::cerr << "running scheme/" << name << std::endl;
+        }
+
+        std::ifstream sqlfile(("scheme/" + name).c_str());
+        if(!sqlfile)
+            sqlfile.open(("/usr/share/osm-history-importer/scheme/" + name).c_str());
+
+        if(!sqlfile)
+            throw std::runtime_error("can't find " + name);
+
+        m_general.execfile(sqlfile);
+    }
+
+    void track_way(const shared_ptr<Osmium::OSM::Way const>& way) {
+        m_way_tracker.feed(way);
+
+        // we're always writing the one-off way
+        if(m_way_tracker.has_cur()) {
+            write_way();
+        }
+
+        m_way_tracker.swap();
+    }
+
+    void flush_ways() {
+        if(m_way_tracker.has_cur()) {
+            write_way();
+        }
+
+        m_way_tracker.swap();
+    }
+
+    /**
+     * read back the ways spilled by the external join, one way with all
+     * its versions at a time, and write them using a nodestore that
+     * contains only the nodes referenced by that way. the external join
+     * is run with TNodestore being the stl nodestore.
+     */
+    void write_joined_ways() {
+        m_join->join();
+
+        std::vector< shared_ptr<Osmium::OSM::Way const> > versions;
+        while(true) {
+            TNodestore store;
+            store.printDebugMessages(m_debug);
+            store.printStoreErrors(m_storeerrors);
+            store.storeMercator(m_projectNodes);
+
+            if(!m_join->nextGroup(versions, &store))
+                break;
+
+            m_cache.nodestore(&store);
+
+            std::vector< shared_ptr<Osmium::OSM::Way const> >::const_iterator end = versions.end();
+            for(std::vector< shared_ptr<Osmium::OSM::Way const> >::const_iterator it = versions.begin(); it != end; ++it) {
+                track_way(*it);
+            }
+            flush_ways();
+        }
+
+        m_cache.nodestore(m_store);
+    }
+
     void write_way_to_db(
         osm_object_id_t id,
         osm_version_t version,
@@ -238,7 +605,7 @@ private:
         const Osmium::OSM::TagList &tags,
         const Osmium::OSM::WayNodeList &nodes
     ) {
-        if(m_debug) {
+        if(debug()) {
             std::cerr << "forging geometry of way " << id << 'v' << version << '.' << minor << " at tstamp " << timestamp << std::endl;
         }
 
@@ -246,28 +613,61 @@ private:
         if(visible) {
             bool looksLikePolygon = PolygonIdentifyer::looksLikePolygon(tags);
             geom = m_geom.forWay(nodes, timestamp, looksLikePolygon);
+
+            if(minor == 0) {
+                m_lastMajorId = id;
+                m_lastMajorVersion = version;
+                m_lastMajorValid = (geom != NULL);
+                m_lastMajorPolygon = geom && geom->getGeometryTypeId() == geos::geom::GEOS_POLYGON;
+            }
+
             if(!geom) {
-                if(m_debug) {
+                if(debug()) {
                     std::cerr << "no valid geometry for way " << id << 'v' << version << '.' << minor << " at tstamp " << timestamp << std::endl;
                 }
                 return;
             }
         }
 
+        write_geom_to_db(id, version, minor, visible, user_id, user_name, valid_from, valid_to, tags, geom);
+    }
+
+    /**
+     * write a way version with an already built geometry, which is deleted
+     * afterwards. geom is NULL for deleted ways.
+     */
+    void write_geom_to_db(
+        osm_object_id_t id,
+        osm_version_t version,
+        osm_version_t minor,
+        bool visible,
+        osm_user_id_t user_id,
+        const char* user_name,
+        time_t valid_from,
+        time_t valid_to,
+        const Osmium::OSM::TagList &tags,
+        geos::geom::Geometry* geom
+    ) {
+        if(!m_window.clip(valid_from, valid_to)) {
+            delete geom;
+            return;
+        }
+
+        std::string hstore = HStore::format(tags);
+        bool lowzoom;
+        long z_order = ZOrderCalculator::calculateZOrder(tags, lowzoom);
+
         // SPEED: sum up 64k of data, before sending them to the database
         // SPEED: instead of stringstream, which does dynamic allocation, use a fixed buffer and snprintf
+        std::string meta = row_meta(id, version, minor, visible, user_id, user_name, valid_from, valid_to, hstore, z_order);
+
         std::stringstream line;
-        line << std::setprecision(8) <<
-            id << '\t' <<
-            version << '\t' <<
-            minor << '\t' <<
-            (visible ? 't' : 'f') << '\t' <<
-            user_id << '\t' <<
-            DbCopyConn::escape_string(user_name) << '\t' <<
-            Timestamp::formatDb(valid_from) << '\t' <<
-            Timestamp::formatDb(valid_to) << '\t' <<
-            HStore::format(tags) << '\t' <<
-            ZOrderCalculator::calculateZOrder(tags) << '\t';
+        line << std::setprecision(8) << meta;
+
+        // keep the coordinates of multipolygon members for assembling the relations
+        if(geom && m_memberWays && m_memberWays->isMember(id)) {
+            m_memberWays->record(id, valid_from, valid_to, geom);
+        }
 
         if(geom == NULL) {
             // this entity is deleted, we have no nd-refs and no tags from it to devide whether it once was a line or an areas
@@ -277,23 +677,41 @@ private:
 
                 const shared_ptr<Osmium::OSM::Way const> prev = m_way_tracker.prev();
 
-                bool looksLikePolygon = PolygonIdentifyer::looksLikePolygon(prev->tags());
-                geom = m_geom.forWay(prev->nodes(), prev->timestamp(), looksLikePolygon);
+                // the major version of prev has just been written, so its geometry is usually known already
+                bool valid, polygon;
+                if(m_lastMajorId == prev->id() && m_lastMajorVersion == prev->version()) {
+                    valid = m_lastMajorValid;
+                    polygon = m_lastMajorPolygon;
+                } else {
+                    bool looksLikePolygon = PolygonIdentifyer::looksLikePolygon(prev->tags());
+                    geom = m_geom.forWay(prev->nodes(), prev->timestamp(), looksLikePolygon);
+
+                    valid = (geom != NULL);
+                    polygon = geom && geom->getGeometryTypeId() == geos::geom::GEOS_POLYGON;
+                    delete geom;
+                    geom = NULL;
+                }
 
-                if(!geom) {
-                    if(m_debug) {
+                if(!valid) {
+                    if(debug()) {
                         std::cerr << "no valid geometry for way of " << prev->id() << 'v' << prev->version() << " which was consulted to determine if the deleted way " <<
                             id << "v" << version << " once was an area or a line. skipping that double-deleted way." << std::endl;
                     }
                     return;
                 }
 
-                if(geom->getGeometryTypeId() == geos::geom::GEOS_POLYGON) {
-                    line << /*area*/ "0\t" << /* geom */ "\\N\t" << /* center */ "\\N\n";
-                    m_polygon.copy(line.str());
+                if(polygon) {
+                    line << /*area*/ "0\t" << /* part */ "0\t" << /* geom */ "\\N\t" << /* center */ "\\N\n";
+                    m_polygon.copy(valid_from, valid_to, line.str());
+                    if(m_latlngTables) {
+                        m_polygon4326.copy(line.str());
+                    }
                 } else {
                     line << /* geom */ "\\N\n";
-                    m_line.copy(line.str());
+                    m_line.copy(valid_from, valid_to, line.str());
+                    if(m_latlngTables) {
+                        m_line4326.copy(line.str());
+                    }
                 }
             }
         }
@@ -303,57 +721,515 @@ private:
             // a polygon, polygon-meta to table
             line << poly->getArea() << '\t';
 
-            // write geometry to polygon table
-            wkb.writeHEX(*geom, line);
-            line << '\t';
-
-            // calculate interior point
-            if(m_interior) {
-                try {
-                    // will leak with invalid geometries on old geos code:
-                    //  http://trac.osgeo.org/geos/ticket/475
-                    geos::geom::Coordinate center;
-                    geos::algorithm::InteriorPointArea interior_calculator(poly);
-                    interior_calculator.getInteriorPoint(center);
-
-                    // write interior point
-                    line << "SRID=900913;POINT(" << center.x << ' ' << center.x << ')';
-                } catch(geos::util::GEOSException e) {
-                    std::cerr << "error calculating interior point: " << e.what() << std::endl;
-                    line << "\\N";
-                }
-            }
-            else
-            {
-                line << "\\N";
-            }
+            std::string current = current_meta(id, valid_to, hstore, z_order, poly->getArea());
 
-            line << '\n';
-            m_polygon.copy(line.str());
+            geos::geom::Coordinate interior;
+            const geos::geom::Coordinate* center = interior_point(poly, interior) ? &interior : NULL;
+            write_polygon_parts(line.str(), current, valid_from, valid_to, geom, center, 0);
+
+            for(size_t i = 0; i < m_generalizers.size(); i++) {
+                m_generalizers[i]->write(id, version, minor, 0, user_id, user_name, valid_from, valid_to, hstore, z_order, false, geom, poly->getArea(), point_ewkt(center, false));
+            }
         } else {
             // a linestring, write geometry to line-table
             wkb.writeHEX(*geom, line);
 
             line << '\n';
-            m_line.copy(line.str());
+            uint32_t cell = cluster_cell(geom);
+            m_line.copy(valid_from, valid_to, cell, line.str());
+
+            // major roads, railways and boundaries go to the roads-table, too
+            if(lowzoom) {
+                m_roads.copy(valid_from, valid_to, cell, line.str());
+            }
+
+            std::string current = current_meta(id, valid_to, hstore, z_order);
+            if(!current.empty()) {
+                std::stringstream row;
+                row << current;
+                wkb.writeHEX(*geom, row);
+                row << '\n';
+
+                m_currentLine.copy(row.str());
+                if(lowzoom) {
+                    m_currentRoads.copy(row.str());
+                }
+            }
+
+            if(m_latlngTables) {
+                std::stringstream latlng;
+                latlng << meta;
+                write_latlng(*geom, latlng);
+                latlng << '\n';
+
+                m_line4326.copy(latlng.str());
+                if(lowzoom) {
+                    m_roads4326.copy(latlng.str());
+                }
+            }
 
+            for(size_t i = 0; i < m_generalizers.size(); i++) {
+                m_generalizers[i]->write(id, version, minor, 0, user_id, user_name, valid_from, valid_to, hstore, z_order, lowzoom, geom, 0, "");
+            }
         }
         delete geom;
     }
 
+    /**
+     * the columns every line-, roads- and polygon-row starts with
+     */
+    std::string row_meta(
+        osm_object_id_t id,
+        osm_version_t version,
+        osm_version_t minor,
+        bool visible,
+        osm_user_id_t user_id,
+        const char* user_name,
+        time_t valid_from,
+        time_t valid_to,
+        const std::string& hstore,
+        long z_order
+    ) {
+        std::stringstream line;
+        line <<
+            id << '\t' <<
+            version << '\t' <<
+            minor << '\t' <<
+            (visible ? 't' : 'f') << '\t' <<
+            user_id << '\t' <<
+            DbCopyConn::escape_string(user_name) << '\t' <<
+            Timestamp::formatDb(valid_from) << '\t' <<
+            Timestamp::formatDb(valid_to) << '\t' <<
+            hstore << '\t' <<
+            z_order << '\t';
+        return line.str();
+    }
+
+    /**
+     * the columns every row of the current line-, roads- and polygon-table
+     * starts with, the area is only written for polygons (area >= 0). an
+     * empty string if the version is not valid anymore or the current
+     * tables are not written.
+     */
+    std::string current_meta(osm_object_id_t id, time_t valid_to, const std::string& hstore, long z_order, double area = -1) {
+        if(!m_currentTables || valid_to != 0) {
+            return "";
+        }
+
+        std::stringstream line;
+        line << std::setprecision(8) <<
+            id << '\t' <<
+            hstore << '\t' <<
+            z_order << '\t';
+
+        if(area >= 0) {
+            line << area << '\t';
+        }
+        return line.str();
+    }
+
+    /**
+     * calculate the interior point of a polygon, if it should be
+     * calculated. returns false if it is not.
+     */
+    bool interior_point(const geos::geom::Polygon* poly, geos::geom::Coordinate& center) {
+        if(!m_interior) {
+            return false;
+        }
+
+        try {
+            // will leak with invalid geometries on old geos code:
+            //  http://trac.osgeo.org/geos/ticket/475
+            geos::algorithm::InteriorPointArea interior_calculator(poly);
+            interior_calculator.getInteriorPoint(center);
+            return true;
+        } catch(geos::util::GEOSException e) {
+            std::cerr << "error calculating interior point: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    /**
+     * a mercator point in the copy format, projected back to lon/lat if
+     * latlng is set. NULL is written as \\N.
+     */
+    static std::string point_ewkt(const geos::geom::Coordinate* point, bool latlng) {
+        if(!point) {
+            return "\\N";
+        }
+
+        double x = point->x, y = point->y;
+        std::stringstream ewkt;
+        if(latlng) {
+            Project::toLatLng(&x, &y);
+            ewkt << std::setprecision(10) << "SRID=4326;POINT(" << x << ' ' << y << ')';
+        } else {
+            ewkt << std::setprecision(8) << "SRID=900913;POINT(" << x << ' ' << y << ')';
+        }
+        return ewkt.str();
+    }
+
+    /**
+     * the Hilbert cell a position is clustered by, NO_CELL if the tables
+     * are not clustered
+     */
+    uint32_t cluster_cell(double x, double y) {
+        if(!m_clustered) {
+            return ClusterSorter::NO_CELL;
+        }
+
+        if(m_keepLatLng) {
+            return ClusterSorter::cell(x, y, -180, -90, 180, 90);
+        }
+
+        // half the size of the mercator world in meters
+        const double world = M_PI * 6378137.0;
+        return ClusterSorter::cell(x, y, -world, -world, world, world);
+    }
+
+    /**
+     * the Hilbert cell a geometry is clustered by. the center of its
+     * envelope is used, which is much cheaper than its centroid.
+     */
+    uint32_t cluster_cell(const geos::geom::Geometry* geom) {
+        if(!m_clustered || geom->isEmpty()) {
+            return ClusterSorter::NO_CELL;
+        }
+
+        const geos::geom::Envelope* env = geom->getEnvelopeInternal();
+        return cluster_cell((env->getMinX() + env->getMaxX()) / 2, (env->getMinY() + env->getMaxY()) / 2);
+    }
+
+    /**
+     * projects the coordinates of a geometry from mercator back to lon/lat
+     */
+    class LatLngFilter : public geos::geom::CoordinateFilter {
+    public:
+        void filter_rw(geos::geom::Coordinate* c) const {
+            Project::toLatLng(&c->x, &c->y);
+        }
+    };
+
+    /**
+     * write a mercator geometry projected back to lon/lat as hex-wkb
+     */
+    void write_latlng(const geos::geom::Geometry& geom, std::ostream& out) {
+        std::auto_ptr<geos::geom::Geometry> latlng(geom.clone());
+
+        LatLngFilter filter;
+        latlng->apply_rw(&filter);
+        latlng->geometryChanged();
+        latlng->setSRID(4326);
+
+        wkb.writeHEX(*latlng, out);
+    }
+
+    /**
+     * write a polygon to the polygon-table, starting with the part number
+     * part. meta contains the columns up to the area. large polygons are
+     * written in several parts, which share the meta data and area of the
+     * whole polygon, only the first one carries the interior point.
+     * current contains the columns of the current polygon-table up to the
+     * geometry, if the parts are written to it, too (see current_meta).
+     * returns the part number following the written parts.
+     */
+    size_t write_polygon_parts(const std::string& meta, const std::string& current, time_t valid_from, time_t valid_to, const geos::geom::Geometry* geom, const geos::geom::Coordinate* center, size_t part) {
+        std::vector<geos::geom::Geometry*> parts;
+        bool split = m_splitter.split(geom, parts);
+        if(!split) {
+            parts.push_back(const_cast<geos::geom::Geometry*>(geom));
+        }
+
+        for(size_t i = 0; i < parts.size(); i++) {
+            std::stringstream row;
+            row << meta << part + i << '\t';
+
+            // write geometry to polygon table
+            wkb.writeHEX(*parts[i], row);
+            row << '\t';
+
+            row << point_ewkt(i == 0 ? center : NULL, false) << '\n';
+            m_polygon.copy(valid_from, valid_to, cluster_cell(parts[i]), row.str());
+
+            if(!current.empty()) {
+                std::stringstream currentRow;
+                currentRow << current;
+                wkb.writeHEX(*parts[i], currentRow);
+                currentRow << '\n';
+                m_currentPolygon.copy(currentRow.str());
+            }
+
+            if(m_latlngTables) {
+                std::stringstream latlng;
+                latlng << meta << part + i << '\t';
+                write_latlng(*parts[i], latlng);
+                latlng << '\t' << point_ewkt(i == 0 ? center : NULL, true) << '\n';
+                m_polygon4326.copy(latlng.str());
+            }
+
+            if(split) {
+                delete parts[i];
+            }
+        }
+
+        return part + parts.size();
+    }
+
+    /**
+     * build the primary keys and indexes of all partitions like
+     * 99-after.sql (or 99-after-brin.sql) does for the tables, using
+     * several connections
+     */
+    void index_partitions() {
+        const char *method = m_brin ? "BRIN" : "GIST";
+
+        ParallelExec exec;
+        add_partition_indexes(exec, m_point, "id, version", method);
+        add_partition_indexes(exec, m_line, "id, version, minor", method);
+        add_partition_indexes(exec, m_roads, "id, version, minor", method);
+        add_partition_indexes(exec, m_polygon, "id, version, minor, part", method);
+
+        std::cerr << "indexing the partitions over " << m_indexJobs << " connections..." << std::endl;
+        exec.run(m_dsn, m_indexJobs);
+    }
+
+    static void add_partition_indexes(ParallelExec& exec, const PartitionedCopyConn& table, const char *key, const char *method) {
+        std::vector< std::pair<std::string, uint64_t> > partitions = table.partitions();
+        for(size_t i = 0; i < partitions.size(); i++) {
+            const std::string& name = partitions[i].first;
+
+            std::stringstream cmd;
+            cmd << "ALTER TABLE " << name << " ADD PRIMARY KEY (" << key << ");" <<
+                "CREATE INDEX " << name << "_geom_and_time_index ON " << name << " USING " << method << " (geom, valid_from, valid_to);";
+
+            // like 99-after-range.sql
+            if(table.hasValidityRange()) {
+                cmd << "CREATE INDEX " << name << "_geom_and_validity_index ON " << name << " USING GIST (geom, validity);";
+            }
+
+            cmd << "ANALYZE " << name << ";";
+            exec.add(cmd.str(), partitions[i].second);
+        }
+    }
+
+    void write_relation() {
+        const shared_ptr<Osmium::OSM::Relation const> next = m_relation_tracker.next();
+        const shared_ptr<Osmium::OSM::Relation const> cur = m_relation_tracker.cur();
+
+        if(debug()) {
+            std::cout << "relation r" << cur->id() << 'v' << cur->version() << " at tstamp " << cur->timestamp() << " (" << Timestamp::format(cur->timestamp()) << ")" << std::endl;
+        }
+
+        m_lastTimestamp = std::max(m_lastTimestamp, cur->timestamp());
+
+        time_t valid_from = cur->timestamp();
+
+        // the end of this version, 0 if it is the last one
+        time_t end = 0;
+        if(m_relation_tracker.next_is_same_entity()) {
+            end = next->timestamp();
+        }
+
+        // a deleted relation is only written, if it was a multipolygon before
+        if(!cur->visible()) {
+            if(m_relation_tracker.prev_is_same_entity() && PolygonIdentifyer::isMultipolygon(m_relation_tracker.prev()->tags())) {
+                std::vector<geos::geom::Geometry*> parts;
+                write_relation_to_db(*cur, 0, false, valid_from, valid_from, parts);
+            }
+            return;
+        }
+
+        if(!PolygonIdentifyer::isMultipolygon(cur->tags())) {
+            return;
+        }
+
+        // the recorded slices of the member ways
+        std::vector<const MemberWays::slices_t*> members;
+        Osmium::OSM::RelationMemberList::const_iterator memberend = cur->members().end();
+        for(Osmium::OSM::RelationMemberList::const_iterator it = cur->members().begin(); it != memberend; ++it) {
+            if(it->type() == 'w') {
+                members.push_back(m_memberWays->slices(it->ref()));
+            }
+        }
+
+        // the times at which the geometry of a member changes during this version
+        std::vector<time_t> changes;
+        for(size_t i = 0; i < members.size(); i++) {
+            if(!members[i]) {
+                continue;
+            }
+
+            for(MemberWays::slices_t::const_iterator it = members[i]->begin(); it != members[i]->end(); ++it) {
+                if(it->from > valid_from && (end == 0 || it->from < end)) {
+                    changes.push_back(it->from);
+                }
+                if(it->to > valid_from && (end == 0 || it->to < end)) {
+                    changes.push_back(it->to);
+                }
+            }
+        }
+        std::sort(changes.begin(), changes.end());
+        changes.erase(std::unique(changes.begin(), changes.end()), changes.end());
+
+        // like the minor way versions, keep only the last change of each interval
+        std::vector<time_t> minor_times;
+        for(size_t i = 0; i < changes.size(); i++) {
+            if(!minor_times.empty() && Granularity::bucket(minor_times.back(), m_sweep.granularity()) == Granularity::bucket(changes[i], m_sweep.granularity())) {
+                minor_times.back() = changes[i];
+            } else {
+                minor_times.push_back(changes[i]);
+            }
+        }
+
+        // the member list changed, the rings need to be assembled again
+        m_multipolygon->reset();
+
+        // the slice of each member valid at the time of the current minor version
+        std::vector<size_t> cursors(members.size(), 0);
+        std::vector<const MemberWays::Slice*> slices(members.size(), NULL);
+
+        for(size_t minor = 0; minor <= minor_times.size(); minor++) {
+            time_t t = (minor == 0) ? valid_from : minor_times[minor-1];
+            time_t valid_to = (minor < minor_times.size()) ? minor_times[minor] : end;
+
+            // versions outside of the time window are not built at all
+            if(!m_window.keeps(t, valid_to)) {
+                continue;
+            }
+
+            for(size_t i = 0; i < members.size(); i++) {
+                slices[i] = NULL;
+                if(!members[i]) {
+                    continue;
+                }
+
+                // the slices are sorted by time and t only grows
+                size_t& c = cursors[i];
+                while(c < members[i]->size() && (*members[i])[c].to != 0 && (*members[i])[c].to <= t) {
+                    c++;
+                }
+                if(c < members[i]->size() && (*members[i])[c].validAt(t)) {
+                    slices[i] = &(*members[i])[c];
+                }
+            }
+
+            std::vector<geos::geom::Geometry*> parts;
+            m_multipolygon->build(slices, parts);
+
+            if(parts.empty()) {
+                if(debug()) {
+                    std::cerr << "no valid geometry for relation " << cur->id() << 'v' << cur->version() << '.' << minor << " at tstamp " << t << std::endl;
+                }
+                continue;
+            }
+
+            write_relation_to_db(*cur, minor, true, t, valid_to, parts);
+        }
+    }
+
+    /**
+     * write a version of a multipolygon relation with the polygons it is
+     * made of to the polygon-table, the polygons are deleted afterwards.
+     * relations are written with negative ids, like osm2pgsql does.
+     */
+    void write_relation_to_db(
+        const Osmium::OSM::Relation& relation,
+        osm_version_t minor,
+        bool visible,
+        time_t valid_from,
+        time_t valid_to,
+        std::vector<geos::geom::Geometry*>& parts
+    ) {
+        if(!m_window.clip(valid_from, valid_to)) {
+            for(size_t i = 0; i < parts.size(); i++) {
+                delete parts[i];
+            }
+            parts.clear();
+            return;
+        }
+
+        std::string hstore = HStore::format(relation.tags());
+        long z_order = ZOrderCalculator::calculateZOrder(relation.tags());
+
+        std::stringstream line;
+        line << std::setprecision(8) << row_meta(-relation.id(), relation.version(), minor, visible, relation.uid(), relation.user(), valid_from, valid_to, hstore, z_order);
+
+        if(!visible) {
+            line << /*area*/ "0\t" << /* part */ "0\t" << /* geom */ "\\N\t" << /* center */ "\\N\n";
+            m_polygon.copy(valid_from, valid_to, line.str());
+            if(m_latlngTables) {
+                m_polygon4326.copy(line.str());
+            }
+            return;
+        }
+
+        // all parts carry the area of the whole multipolygon
+        double area = 0;
+        for(size_t i = 0; i < parts.size(); i++) {
+            area += parts[i]->getArea();
+        }
+        line << area << '\t';
+
+        std::string current = current_meta(-relation.id(), valid_to, hstore, z_order, area);
+
+        geos::geom::Coordinate interior;
+        const geos::geom::Coordinate* center = interior_point(dynamic_cast<const geos::geom::Polygon*>(parts[0]), interior) ? &interior : NULL;
+
+        size_t part = 0;
+        for(size_t i = 0; i < parts.size(); i++) {
+            part = write_polygon_parts(line.str(), current, valid_from, valid_to, parts[i], i == 0 ? center : NULL, part);
+
+            for(size_t g = 0; g < m_generalizers.size(); g++) {
+                m_generalizers[g]->write(-relation.id(), relation.version(), minor, i, relation.uid(), relation.user(), valid_from, valid_to, hstore, z_order, false, parts[i], area, point_ewkt(i == 0 ? center : NULL, false));
+            }
+
+            delete parts[i];
+        }
+        parts.clear();
+    }
+
 public:
-    ImportHandler(Nodestore *nodestore):
+    ImportHandler(TNodestore *nodestore):
             m_progress(),
             m_node_tracker(),
             m_store(nodestore),
+            m_cache(nodestore),
             m_adapter(),
-            m_geom(m_store, &m_adapter),
-            m_mtimes(m_store, &m_adapter),
+            m_geom(&m_cache, &m_adapter),
+            m_sweep(&m_cache),
             m_sorttest(),
+            m_indexJobs(4),
+            m_clustered(false),
+            m_brin(false),
+            m_currentTables(false),
+            m_lastTimestamp(0),
             wkb(),
-            m_prefix("hist_") {}
-
-    ~ImportHandler() {}
+            m_prefix("hist_"),
+            m_projectNodes(false),
+            m_lazy(false),
+            m_latlngTables(false),
+            m_writeSnapshot(),
+            m_readSnapshot(),
+            m_referencedNodes(NULL),
+            m_regionNodes(NULL),
+            m_regionWays(NULL),
+            m_window(),
+            m_join(NULL),
+            m_generalizers(),
+            m_splitter(),
+            m_memberWays(NULL),
+            m_multipolygon(NULL),
+            m_lastMajorId(0),
+            m_lastMajorVersion(0),
+            m_lastMajorValid(false),
+            m_lastMajorPolygon(false) {}
+
+    ~ImportHandler() {
+        for(size_t i = 0; i < m_generalizers.size(); i++) {
+            delete m_generalizers[i];
+        }
+        delete m_multipolygon;
+    }
 
     std::string dsn() {
         return m_dsn;
@@ -378,6 +1254,8 @@ public:
     void printStoreErrors(bool shouldPrintStoreErrors) {
         m_storeerrors = shouldPrintStoreErrors;
         m_store->printStoreErrors(shouldPrintStoreErrors);
+        m_cache.printStoreErrors(shouldPrintStoreErrors);
+        m_sweep.printStoreErrors(shouldPrintStoreErrors);
     }
 
     bool isCalculatingInterior() {
@@ -397,6 +1275,262 @@ public:
         m_geom.keepLatLng(shouldKeepLatLng);
     }
 
+    Granularity::Unit granularity() {
+        return m_sweep.granularity();
+    }
+
+    /**
+     * keep only the last minor version in each interval of this unit
+     */
+    void granularity(Granularity::Unit unit) {
+        m_sweep.granularity(unit);
+    }
+
+    double tolerance() {
+        return m_sweep.tolerance();
+    }
+
+    /**
+     * only create minor versions when a node moved further then this
+     * distance in projected meters
+     */
+    void tolerance(double meters) {
+        m_sweep.tolerance(meters);
+    }
+
+    bool isProjectingNodes() {
+        return m_projectNodes;
+    }
+
+    /**
+     * should the nodes be projected to mercator once, before they are
+     * recorded into the nodestore, instead of each time they are looked up?
+     */
+    void projectNodes(bool shouldProjectNodes) {
+        m_projectNodes = shouldProjectNodes;
+        m_store->storeMercator(shouldProjectNodes);
+        if(m_join) {
+            m_join->storeMercator(shouldProjectNodes);
+        }
+    }
+
+    std::string writeNodestoreSnapshot() {
+        return m_writeSnapshot;
+    }
+
+    void writeNodestoreSnapshot(std::string& filename) {
+        m_writeSnapshot = filename;
+    }
+
+    std::string readNodestoreSnapshot() {
+        return m_readSnapshot;
+    }
+
+    void readNodestoreSnapshot(std::string& filename) {
+        m_readSnapshot = filename;
+    }
+
+    IdSet *referencedNodes() {
+        return m_referencedNodes;
+    }
+
+    void referencedNodes(IdSet *referencedNodes) {
+        m_referencedNodes = referencedNodes;
+    }
+
+    /**
+     * restrict the import to the nodes and ways in the sets
+     */
+    void region(IdSet *regionNodes, IdSet *regionWays) {
+        m_regionNodes = regionNodes;
+        m_regionWays = regionWays;
+    }
+
+    const TimeWindow& timeWindow() {
+        return m_window;
+    }
+
+    /**
+     * restrict the import to a window of time
+     */
+    void timeWindow(const TimeWindow& window) {
+        m_window = window;
+    }
+
+    ExternalJoin *externalJoin() {
+        return m_join;
+    }
+
+    void externalJoin(ExternalJoin *join) {
+        m_join = join;
+        m_join->storeMercator(m_projectNodes);
+    }
+
+    std::vector<int> generalize() {
+        std::vector<int> zooms;
+        for(size_t i = 0; i < m_generalizers.size(); i++) {
+            zooms.push_back(m_generalizers[i]->zoom());
+        }
+        return zooms;
+    }
+
+    /**
+     * write generalized line- and polygon-tables for these zoom levels
+     */
+    void generalize(const std::vector<int>& zooms) {
+        for(size_t i = 0; i < m_generalizers.size(); i++) {
+            delete m_generalizers[i];
+        }
+        m_generalizers.clear();
+
+        for(size_t i = 0; i < zooms.size(); i++) {
+            m_generalizers.push_back(new Generalizer(zooms[i]));
+        }
+    }
+
+    bool isPartitioned() {
+        return m_line.isPartitioned();
+    }
+
+    /**
+     * split the point-, line-, roads- and polygon-table into yearly
+     * partitions
+     */
+    void partitioned(bool shouldPartition) {
+        m_point.partitioned(shouldPartition);
+        m_line.partitioned(shouldPartition);
+        m_roads.partitioned(shouldPartition);
+        m_polygon.partitioned(shouldPartition);
+    }
+
+    size_t indexJobs() {
+        return m_indexJobs;
+    }
+
+    /**
+     * build the indexes of the partitions over this many connections
+     */
+    void indexJobs(size_t jobs) {
+        m_indexJobs = jobs;
+    }
+
+    bool isClustered() {
+        return m_clustered;
+    }
+
+    /**
+     * sort the rows of the point-, line-, roads- and polygon-table by the
+     * Hilbert cell of their geometry and their valid_from before copying
+     * them. the keys are spilled to tmpdir, the four tables share
+     * memoryLimit bytes for them.
+     */
+    void cluster(const std::string& tmpdir, size_t memoryLimit) {
+        m_clustered = true;
+        m_point.cluster(tmpdir, memoryLimit / 4);
+        m_line.cluster(tmpdir, memoryLimit / 4);
+        m_roads.cluster(tmpdir, memoryLimit / 4);
+        m_polygon.cluster(tmpdir, memoryLimit / 4);
+    }
+
+    bool hasValidityRange() {
+        return m_line.hasValidityRange();
+    }
+
+    /**
+     * write the validity of the point-, line-, roads- and polygon-table
+     * as a tsrange column, too
+     */
+    void validityRange(bool shouldWriteRange) {
+        m_point.validityRange(shouldWriteRange);
+        m_line.validityRange(shouldWriteRange);
+        m_roads.validityRange(shouldWriteRange);
+        m_polygon.validityRange(shouldWriteRange);
+    }
+
+    bool isWritingCurrentTables() {
+        return m_currentTables;
+    }
+
+    /**
+     * write the versions which are still valid to the current-tables, too
+     */
+    void currentTables(bool shouldWriteCurrentTables) {
+        m_currentTables = shouldWriteCurrentTables;
+    }
+
+    bool isUsingBrin() {
+        return m_brin;
+    }
+
+    /**
+     * index the geometry and validity of the tables with BRIN instead of
+     * GiST indexes
+     */
+    void brin(bool shouldUseBrin) {
+        m_brin = shouldUseBrin;
+    }
+
+    bool isWritingLatLngTables() {
+        return m_latlngTables;
+    }
+
+    /**
+     * write a second set of tables with lon/lat geometries next to the
+     * mercator ones
+     */
+    void latlngTables(bool shouldWriteLatLngTables) {
+        m_latlngTables = shouldWriteLatLngTables;
+    }
+
+    bool isLazy() {
+        return m_lazy;
+    }
+
+    /**
+     * write only the node lists of the ways instead of their geometries,
+     * which are assembled from the node history in the database on demand
+     */
+    void lazy(bool shouldBeLazy) {
+        m_lazy = shouldBeLazy;
+    }
+
+    size_t splitVertices() {
+        return m_splitter.maxVertices();
+    }
+
+    /**
+     * split polygons with more vertices into grid aligned parts
+     */
+    void splitVertices(size_t vertices) {
+        m_splitter.maxVertices(vertices);
+    }
+
+    double splitExtent() {
+        return m_splitter.maxExtent();
+    }
+
+    /**
+     * split polygons wider or higher then this many meters into grid
+     * aligned parts
+     */
+    void splitExtent(double meters) {
+        m_splitter.maxExtent(meters);
+    }
+
+    MemberWays *memberWays() {
+        return m_memberWays;
+    }
+
+    /**
+     * assemble multipolygon relations from the coordinates of their
+     * member ways, which are recorded into memberWays
+     */
+    void memberWays(MemberWays *memberWays) {
+        m_memberWays = memberWays;
+        delete m_multipolygon;
+        m_multipolygon = new MultipolygonBuilder(memberWays);
+    }
+
     bool isPrintingDebugMessages() {
         return m_debug;
     }
@@ -410,59 +1544,137 @@ public:
 
 
     void init(Osmium::OSM::Meta& meta) {
-        if(m_debug) {
+        if(debug()) {
             std::cerr << "connecting to database using dsn: " << m_dsn << std::endl;
         }
 
         m_general.open(m_dsn);
-        if(m_debug) {
-            std::cerr << "running scheme/00-before.sql" << std::endl;
+        exec_scheme("00-before.sql");
+        if(hasValidityRange()) {
+            exec_scheme("00-before-range.sql");
+        }
+        if(m_lazy) {
+            exec_scheme("00-before-lazy.sql");
+        }
+        if(m_latlngTables) {
+            exec_scheme("00-before-4326.sql");
+        }
+        if(m_currentTables) {
+            exec_scheme("00-before-current.sql");
         }
 
-        std::ifstream sqlfile("scheme/00-before.sql");
-        if(!sqlfile)
-            sqlfile.open("/usr/share/osm-history-importer/scheme/00-before.sql");
-
-        if(!sqlfile)
-            throw std::runtime_error("can't find 00-before.sql");
-
-        m_general.execfile(sqlfile);
+        m_point.open(m_general, m_dsn, m_prefix, "point");
+        m_line.open(m_general, m_dsn, m_prefix, "line");
+        m_roads.open(m_general, m_dsn, m_prefix, "roads");
+        m_polygon.open(m_general, m_dsn, m_prefix, "polygon");
+        if(m_lazy) {
+            m_way.open(m_dsn, m_prefix, "way");
+        }
+        if(m_latlngTables) {
+            m_point4326.open(m_dsn, m_prefix, "point_4326");
+            m_line4326.open(m_dsn, m_prefix, "line_4326");
+            m_roads4326.open(m_dsn, m_prefix, "roads_4326");
+            m_polygon4326.open(m_dsn, m_prefix, "polygon_4326");
+        }
+        if(m_currentTables) {
+            m_currentPoint.open(m_dsn, m_prefix, "current_point");
+            m_currentLine.open(m_dsn, m_prefix, "current_line");
+            m_currentRoads.open(m_dsn, m_prefix, "current_roads");
+            m_currentPolygon.open(m_dsn, m_prefix, "current_polygon");
+        }
 
-        m_point.open(m_dsn, m_prefix, "point");
-        m_line.open(m_dsn, m_prefix, "line");
-        m_polygon.open(m_dsn, m_prefix, "polygon");
+        for(size_t i = 0; i < m_generalizers.size(); i++) {
+            if(debug()) {
+                std::cerr << "creating generalized tables for zoom " << m_generalizers[i]->zoom() << std::endl;
+            }
+            m_generalizers[i]->validityRange(hasValidityRange());
+            m_generalizers[i]->create(m_general, m_prefix);
+            m_generalizers[i]->open(m_dsn);
+        }
 
         m_progress.init(meta);
 
         wkb.setIncludeSRID(true);
+
+        if(m_readSnapshot.size()) {
+            std::cerr << "reading nodestore snapshot " << m_readSnapshot << "..." << std::endl;
+            m_store->readSnapshot(m_readSnapshot);
+        }
     }
 
     void final() {
         m_progress.final();
 
+        if(m_window.isRestricting()) {
+            m_window.printStatistics();
+        }
+
         std::cerr << "closing point-table..." << std::endl;
         m_point.close();
 
         std::cerr << "closing line-table..." << std::endl;
         m_line.close();
 
+        std::cerr << "closing roads-table..." << std::endl;
+        m_roads.close();
+
         std::cerr << "closing polygon-table..." << std::endl;
         m_polygon.close();
 
-        if(m_debug) {
-            std::cerr << "running scheme/99-after.sql" << std::endl;
+        if(m_lazy) {
+            std::cerr << "closing way-table..." << std::endl;
+            m_way.close();
         }
 
-        std::ifstream sqlfile("scheme/99-after.sql");
-        if(!sqlfile)
-            sqlfile.open("/usr/share/osm-history-importer/scheme/99-after.sql");
+        if(m_latlngTables) {
+            std::cerr << "closing lon/lat tables..." << std::endl;
+            m_point4326.close();
+            m_line4326.close();
+            m_roads4326.close();
+            m_polygon4326.close();
+        }
 
-        if(!sqlfile)
-            throw std::runtime_error("can't find 99-after.sql");
+        if(m_currentTables) {
+            std::cerr << "closing current tables..." << std::endl;
+            m_currentPoint.close();
+            m_currentLine.close();
+            m_currentRoads.close();
+            m_currentPolygon.close();
 
-        m_general.execfile(sqlfile);
+            m_general.exec("INSERT INTO " + m_prefix + "current_meta (last_timestamp) VALUES ('" + Timestamp::format(m_lastTimestamp) + "');");
+        }
+
+        for(size_t i = 0; i < m_generalizers.size(); i++) {
+            std::cerr << "closing generalized tables for zoom " << m_generalizers[i]->zoom() << "..." << std::endl;
+            m_generalizers[i]->close();
+            m_generalizers[i]->printStatistics();
+        }
 
-        if(m_debug) {
+        exec_scheme(m_brin ? "99-after-brin.sql" : "99-after.sql");
+        if(hasValidityRange()) {
+            exec_scheme("99-after-range.sql");
+        }
+        if(m_lazy) {
+            exec_scheme("99-after-lazy.sql");
+        }
+        if(m_latlngTables) {
+            exec_scheme("99-after-4326.sql");
+        }
+        if(m_currentTables) {
+            exec_scheme("99-after-current.sql");
+        }
+        if(isPartitioned()) {
+            index_partitions();
+        }
+
+        for(size_t i = 0; i < m_generalizers.size(); i++) {
+            if(debug()) {
+                std::cerr << "indexing generalized tables for zoom " << m_generalizers[i]->zoom() << std::endl;
+            }
+            m_generalizers[i]->index(m_general);
+        }
+
+        if(debug()) {
             std::cerr << "disconnecting from database" << std::endl;
         }
         m_general.close();
@@ -472,6 +1684,13 @@ public:
 
     void node(const shared_ptr<Osmium::OSM::Node const>& node) {
         m_sorttest.test(node);
+
+        // nodes outside of the region and not needed by a way in it
+        if(m_regionNodes && !m_regionNodes->test(node->id())) {
+            m_progress.node(node);
+            return;
+        }
+
         m_node_tracker.feed(node);
 
         // we're always writing the one-off node
@@ -489,27 +1708,86 @@ public:
         }
 
         m_node_tracker.swap();
+        m_store->printStatistics();
+
+        if(m_writeSnapshot.size()) {
+            std::cerr << "writing nodestore snapshot " << m_writeSnapshot << "..." << std::endl;
+            m_store->writeSnapshot(m_writeSnapshot);
+        }
     }
 
     void way(const shared_ptr<Osmium::OSM::Way const>& way) {
         m_sorttest.test(way);
-        m_way_tracker.feed(way);
 
-        // we're always writing the one-off way
-        if(m_way_tracker.has_cur()) {
-            write_way();
+        // ways never touching the region
+        if(m_regionWays && !m_regionWays->test(way->id())) {
+            m_progress.way(way);
+            return;
+        }
+
+        // in the external join mode, the ways are written after all of them have been spilled
+        if(m_join) {
+            m_join->recordWay(way);
+        } else {
+            track_way(way);
         }
 
-        m_way_tracker.swap();
         m_progress.way(way);
     }
 
     void after_ways() {
-        if(m_way_tracker.has_cur()) {
-            write_way();
+        if(m_join) {
+            write_joined_ways();
+        } else {
+            flush_ways();
+            m_store->printLookupStatistics();
         }
 
-        m_way_tracker.swap();
+        m_cache.printStatistics();
+        std::cerr << "skipped " << m_sweep.skipped() << " minor way versions without coordinate changes" << std::endl;
+        if(m_sweep.tolerance() > 0) {
+            std::cerr << "merged " << m_sweep.coalesced() << " minor way versions with node moves below the tolerance into the versions before" << std::endl;
+        }
+        if(m_splitter.isSplitting()) {
+            m_splitter.printStatistics();
+        }
+        if(m_sweep.granularity() != Granularity::SECOND) {
+            std::cerr << "merged " << m_sweep.merged() << " minor way versions into later ones of the same interval" << std::endl;
+        }
+        if(m_memberWays) {
+            m_memberWays->printStatistics();
+        }
+    }
+
+    void relation(const shared_ptr<Osmium::OSM::Relation const>& relation) {
+        m_sorttest.test(relation);
+
+        // relations are only imported to assemble multipolygons
+        if(m_memberWays) {
+            m_relation_tracker.feed(relation);
+
+            // we're always writing the one-off relation
+            if(m_relation_tracker.has_cur()) {
+                write_relation();
+            }
+
+            m_relation_tracker.swap();
+        }
+
+        m_progress.relation(relation);
+    }
+
+    void after_relations() {
+        if(!m_memberWays) {
+            return;
+        }
+
+        if(m_relation_tracker.has_cur()) {
+            write_relation();
+        }
+
+        m_relation_tracker.swap();
+        m_multipolygon->printStatistics();
     }
 };
 
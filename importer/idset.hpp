@@ -0,0 +1,137 @@
+/**
+ * Some decisions during the import need to know if an id has been seen
+ * somewhere else in the file, for example if a node is referenced by any
+ * way. This class provides a compact set of osm-ids, stored as a bitset.
+ *
+ * The ids of an extract are usually spread over a wide range with large
+ * holes in between, so the bitset is split into pages which are only
+ * allocated when an id inside of them is set.
+ */
+
+#ifndef IMPORTER_IDSET_HPP
+#define IMPORTER_IDSET_HPP
+
+/**
+ * compact set of osm-ids
+ */
+class IdSet {
+private:
+    /**
+     * number of ids covered by one page (8 kB of bits)
+     */
+    const static osm_object_id_t PAGE_BITS = 1 << 16;
+
+    /**
+     * number of 64 bit words in one page
+     */
+    const static size_t PAGE_WORDS = PAGE_BITS / 64;
+
+    /**
+     * the pages of the non-negative ids and those of the negative ids (as
+     * used by JOSM for new objects), which are stored as -id - 1. NULL for
+     * pages without any id set
+     */
+    std::vector< uint64_t* > m_pages, m_negativePages;
+
+    /**
+     * number of ids set
+     */
+    size_t m_size;
+
+    /**
+     * the word containing the bit of an id, NULL if its page does not
+     * exist and should not be created
+     */
+    uint64_t *word(osm_object_id_t id, bool create) {
+        std::vector< uint64_t* >& pages = (id < 0) ? m_negativePages : m_pages;
+        uint64_t index = (id < 0) ? -(id + 1) : id;
+
+        size_t page = index / PAGE_BITS;
+        if(page >= pages.size()) {
+            if(!create)
+                return NULL;
+            pages.resize(page + 1, NULL);
+        }
+
+        if(!pages[page]) {
+            if(!create)
+                return NULL;
+            pages[page] = new uint64_t[PAGE_WORDS]();
+        }
+
+        return &pages[page][(index % PAGE_BITS) / 64];
+    }
+
+    static uint64_t bit(osm_object_id_t id) {
+        uint64_t index = (id < 0) ? -(id + 1) : id;
+        return (uint64_t)1 << (index % 64);
+    }
+
+public:
+    IdSet() : m_pages(), m_negativePages(), m_size(0) {}
+
+    ~IdSet() {
+        clear();
+    }
+
+    /**
+     * add an id to the set
+     */
+    void set(osm_object_id_t id) {
+        uint64_t *w = word(id, true);
+        if(!(*w & bit(id))) {
+            *w |= bit(id);
+            m_size++;
+        }
+    }
+
+    /**
+     * check if an id is contained in the set
+     */
+    bool test(osm_object_id_t id) const {
+        uint64_t *w = const_cast<IdSet*>(this)->word(id, false);
+        return w && (*w & bit(id));
+    }
+
+    /**
+     * number of ids in the set
+     */
+    size_t size() const {
+        return m_size;
+    }
+
+    /**
+     * number of bytes allocated for the pages
+     */
+    size_t memory() const {
+        size_t bytes = (m_pages.capacity() + m_negativePages.capacity()) * sizeof(uint64_t*);
+        for(size_t i = 0; i < m_pages.size(); i++) {
+            if(m_pages[i]) {
+                bytes += PAGE_WORDS * sizeof(uint64_t);
+            }
+        }
+        for(size_t i = 0; i < m_negativePages.size(); i++) {
+            if(m_negativePages[i]) {
+                bytes += PAGE_WORDS * sizeof(uint64_t);
+            }
+        }
+        return bytes;
+    }
+
+    /**
+     * remove all ids from the set and free the pages
+     */
+    void clear() {
+        for(size_t i = 0; i < m_pages.size(); i++) {
+            delete[] m_pages[i];
+        }
+        for(size_t i = 0; i < m_negativePages.size(); i++) {
+            delete[] m_negativePages[i];
+        }
+        m_pages.clear();
+        m_negativePages.clear();
+        m_size = 0;
+    }
+};
+
+#endif // IMPORTER_IDSET_HPP
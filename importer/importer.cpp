@@ -8,6 +8,7 @@
  */
 
 #include <getopt.h>
+#include <sys/stat.h>
 
 #define OSMIUM_MAIN
 #define OSMIUM_WITH_PBF_INPUT
@@ -24,14 +25,301 @@
  */
 #include "handler.hpp"
 
+/**
+ * include the prepass-handler which collects information needed before the import starts.
+ */
+#include "prepass.hpp"
+
+/**
+ * the options/switches on the commandline
+ */
+struct ImportOptions {
+    std::string filename, nodestore, dsn, prefix;
+    std::string writeSnapshot, readSnapshot;
+    std::string join, tmpdir, granularity, generalize, bbox, polygon, since, until, sampleEvery, cluster, index;
+    size_t memoryLimit, splitVertices, indexJobs;
+    double tolerance, splitExtent;
+    bool printDebugMessages, printStoreErrors, calculateInterior;
+    bool keepLatLng, latlngTables, onlyReferenced, projectNodes, multipolygons, lazy, partition, validityRange, currentTables;
+
+    ImportOptions() :
+        filename(),
+        nodestore("stl"),
+        dsn(),
+        prefix("hist_"),
+        writeSnapshot(),
+        readSnapshot(),
+        join("nodestore"),
+        tmpdir("/tmp"),
+        granularity("second"),
+        generalize(),
+        bbox(),
+        polygon(),
+        since(),
+        until(),
+        sampleEvery(),
+        cluster("none"),
+        index("gist"),
+        memoryLimit(1024),
+        splitVertices(0),
+        indexJobs(4),
+        tolerance(0),
+        splitExtent(0),
+        printDebugMessages(false),
+        printStoreErrors(false),
+        calculateInterior(false),
+        keepLatLng(false),
+        latlngTables(false),
+        onlyReferenced(false),
+        projectNodes(false),
+        multipolygons(false),
+        lazy(false),
+        partition(false),
+        validityRange(false),
+        currentTables(false) {}
+};
+
+/**
+ * parse a comma separated list of zoom levels, returns false if it
+ * contains anything else
+ */
+bool parseZooms(const std::string& list, std::vector<int>& zooms) {
+    std::stringstream stream(list);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        char *end;
+        long zoom = strtol(item.c_str(), &end, 10);
+        if(item.empty() || *end != '\0' || zoom < 0 || zoom > 20) {
+            return false;
+        }
+        zooms.push_back(zoom);
+    }
+    return true;
+}
+
+/**
+ * the input file and the filters of this run, which decide which nodes
+ * end up in the nodestore and are recorded in nodestore snapshots
+ */
+NodestoreSnapshot::Fingerprint snapshotFingerprint(const ImportOptions& options) {
+    NodestoreSnapshot::Fingerprint fingerprint;
+    memset(&fingerprint, 0, sizeof(fingerprint));
+
+    struct stat st;
+    if(stat(options.filename.c_str(), &st) == 0) {
+        fingerprint.inputSize = st.st_size;
+        fingerprint.inputMtime = st.st_mtime;
+    }
+
+    time_t t;
+    if(Timestamp::parse(options.since, t)) {
+        fingerprint.since = t;
+    }
+    if(Timestamp::parse(options.until, t)) {
+        fingerprint.until = t;
+    }
+
+    if(options.bbox.size()) {
+        fingerprint.region = NodestoreSnapshot::hash("bbox " + options.bbox);
+    }
+    if(options.polygon.size()) {
+        std::ifstream file(options.polygon.c_str());
+        std::stringstream contents;
+        contents << file.rdbuf();
+        fingerprint.region = NodestoreSnapshot::hash("polygon " + contents.str());
+    }
+
+    fingerprint.onlyReferenced = options.onlyReferenced ? 1 : 0;
+    return fingerprint;
+}
+
+/**
+ * apply nodestore specific options, most nodestores have none
+ */
+template <class TNodestore>
+void configureNodestore(TNodestore* /*store*/, ImportOptions& /*options*/) {}
+
+/**
+ * the adaptive nodestore spills to disk when it reaches the memory limit
+ */
+template <class TDebug>
+void configureNodestore(NodestoreAdaptive<TDebug> *store, ImportOptions& options) {
+    store->memoryLimit(options.memoryLimit << 20);
+    store->tmpdir(options.tmpdir);
+}
+
+/**
+ * run the import with the nodestore TNodestore and the debug policy TDebug
+ */
+template <class TNodestore, class TDebug>
+int import(ImportOptions& options) {
+    // open the input-file
+    Osmium::OSMFile infile(options.filename);
+
+    // create an instance of the nodestore
+    TNodestore *store = new TNodestore();
+    configureNodestore(store, options);
+    store->snapshotFingerprint(snapshotFingerprint(options));
+
+    // create an instance of the import-handler
+    ImportHandler<TNodestore, TDebug> handler(store);
+
+    // copy relevant settings to the handler
+    if(options.dsn.size()) {
+        handler.dsn(options.dsn);
+    }
+    if(options.prefix.size()) {
+        handler.prefix(options.prefix);
+    }
+    handler.printDebugMessages(options.printDebugMessages);
+    handler.printStoreErrors(options.printStoreErrors);
+    handler.calculateInterior(options.calculateInterior);
+    handler.keepLatLng(options.keepLatLng);
+    handler.latlngTables(options.latlngTables);
+    handler.projectNodes(options.projectNodes);
+    handler.lazy(options.lazy);
+    handler.partitioned(options.partition);
+    handler.indexJobs(options.indexJobs);
+    handler.brin(options.index == "brin");
+    handler.validityRange(options.validityRange);
+    handler.currentTables(options.currentTables);
+    if(options.cluster == "hilbert") {
+        handler.cluster(options.tmpdir, options.memoryLimit << 20);
+    }
+
+    Granularity::Unit granularity;
+    Granularity::parse(options.granularity, granularity);
+    handler.granularity(granularity);
+
+    TimeWindow window;
+    time_t t;
+    if(Timestamp::parse(options.since, t)) {
+        window.since(t);
+    }
+    if(Timestamp::parse(options.until, t)) {
+        window.until(t);
+    }
+    Granularity::Unit sample;
+    if(Granularity::parse(options.sampleEvery, sample)) {
+        window.sampleEvery(sample);
+    }
+    handler.timeWindow(window);
+    handler.tolerance(options.tolerance);
+
+    std::vector<int> zooms;
+    parseZooms(options.generalize, zooms);
+    handler.generalize(zooms);
+    handler.splitVertices(options.splitVertices);
+    handler.splitExtent(options.splitExtent);
+    if(options.writeSnapshot.size()) {
+        handler.writeNodestoreSnapshot(options.writeSnapshot);
+    }
+    if(options.readSnapshot.size()) {
+        handler.readNodestoreSnapshot(options.readSnapshot);
+    }
+
+    // join nodes and ways in temporary files instead of the nodestore
+    ExternalJoin *externalJoin = NULL;
+    if(options.join == "external") {
+        externalJoin = new ExternalJoin(options.tmpdir, options.memoryLimit << 20);
+        handler.externalJoin(externalJoin);
+    }
+
+    // the region the import is restricted to
+    Region region;
+    bool restricted = options.bbox.size() || options.polygon.size();
+    if(options.bbox.size()) {
+        region.parseBbox(options.bbox);
+    }
+    if(options.polygon.size() && !region.readPoly(options.polygon)) {
+        std::cerr << "can't read the polygon file " << options.polygon << std::endl;
+        return 1;
+    }
+
+    // collect the nodes referenced by ways, the members of multipolygons and the region in a first pass
+    IdSet referencedNodes, multipolygonMembers, regionNodes, regionWays;
+    if(options.onlyReferenced || options.multipolygons || restricted) {
+        std::cerr << "reading the input file in a first pass..." << std::endl;
+
+        Osmium::OSMFile prepassfile(options.filename);
+        PrepassHandler prepass;
+        if(options.onlyReferenced) {
+            prepass.collectReferencedNodes(&referencedNodes);
+        }
+        if(options.multipolygons) {
+            prepass.collectMultipolygonMembers(&multipolygonMembers);
+        }
+        if(restricted) {
+            prepass.collectRegion(&region, &regionNodes, &regionWays);
+        }
+        Osmium::Input::read(prepassfile, prepass);
+
+        // the members of multipolygons crossing the border of the region
+        if(prepass.needsSecondPass()) {
+            std::cerr << "reading the ways again for the multipolygons crossing the border of the region..." << std::endl;
+
+            Osmium::OSMFile secondfile(options.filename);
+            prepass.secondPass();
+            Osmium::Input::read(secondfile, prepass);
+        }
+
+        if(options.onlyReferenced) {
+            handler.referencedNodes(&referencedNodes);
+        }
+        if(restricted) {
+            handler.region(&regionNodes, &regionWays);
+        }
+    }
+
+    // the coordinates of the multipolygon members, recorded while the ways are written
+    MemberWays memberWays(&multipolygonMembers);
+    if(options.multipolygons) {
+        memberWays.storeMercator(!options.keepLatLng);
+        handler.memberWays(&memberWays);
+    }
+
+    // read the input-file to the handler
+    Osmium::Input::read(infile, handler);
+
+    delete externalJoin;
+    delete store;
+
+    return 0;
+}
+
+/**
+ * pick the nodestore and run the import with it
+ */
+template <class TDebug>
+int selectNodestore(ImportOptions& options) {
+    // the external join builds a small stl nodestore for each way
+    if(options.join == "external") {
+        return import< NodestoreStl<TDebug>, TDebug >(options);
+    }
+
+    if(options.nodestore == "sparse") {
+        return import< NodestoreSparse<TDebug>, TDebug >(options);
+    }
+
+    if(options.nodestore == "adaptive") {
+        return import< NodestoreAdaptive<TDebug>, TDebug >(options);
+    }
+
+    return import< NodestoreStl<TDebug>, TDebug >(options);
+}
+
 /**
  * entry point into the importer.
  */
 int main(int argc, char *argv[]) {
-    // local variables for the options/switches on the commandline
-    std::string filename, nodestore = "stl", dsn, prefix = "hist_";
-    bool printDebugMessages = false, printStoreErrors = false, calculateInterior = false;
-    bool showHelp = false, keepLatLng = false;
+    // the options/switches on the commandline
+    ImportOptions options;
+    bool showHelp = false;
+
+    // temporary files go to $TMPDIR, if it is set
+    if(getenv("TMPDIR")) {
+        options.tmpdir = getenv("TMPDIR");
+    }
 
     // options configuration array for getopt
     static struct option long_options[] = {
@@ -41,15 +329,41 @@ int main(int argc, char *argv[]) {
         {"interior",            no_argument, 0, 'i'},
         {"latlng",              no_argument, 0, 'l'},
         {"latlon",              no_argument, 0, 'l'},
+        {"latlng-tables",       no_argument, 0, 'B'},
+        {"only-referenced",     no_argument, 0, 'r'},
+        {"project-nodes",       no_argument, 0, 'p'},
+        {"multipolygons",       no_argument, 0, 'm'},
+        {"lazy",                no_argument, 0, 'L'},
+        {"partition",           no_argument, 0, 'Y'},
+        {"index-jobs",          required_argument, 0, 'J'},
+        {"cluster",             required_argument, 0, 'C'},
+        {"index",               required_argument, 0, 'I'},
+        {"validity-range",      no_argument, 0, 'a'},
+        {"current-tables",      no_argument, 0, 'c'},
         {"nodestore",           required_argument, 0, 'S'},
         {"dsn",                 required_argument, 0, 'D'},
         {"prefix",              required_argument, 0, 'P'},
+        {"write-nodestore",     required_argument, 0, 'W'},
+        {"read-nodestore",      required_argument, 0, 'R'},
+        {"join",                required_argument, 0, 'j'},
+        {"memory-limit",        required_argument, 0, 'M'},
+        {"tmpdir",              required_argument, 0, 'T'},
+        {"granularity",         required_argument, 0, 'g'},
+        {"tolerance",           required_argument, 0, 't'},
+        {"generalize",          required_argument, 0, 'z'},
+        {"split-vertices",      required_argument, 0, 'V'},
+        {"split-extent",        required_argument, 0, 'X'},
+        {"bbox",                required_argument, 0, 'b'},
+        {"polygon",             required_argument, 0, 'o'},
+        {"since",               required_argument, 0, 's'},
+        {"until",               required_argument, 0, 'u'},
+        {"sample-every",        required_argument, 0, 'E'},
         {0, 0, 0, 0}
     };
 
     // walk through the options
     while(1) {
-        int c = getopt_long(argc, argv, "hdeilS:D:P:", long_options, 0);
+        int c = getopt_long(argc, argv, "hdeilBrpmLYacJ:C:I:S:D:P:W:R:j:M:T:g:t:z:V:X:b:o:s:u:E:", long_options, 0);
         if (c == -1)
             break;
 
@@ -61,39 +375,169 @@ int main(int argc, char *argv[]) {
 
             // enable debug messages
             case 'd':
-                printDebugMessages = true;
+                options.printDebugMessages = true;
                 break;
 
             // enables errors from the node-store. Possibly many in
             // softcutted files because of incomplete reference
             // in the input
             case 'e':
-                printStoreErrors = true;
+                options.printStoreErrors = true;
                 break;
 
             // calculate the interior-point ans store it in the database
             case 'i':
-                calculateInterior = true;
+                options.calculateInterior = true;
                 break;
 
             // keep lat/lng ant don't transform it to mercator
             case 'l':
-                keepLatLng = true;
+                options.keepLatLng = true;
+                break;
+
+            // write lat/lng tables next to the mercator ones
+            case 'B':
+                options.latlngTables = true;
+                break;
+
+            // only store nodes referenced by ways in the nodestore
+            case 'r':
+                options.onlyReferenced = true;
+                break;
+
+            // project the nodes once before storing them in the nodestore
+            case 'p':
+                options.projectNodes = true;
+                break;
+
+            // assemble multipolygon relations
+            case 'm':
+                options.multipolygons = true;
+                break;
+
+            // write node lists instead of way geometries
+            case 'L':
+                options.lazy = true;
+                break;
+
+            // split the tables into yearly partitions
+            case 'Y':
+                options.partition = true;
+                break;
+
+            // write the validity as a tsrange column, too
+            case 'a':
+                options.validityRange = true;
+                break;
+
+            // write the versions which are still valid to the current-tables
+            case 'c':
+                options.currentTables = true;
+                break;
+
+            // build the indexes of the partitions over this many connections
+            case 'J':
+                options.indexJobs = strtoul(optarg, NULL, 10);
+                break;
+
+            // sort the rows by a space-filling curve before copying them
+            case 'C':
+                options.cluster = optarg;
+                break;
+
+            // set the kind of index on geometry and validity
+            case 'I':
+                options.index = optarg;
                 break;
 
             // set the nodestore
             case 'S':
-                nodestore = optarg;
+                options.nodestore = optarg;
                 break;
 
             // set the database dsn, check the postgres documentation for syntax
             case 'D':
-                dsn = optarg;
+                options.dsn = optarg;
                 break;
 
             // set the table-prefix
             case 'P':
-                prefix = optarg;
+                options.prefix = optarg;
+                break;
+
+            // write the nodestore to a snapshot file after the nodes have been read
+            case 'W':
+                options.writeSnapshot = optarg;
+                break;
+
+            // read the nodestore from a snapshot file instead of building it
+            case 'R':
+                options.readSnapshot = optarg;
+                break;
+
+            // set the way nodes are joined with the ways
+            case 'j':
+                options.join = optarg;
+                break;
+
+            // set the memory budget in MB
+            case 'M':
+                options.memoryLimit = std::max(0L, strtol(optarg, NULL, 10));
+                break;
+
+            // set the directory for temporary files
+            case 'T':
+                options.tmpdir = optarg;
+                break;
+
+            // set the granularity of the minor way versions
+            case 'g':
+                options.granularity = optarg;
+                break;
+
+            // set the distance nodes need to move to create a minor way version
+            case 't':
+                options.tolerance = strtod(optarg, NULL);
+                break;
+
+            // write generalized tables for these zoom levels
+            case 'z':
+                options.generalize = optarg;
+                break;
+
+            // split polygons with more vertices
+            case 'V':
+                options.splitVertices = strtoul(optarg, NULL, 10);
+                break;
+
+            // split polygons with a larger extent
+            case 'X':
+                options.splitExtent = strtod(optarg, NULL);
+                break;
+
+            // restrict the import to a bounding box
+            case 'b':
+                options.bbox = optarg;
+                break;
+
+            // restrict the import to a polygon
+            case 'o':
+                options.polygon = optarg;
+                break;
+
+            // drop everything before this date
+            case 's':
+                options.since = optarg;
+                break;
+
+            // drop everything from this date on
+            case 'u':
+                options.until = optarg;
+                break;
+
+            // only keep the states at the start of each interval
+            case 'E':
+                options.sampleEvery = optarg;
                 break;
         }
     }
@@ -115,51 +559,240 @@ int main(int argc, char *argv[]) {
             << "       calculate the interior-point ans store it in the database" << std::endl
             << "  -l|--latlng" << std::endl
             << "       keep lat/lng ant don't transform to mercator" << std::endl
-            << "  -s|--nodestore" << std::endl
-            << "       set the nodestore type [defaults to '" << nodestore << "']" << std::endl
+            << "  -B|--latlng-tables" << std::endl
+            << "       write the point-, line-, roads- and polygon-tables a second time with" << std::endl
+            << "       lat/lng geometries (SRID 4326) in the same pass, eg. hist_line_4326" << std::endl
+            << "  -r|--only-referenced" << std::endl
+            << "       read the ways in a first pass and only store nodes referenced by a way" << std::endl
+            << "       in the nodestore" << std::endl
+            << "  -p|--project-nodes" << std::endl
+            << "       project the nodes to mercator once and store the projected coordinates" << std::endl
+            << "       (in centimeters) in the nodestore" << std::endl
+            << "  -m|--multipolygons" << std::endl
+            << "       assemble multipolygon and boundary relations into areas, which are written" << std::endl
+            << "       to the polygon-table with negative ids. needs a first pass over the file" << std::endl
+            << "  -L|--lazy" << std::endl
+            << "       don't write the geometries and minor versions of the ways, but their node" << std::endl
+            << "       lists to the way-table. the geometries are assembled in the database when" << std::endl
+            << "       they are queried" << std::endl
+            << "  -Y|--partition" << std::endl
+            << "       split the point-, line-, roads- and polygon-table into partitions by the" << std::endl
+            << "       year of valid_from (eg. hist_line_y2009)" << std::endl
+            << "  -J|--index-jobs N" << std::endl
+            << "       build the indexes of the partitions over N connections at the same time" << std::endl
+            << "       [defaults to " << options.indexJobs << "]" << std::endl
+            << "  -a|--validity-range" << std::endl
+            << "       also write the validity of the point-, line-, roads- and polygon-table as" << std::endl
+            << "       a tsrange column, indexed together with the geometry for querying it with" << std::endl
+            << "       @> (needs PostgreSQL 9.2)" << std::endl
+            << "  -c|--current-tables" << std::endl
+            << "       also write the versions which are still valid to the tables" << std::endl
+            << "       hist_current_point, _line, _roads and _polygon with the columns of an" << std::endl
+            << "       osm2pgsql database, for rendering the present state" << std::endl
+            << "  -C|--cluster" << std::endl
+            << "       set the physical order of the point-, line-, roads- and polygon-table" << std::endl
+            << "       [defaults to '" << options.cluster << "']" << std::endl
+            << "       possible values: " << std::endl
+            << "          none    (the order of the input file)" << std::endl
+            << "          hilbert (sorted by the Hilbert cell of the geometry and valid_from" << std::endl
+            << "                   before copying, spilling to --tmpdir)" << std::endl
+            << "  -I|--index" << std::endl
+            << "       set the index on geometry and validity [defaults to '" << options.index << "']" << std::endl
+            << "       possible values: " << std::endl
+            << "          gist (a composite GiST index)" << std::endl
+            << "          brin (a much smaller BRIN index, only useful with --cluster hilbert," << std::endl
+            << "                needs PostgreSQL 9.5 and PostGIS 2.3)" << std::endl
+            << "  -S|--nodestore" << std::endl
+            << "       set the nodestore type [defaults to '" << options.nodestore << "']" << std::endl
             << "       possible values: " << std::endl
             << "          stl    (needs more memory but is more robust and a little faster)" << std::endl
             << "          sparse (needs much, much less memory but is still experimental)" << std::endl
+            << "          adaptive (keeps the nodes in memory up to --memory-limit and spills" << std::endl
+            << "                    the rest to a file in --tmpdir)" << std::endl
             << "  -D|--dsn" << std::endl
             << "       set the database dsn, check the postgres documentation for syntax" << std::endl
             << "  -P|--prefix" << std::endl
-            << "       set the table-prefix [defaults to '"  << prefix << "']" << std::endl;
+            << "       set the table-prefix [defaults to '"  << options.prefix << "']" << std::endl
+            << "  -W|--write-nodestore FILE" << std::endl
+            << "       write the nodestore to a snapshot file after all nodes have been read" << std::endl
+            << "  -R|--read-nodestore FILE" << std::endl
+            << "       read the nodestore from a snapshot file written by --write-nodestore" << std::endl
+            << "       instead of building it from the nodes in the input file" << std::endl
+            << "  -j|--join" << std::endl
+            << "       set how the ways are joined with their nodes [defaults to '" << options.join << "']" << std::endl
+            << "       possible values: " << std::endl
+            << "          nodestore (keep all nodes in the nodestore)" << std::endl
+            << "          external  (sort and join the nodes and ways in temporary files," << std::endl
+            << "                     for inputs that don't fit into memory)" << std::endl
+            << "  -M|--memory-limit MB" << std::endl
+            << "       memory used by the adaptive nodestore or for sorting in the external join" << std::endl
+            << "       [defaults to " << options.memoryLimit << "]" << std::endl
+            << "  -T|--tmpdir DIR" << std::endl
+            << "       directory for temporary files [defaults to '" << options.tmpdir << "']" << std::endl
+            << "  -g|--granularity" << std::endl
+            << "       only keep the last minor way version in each interval [defaults to '" << options.granularity << "']" << std::endl
+            << "       possible values: second, minute, hour, day, month, quarter, year" << std::endl
+            << "  -t|--tolerance METERS" << std::endl
+            << "       only create a minor way version when a node moved further then this" << std::endl
+            << "       distance (in projected meters) [defaults to " << options.tolerance << "]" << std::endl
+            << "  -z|--generalize ZOOMS" << std::endl
+            << "       additionally write simplified line- and polygon-tables for rendering at" << std::endl
+            << "       these zoom levels and below, eg. '6,9' (writes hist_line_z6, hist_line_z9, ...)" << std::endl
+            << "  -V|--split-vertices N" << std::endl
+            << "       split polygons with more then N vertices into grid aligned parts" << std::endl
+            << "  -X|--split-extent METERS" << std::endl
+            << "       split polygons wider or higher then this distance (in projected meters)" << std::endl
+            << "       into grid aligned parts" << std::endl
+            << "  -b|--bbox MINLON,MINLAT,MAXLON,MAXLAT" << std::endl
+            << "       only import the nodes and ways inside of this bounding box. needs a first" << std::endl
+            << "       pass over the file" << std::endl
+            << "  -o|--polygon FILE" << std::endl
+            << "       only import the nodes and ways inside of the polygon in this file (osmosis" << std::endl
+            << "       polygon format). needs a first pass over the file" << std::endl
+            << "  -s|--since DATE" << std::endl
+            << "       only import the versions valid from this date (yyyy-mm-dd or" << std::endl
+            << "       yyyy-mm-ddThh:mm:ssZ) on and start their validity there" << std::endl
+            << "  -u|--until DATE" << std::endl
+            << "       only import the versions valid before this date and end their validity there" << std::endl
+            << "  -E|--sample-every UNIT" << std::endl
+            << "       only import the states valid at the start of each interval, one of" << std::endl
+            << "       day, month, quarter, year (or any other granularity)" << std::endl;
 
         return 1;
     }
 
     // strip off the filename
-    filename = argv[optind];
+    options.filename = argv[optind];
 
-    // open the input-file
-    Osmium::OSMFile infile(filename);
+    if(options.join != "nodestore" && options.join != "external") {
+        std::cerr << "unknown join mode: " << options.join << std::endl;
+        return 1;
+    }
 
-    // create an instance of the import-handler
-    Nodestore *store;
-    if(nodestore == "sparse")
-        store = new NodestoreSparse();
-    else
-        store = new NodestoreStl();
+    Granularity::Unit granularity;
+    if(!Granularity::parse(options.granularity, granularity)) {
+        std::cerr << "unknown granularity: " << options.granularity << std::endl;
+        return 1;
+    }
 
-    // create an instance of the import-handler
-    ImportHandler handler(store);
+    if(options.tolerance < 0) {
+        std::cerr << "the tolerance can't be negative" << std::endl;
+        return 1;
+    }
 
-    // copy relevant settings to the handler
-    if(dsn.size()) {
-        handler.dsn(dsn);
+    time_t since = 0, until = 0;
+    if(options.since.size() && !Timestamp::parse(options.since, since)) {
+        std::cerr << "invalid date: " << options.since << std::endl;
+        return 1;
     }
-    if(prefix.size()) {
-        handler.prefix(prefix);
+
+    if(options.until.size() && !Timestamp::parse(options.until, until)) {
+        std::cerr << "invalid date: " << options.until << std::endl;
+        return 1;
     }
-    handler.printDebugMessages(printDebugMessages);
-    handler.printStoreErrors(printStoreErrors);
-    handler.calculateInterior(calculateInterior);
-    handler.keepLatLng(keepLatLng);
 
-    // read the input-file to the handler
-    Osmium::Input::read(infile, handler);
+    if(since && until && since >= until) {
+        std::cerr << "--since needs to be before --until" << std::endl;
+        return 1;
+    }
 
-    delete store;
+    Granularity::Unit sample;
+    if(options.sampleEvery.size() && !Granularity::parse(options.sampleEvery, sample)) {
+        std::cerr << "unknown sampling interval: " << options.sampleEvery << std::endl;
+        return 1;
+    }
 
-    return 0;
+    if(options.bbox.size() && options.polygon.size()) {
+        std::cerr << "--bbox and --polygon can't be used together" << std::endl;
+        return 1;
+    }
+
+    Region region;
+    if(options.bbox.size() && !region.parseBbox(options.bbox)) {
+        std::cerr << "invalid bounding box: " << options.bbox << std::endl;
+        return 1;
+    }
+
+    std::vector<int> zooms;
+    if(!parseZooms(options.generalize, zooms)) {
+        std::cerr << "invalid list of zoom levels: " << options.generalize << std::endl;
+        return 1;
+    }
+
+    if(zooms.size() && options.keepLatLng) {
+        std::cerr << "--generalize can't be used together with --latlng" << std::endl;
+        return 1;
+    }
+
+    if(options.splitExtent < 0) {
+        std::cerr << "the split extent can't be negative" << std::endl;
+        return 1;
+    }
+
+    if((options.splitVertices || options.splitExtent) && options.keepLatLng) {
+        std::cerr << "--split-vertices and --split-extent can't be used together with --latlng" << std::endl;
+        return 1;
+    }
+
+    if(options.lazy && (zooms.size() || options.multipolygons || options.splitVertices || options.splitExtent)) {
+        std::cerr << "--lazy can't be used together with --generalize, --multipolygons or --split-*, which need the way geometries" << std::endl;
+        return 1;
+    }
+
+    if(options.latlngTables && (options.keepLatLng || options.lazy)) {
+        std::cerr << "--latlng-tables can't be used together with --latlng or --lazy" << std::endl;
+        return 1;
+    }
+
+    if(options.partition && options.lazy) {
+        std::cerr << "--partition can't be used together with --lazy" << std::endl;
+        return 1;
+    }
+
+    if(options.cluster != "none" && options.cluster != "hilbert") {
+        std::cerr << "unknown cluster order: " << options.cluster << std::endl;
+        return 1;
+    }
+
+    if(options.index != "gist" && options.index != "brin") {
+        std::cerr << "unknown index type: " << options.index << std::endl;
+        return 1;
+    }
+
+    if(options.currentTables && (options.lazy || until)) {
+        std::cerr << "--current-tables can't be used together with --lazy or --until" << std::endl;
+        return 1;
+    }
+
+    if(options.memoryLimit < 1) {
+        std::cerr << "the memory limit needs to be at least 1 MB" << std::endl;
+        return 1;
+    }
+
+    if(options.indexJobs < 1) {
+        std::cerr << "at least one index job is needed" << std::endl;
+        return 1;
+    }
+
+    if(options.lazy && options.join == "external") {
+        std::cerr << "--lazy needs the nodestore and can't be used with --join external" << std::endl;
+        return 1;
+    }
+
+    if(options.projectNodes && options.keepLatLng) {
+        std::cerr << "--project-nodes can't be used together with --latlng" << std::endl;
+        return 1;
+    }
+
+    if(options.join == "external" && (options.writeSnapshot.size() || options.readSnapshot.size())) {
+        std::cerr << "the external join does not use a nodestore, so it can't write or read nodestore snapshots" << std::endl;
+        return 1;
+    }
+
+    // pick the debug policy, the nodestore and instantiate the import for them
+    if(options.printDebugMessages || options.printStoreErrors) {
+        return selectNodestore<DebugEnabled>(options);
+    } else {
+        return selectNodestore<DebugDisabled>(options);
+    }
 }
@@ -0,0 +1,145 @@
+/**
+ * Multipolygon relations are assembled from the geometries of their member
+ * ways, which are written long before the relations are read. Instead of
+ * building the member geometries from the nodestore again for every point
+ * in time a relation needs to be assembled for, the MemberWays keep the
+ * coordinates of every version and minor version written for a way that
+ * is a member of any multipolygon relation, together with the time range
+ * it was valid in. Which ways are members is collected in the prepass.
+ *
+ * The coordinates are stored as fixed point integers like in the sparse
+ * nodestore. Consecutive versions of a way with the same coordinates (for
+ * example when only the tags changed) are merged into one slice, so the
+ * relation is not rebuilt for them.
+ */
+
+#ifndef IMPORTER_MEMBERWAYS_HPP
+#define IMPORTER_MEMBERWAYS_HPP
+
+#include "idset.hpp"
+
+class MemberWays {
+public:
+    /**
+     * the coordinates of a member way in a range of time
+     */
+    struct Slice {
+        /**
+         * the range of time the coordinates are valid in, to is 0 if they
+         * are still valid
+         */
+        time_t from, to;
+
+        std::vector<int32_t> x, y;
+
+        /**
+         * is the slice valid at time t?
+         */
+        bool validAt(time_t t) const {
+            return from <= t && (to == 0 || t < to);
+        }
+    };
+
+    typedef std::vector<Slice> slices_t;
+
+private:
+    typedef std::map<osm_object_id_t, slices_t> slicemap;
+
+    /**
+     * ids of the ways that are members of a multipolygon relation
+     */
+    IdSet *m_members;
+
+    slicemap m_slices;
+
+    bool m_mercator;
+
+    uint64_t m_count, m_merged, m_coordinates;
+
+public:
+    MemberWays(IdSet *members) : m_members(members), m_slices(), m_mercator(true), m_count(0), m_merged(0), m_coordinates(0) {}
+
+    /**
+     * are the coordinates stored in mercator meters or in degrees?
+     */
+    bool isStoringMercator() {
+        return m_mercator;
+    }
+
+    void storeMercator(bool mercator) {
+        m_mercator = mercator;
+    }
+
+    /**
+     * is the way a member of a multipolygon relation?
+     */
+    bool isMember(osm_object_id_t id) const {
+        return m_members->test(id);
+    }
+
+    /**
+     * record the coordinates of a way version valid from from to to. the
+     * versions of a way need to be recorded in the order of time.
+     */
+    void record(osm_object_id_t id, time_t from, time_t to, const geos::geom::Geometry* geom) {
+        const geos::geom::LineString* line;
+        if(geom->getGeometryTypeId() == geos::geom::GEOS_POLYGON) {
+            line = dynamic_cast<const geos::geom::Polygon*>(geom)->getExteriorRing();
+        } else {
+            line = dynamic_cast<const geos::geom::LineString*>(geom);
+        }
+
+        const geos::geom::CoordinateSequence* coords = line->getCoordinatesRO();
+        size_t size = coords->getSize();
+
+        Slice slice;
+        slice.from = from;
+        slice.to = to;
+        slice.x.resize(size);
+        slice.y.resize(size);
+        for(size_t i = 0; i < size; i++) {
+            const geos::geom::Coordinate& c = coords->getAt(i);
+            slice.x[i] = Nodestore::toFix(c.x, m_mercator);
+            slice.y[i] = Nodestore::toFix(c.y, m_mercator);
+        }
+
+        slices_t& slices = m_slices[id];
+
+        // the same coordinates as the slice before, just extend its range
+        if(!slices.empty() && slices.back().to == from && slices.back().x == slice.x && slices.back().y == slice.y) {
+            slices.back().to = to;
+            m_merged++;
+            return;
+        }
+
+        slices.push_back(slice);
+        m_count++;
+        m_coordinates += size;
+    }
+
+    /**
+     * all slices of the way in the order of time, NULL if none has been
+     * recorded
+     */
+    const slices_t* slices(osm_object_id_t id) const {
+        slicemap::const_iterator it = m_slices.find(id);
+        if(it == m_slices.end()) {
+            return NULL;
+        }
+        return &it->second;
+    }
+
+    /**
+     * convert a stored coordinate back
+     */
+    double fromFix(int32_t fix) const {
+        return Nodestore::fromFix(fix, m_mercator);
+    }
+
+    void printStatistics() {
+        std::cerr << "member ways: " << m_slices.size() << " ways, " << m_count << " slices with " << m_coordinates << " coordinates (" <<
+            ((m_coordinates * 2 * sizeof(int32_t)) >> 20) << " MB), " << m_merged << " versions without coordinate changes merged" << std::endl;
+    }
+};
+
+#endif // IMPORTER_MEMBERWAYS_HPP
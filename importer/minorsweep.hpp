@@ -0,0 +1,414 @@
+/**
+ * A minor way version is written for each point in time one of the nodes
+ * of a way was changed. Looking up all nodes and building the geometry
+ * from scratch for each minor version costs O(minors * nodes) lookups,
+ * which is where heavily edited ways spend most of their time.
+ *
+ * The MinorSweep fetches the timeline of each node of the way only once,
+ * reading it directly from the versions held by the NodestoreCache.
+ * It collects the coordinates of all nodes at the time of the way version
+ * into a running coordinate array and the later node versions into a list
+ * of events, sorted by time. The minor versions are then produced by
+ * applying the events of each minor time to the running array, which then
+ * holds the coordinates of the way at that time.
+ *
+ * The coordinates at each minor time are the ones the GeomBuilder would
+ * look up for it. The minor times are the times of the node versions
+ * after the start of the way version up to and including its end, except
+ * for those at which no coordinate of the way changes (ie. when a node
+ * only got new tags or was saved again at the same position). Those would only duplicate the geometry of the version
+ * before, so they are skipped and counted.
+ *
+ * With a granularity coarser then a second, only the last minor time of
+ * each interval is kept (see granularity.hpp). Its geometry contains all
+ * changes up to that time and the row before it stays valid until then,
+ * so the validity ranges stay contiguous.
+ *
+ * With a tolerance, a minor version is only created when at least one
+ * node moved further then the tolerance (in projected meters) away from
+ * its position in the last minor version. Smaller moves stay in the
+ * validity range of the version before, until they add up or another
+ * node moves far enough.
+ */
+
+#ifndef IMPORTER_MINORSWEEP_HPP
+#define IMPORTER_MINORSWEEP_HPP
+
+#include "project.hpp"
+#include "granularity.hpp"
+
+/**
+ * timestamp and user of a minor way version
+ */
+struct MinorTimesInfo {
+    time_t t;
+    osm_user_id_t uid;
+
+    bool operator<(const MinorTimesInfo& a) const
+    {
+        return t < a.t;
+    }
+
+    bool operator==(const MinorTimesInfo& a) const
+    {
+        return t == a.t;
+    }
+};
+
+template <class TNodestore, class TDebug>
+class MinorSweep {
+private:
+    /**
+     * a node version changing the coordinate at pos of the running array
+     */
+    struct Event {
+        time_t t;
+        osm_user_id_t uid;
+        uint32_t pos;
+        double lon, lat;
+
+        bool operator<(const Event& other) const {
+            return t < other.t;
+        }
+    };
+
+    TNodestore *m_nodestore;
+
+    /**
+     * the running coordinate array, one entry per node found in the store
+     */
+    std::vector<double> m_lon, m_lat;
+
+    /**
+     * all events, sorted by time
+     */
+    std::vector<Event> m_events;
+
+    /**
+     * the minor times and the position of the next event to apply
+     */
+    std::vector<MinorTimesInfo> m_times;
+    size_t m_next;
+
+    /**
+     * number of minor times skipped because no coordinate changed
+     */
+    uint64_t m_skipped;
+
+    /**
+     * the granularity of the minor times and the number of minor times
+     * merged into a later one of the same interval
+     */
+    Granularity::Unit m_granularity;
+    uint64_t m_merged;
+
+    bool m_showerrors;
+
+    /**
+     * minimal distance in projected meters a node needs to move away from
+     * its position in the last minor version to create a new one
+     */
+    double m_tolerance;
+    uint64_t m_coalesced;
+
+    /**
+     * does the coordinate at pos in the measure arrays differ from the one
+     * at the last minor version (or the way version itself)
+     */
+    bool moved(double lon, double lat, double lastLon, double lastLat) {
+        if(m_tolerance <= 0) {
+            return lon != lastLon || lat != lastLat;
+        }
+
+        double dx = lon - lastLon, dy = lat - lastLat;
+        return !(dx * dx + dy * dy <= m_tolerance * m_tolerance);
+    }
+
+    /**
+     * replay the events on the measure coordinates, which contain the
+     * initial coordinates of the nodeCount nodes followed by those of the
+     * events, and collect the times of the minor versions
+     */
+    void findMinorTimes(size_t nodeCount, const std::vector<double>& mlon, const std::vector<double>& mlat) {
+        // the coordinates at the last minor version and the current ones
+        std::vector<double> lastLon(mlon.begin(), mlon.begin() + nodeCount), lastLat(mlat.begin(), mlat.begin() + nodeCount);
+        std::vector<double> curLon(lastLon), curLat(lastLat);
+
+        // positions changed since the last minor version
+        std::vector<uint32_t> dirty;
+        std::vector<bool> isDirty(nodeCount, false);
+
+        for(size_t i = 0; i < m_events.size(); ) {
+            time_t t = m_events[i].t;
+            osm_user_id_t uid = m_events[i].uid;
+            bool changed = false, moves = false;
+
+            for(; i < m_events.size() && m_events[i].t == t; i++) {
+                const Event& event = m_events[i];
+                double lon = mlon[nodeCount + i], lat = mlat[nodeCount + i];
+                if(curLon[event.pos] != lon || curLat[event.pos] != lat) {
+                    if(!changed) {
+                        uid = event.uid;
+                        changed = true;
+                    }
+                    curLon[event.pos] = lon;
+                    curLat[event.pos] = lat;
+
+                    if(!isDirty[event.pos]) {
+                        isDirty[event.pos] = true;
+                        dirty.push_back(event.pos);
+                    }
+                }
+            }
+
+            if(!changed) {
+                m_skipped++;
+                continue;
+            }
+
+            // did any of the nodes changed since the last minor version move far enough?
+            for(size_t d = 0; d < dirty.size() && !moves; d++) {
+                uint32_t pos = dirty[d];
+                moves = moved(curLon[pos], curLat[pos], lastLon[pos], lastLat[pos]);
+            }
+
+            if(!moves) {
+                m_coalesced++;
+                continue;
+            }
+
+            for(size_t d = 0; d < dirty.size(); d++) {
+                uint32_t pos = dirty[d];
+                lastLon[pos] = curLon[pos];
+                lastLat[pos] = curLat[pos];
+                isDirty[pos] = false;
+            }
+            dirty.clear();
+
+            // a later change in the same interval replaces the minor time before
+            MinorTimesInfo info = {t, uid};
+            if(!m_times.empty() && Granularity::bucket(m_times.back().t, m_granularity) == Granularity::bucket(t, m_granularity)) {
+                m_times.back() = info;
+                m_merged++;
+            } else {
+                m_times.push_back(info);
+            }
+        }
+    }
+
+public:
+    MinorSweep(TNodestore *nodestore) : m_nodestore(nodestore), m_lon(), m_lat(), m_events(), m_times(), m_next(0), m_skipped(0), m_granularity(Granularity::SECOND), m_merged(0), m_showerrors(false), m_tolerance(0), m_coalesced(0) {}
+
+    /**
+     * start the sweep over the nodes of a way version valid from from to
+     * to (0 if it is the last version). if project is true, the
+     * coordinates are projected to mercator.
+     */
+    void start(const Osmium::OSM::WayNodeList &nodes, time_t from, time_t to, bool project) {
+        m_lon.clear();
+        m_lat.clear();
+        m_events.clear();
+        m_times.clear();
+        m_next = 0;
+
+        for(Osmium::OSM::WayNodeList::const_iterator nodeit = nodes.begin(); nodeit != nodes.end(); nodeit++) {
+            osm_object_id_t id = nodeit->ref();
+
+            // the versions of the node, sorted by time
+            typedef typename TNodestore::Version Version;
+            const Version *begin, *end;
+
+            // a missing node can just be skipped
+            if(!m_nodestore->versions(id, begin, end)) {
+                continue;
+            }
+
+            // the first version younger then from
+            const Version *lower = begin;
+            while(lower != end && lower->t <= from) {
+                lower++;
+            }
+
+            // the version valid at from, or the first one if the way is older then the node
+            const Version *initial = lower;
+            if(initial == begin) {
+                if(TDebug::enabled && m_showerrors) {
+                    std::cerr << "reference to node #" << id << " at tstamp " << from << " which is before the youngest available version of that node, using first version" << std::endl;
+                }
+            } else {
+                initial--;
+            }
+
+            uint32_t pos = m_lon.size();
+            m_lon.push_back(initial->info.lon);
+            m_lat.push_back(initial->info.lat);
+
+            // the later versions up to and including to
+            for(const Version *it = lower; it != end && (to == 0 || it->t <= to); it++) {
+                Event event = {it->t, it->info.uid, pos, it->info.lon, it->info.lat};
+                m_events.push_back(event);
+            }
+        }
+
+        // keep the events of the same time in the order of the nodes
+        std::stable_sort(m_events.begin(), m_events.end());
+
+        size_t nodeCount = m_lon.size(), count = nodeCount + m_events.size();
+
+        // all coordinates in one array: first the initial ones, then those of the events
+        std::vector<double> lon(count), lat(count);
+        std::copy(m_lon.begin(), m_lon.end(), lon.begin());
+        std::copy(m_lat.begin(), m_lat.end(), lat.begin());
+        for(size_t i = 0; i < m_events.size(); i++) {
+            lon[nodeCount + i] = m_events[i].lon;
+            lat[nodeCount + i] = m_events[i].lat;
+        }
+
+        // the coordinates the changes are measured with. without a tolerance
+        // any difference counts, otherwise the distance is measured in
+        // projected meters
+        std::vector<double> mlon, mlat;
+        bool projected = false;
+        if(m_tolerance > 0 && !m_nodestore->isStoringMercator()) {
+            if(project) {
+                // the projected coordinates are needed for the geometries, too
+                if(count > 0) {
+                    Project::toMercator(&lon[0], &lat[0], count);
+                }
+                projected = true;
+                mlon = lon;
+                mlat = lat;
+            } else {
+                mlon = lon;
+                mlat = lat;
+                if(count > 0) {
+                    Project::toMercator(&mlon[0], &mlat[0], count);
+                }
+            }
+        } else {
+            mlon = lon;
+            mlat = lat;
+        }
+
+        findMinorTimes(nodeCount, mlon, mlat);
+
+        if(project && !projected && count > 0) {
+            Project::toMercator(&lon[0], &lat[0], count);
+        }
+
+        std::copy(lon.begin(), lon.begin() + nodeCount, m_lon.begin());
+        std::copy(lat.begin(), lat.begin() + nodeCount, m_lat.begin());
+        for(size_t i = 0; i < m_events.size(); i++) {
+            m_events[i].lon = lon[nodeCount + i];
+            m_events[i].lat = lat[nodeCount + i];
+        }
+    }
+
+    /**
+     * the times of the minor versions, in ascending order
+     */
+    const std::vector<MinorTimesInfo>& times() const {
+        return m_times;
+    }
+
+    /**
+     * apply the events up to and including time t to the running
+     * coordinate array. the times need to be advanced to in ascending order
+     */
+    void advance(time_t t) {
+        for(; m_next < m_events.size() && m_events[m_next].t <= t; m_next++) {
+            const Event& event = m_events[m_next];
+            m_lon[event.pos] = event.lon;
+            m_lat[event.pos] = event.lat;
+        }
+    }
+
+    /**
+     * the running coordinate array, NaN for coordinates that could not be
+     * projected
+     */
+    const double *lon() const {
+        return m_lon.empty() ? NULL : &m_lon[0];
+    }
+
+    const double *lat() const {
+        return m_lat.empty() ? NULL : &m_lat[0];
+    }
+
+    size_t size() const {
+        return m_lon.size();
+    }
+
+    /**
+     * the bounding box of all coordinates the nodes of the way take during
+     * the sweep, returns false if there is none
+     */
+    bool bounds(double &minx, double &miny, double &maxx, double &maxy) const {
+        bool found = false;
+        for(size_t i = 0; i < m_lon.size() + m_events.size(); i++) {
+            double lon = i < m_lon.size() ? m_lon[i] : m_events[i - m_lon.size()].lon;
+            double lat = i < m_lon.size() ? m_lat[i] : m_events[i - m_lon.size()].lat;
+
+            // coordinates that could not be projected
+            if(lon != lon) {
+                continue;
+            }
+
+            if(!found) {
+                minx = maxx = lon;
+                miny = maxy = lat;
+                found = true;
+            } else {
+                minx = std::min(minx, lon);
+                maxx = std::max(maxx, lon);
+                miny = std::min(miny, lat);
+                maxy = std::max(maxy, lat);
+            }
+        }
+        return found;
+    }
+
+    /**
+     * number of minor versions skipped because no coordinate changed
+     */
+    uint64_t skipped() const {
+        return m_skipped;
+    }
+
+    /**
+     * number of minor versions merged into a later one of the same interval
+     */
+    uint64_t merged() const {
+        return m_merged;
+    }
+
+    /**
+     * number of minor versions merged into the one before because no node
+     * moved further then the tolerance
+     */
+    uint64_t coalesced() const {
+        return m_coalesced;
+    }
+
+    double tolerance() const {
+        return m_tolerance;
+    }
+
+    void tolerance(double meters) {
+        m_tolerance = meters;
+    }
+
+    Granularity::Unit granularity() const {
+        return m_granularity;
+    }
+
+    void granularity(Granularity::Unit unit) {
+        m_granularity = unit;
+    }
+
+    void printStoreErrors(bool shouldPrintStoreErrors) {
+        m_showerrors = shouldPrintStoreErrors;
+    }
+};
+
+#endif // IMPORTER_MINORSWEEP_HPP
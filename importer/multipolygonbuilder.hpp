@@ -0,0 +1,342 @@
+/**
+ * A multipolygon relation needs to be assembled again each time one of
+ * its member ways changes. Over the history of a large boundary relation
+ * this happens thousands of times, but most changes only move nodes
+ * inside of a member way and don't change which members connect to which
+ * rings.
+ *
+ * The MultipolygonBuilder joins the member ways at their end points into
+ * closed rings and decides which rings are outer rings and which are
+ * holes by nesting them into each other. The chaining (the order and
+ * direction of the members in each ring) is kept, and reused as long as
+ * the same members are present and their end points did not change. Then
+ * only the coordinates of the rings are collected again. The nesting
+ * depends on all coordinates of the rings, so it is decided again for
+ * each geometry, which is cheap next to building it.
+ *
+ * The roles of the members are not consulted, the nesting of the rings
+ * decides: a ring inside of an odd number of other rings is a hole.
+ */
+
+#ifndef IMPORTER_MULTIPOLYGONBUILDER_HPP
+#define IMPORTER_MULTIPOLYGONBUILDER_HPP
+
+#include "memberways.hpp"
+
+class MultipolygonBuilder {
+private:
+    /**
+     * a member way in a ring, possibly walked in reverse direction
+     */
+    struct RingPart {
+        size_t member;
+        bool reversed;
+    };
+
+    /**
+     * the members and the nesting of a ring
+     */
+    struct Ring {
+        std::vector<RingPart> parts;
+
+        /**
+         * does the ring have enough points to be used?
+         */
+        bool valid;
+
+        /**
+         * the ring this one is directly nested in, -1 if none
+         */
+        int parent;
+
+        /**
+         * number of rings this one is nested in
+         */
+        int depth;
+
+        /**
+         * the bounding box of the ring
+         */
+        int32_t minx, miny, maxx, maxy;
+    };
+
+    /**
+     * the end points of a member the topology was assembled with, and if
+     * the member was present at all
+     */
+    struct Ends {
+        bool present;
+        int32_t x0, y0, x1, y1;
+
+        bool operator==(const Ends& other) const {
+            return present == other.present && (!present || (x0 == other.x0 && y0 == other.y0 && x1 == other.x1 && y1 == other.y1));
+        }
+    };
+
+    const MemberWays *m_memberWays;
+
+    /**
+     * the cached chaining of the rings and the end points it is valid for
+     */
+    std::vector<Ring> m_rings;
+    std::vector<Ends> m_ends;
+    bool m_hasTopology;
+
+    /**
+     * the coordinates of each ring in the geometry currently built
+     */
+    std::vector< std::vector<int32_t> > m_rx, m_ry;
+
+    uint64_t m_builds, m_assembled;
+
+    static Ends endsOf(const MemberWays::Slice* slice) {
+        Ends ends;
+        ends.present = slice && slice->x.size() >= 2;
+        ends.x0 = ends.y0 = ends.x1 = ends.y1 = 0;
+        if(ends.present) {
+            ends.x0 = slice->x.front();
+            ends.y0 = slice->y.front();
+            ends.x1 = slice->x.back();
+            ends.y1 = slice->y.back();
+        }
+        return ends;
+    }
+
+    /**
+     * collect the coordinates of a ring, without repeating the points
+     * where two members join
+     */
+    static void collect(const Ring& ring, const std::vector<const MemberWays::Slice*>& slices, std::vector<int32_t>& x, std::vector<int32_t>& y) {
+        x.clear();
+        y.clear();
+        for(size_t p = 0; p < ring.parts.size(); p++) {
+            const MemberWays::Slice* slice = slices[ring.parts[p].member];
+            size_t size = slice->x.size();
+            for(size_t i = (p == 0 ? 0 : 1); i < size; i++) {
+                size_t j = ring.parts[p].reversed ? size - 1 - i : i;
+                x.push_back(slice->x[j]);
+                y.push_back(slice->y[j]);
+            }
+        }
+    }
+
+    /**
+     * is the point inside of the ring? (crossing number test)
+     */
+    static bool inside(int32_t px, int32_t py, const std::vector<int32_t>& x, const std::vector<int32_t>& y) {
+        bool in = false;
+        for(size_t i = 0, j = x.size() - 1; i < x.size(); j = i++) {
+            if((y[i] > py) != (y[j] > py) &&
+                    px < (double)(x[j] - x[i]) * (py - y[i]) / (double)(y[j] - y[i]) + x[i]) {
+                in = !in;
+            }
+        }
+        return in;
+    }
+
+    /**
+     * join the present members into closed rings
+     */
+    void assemble(const std::vector<const MemberWays::Slice*>& slices) {
+        m_rings.clear();
+        m_assembled++;
+
+        // index the members by their first and their last point
+        typedef std::pair<int32_t, int32_t> point_t;
+        typedef std::multimap<point_t, size_t> endmap;
+        endmap ends;
+        std::vector<bool> used(slices.size(), false);
+        for(size_t i = 0; i < slices.size(); i++) {
+            if(!m_ends[i].present) {
+                used[i] = true;
+                continue;
+            }
+            ends.insert(std::make_pair(point_t(m_ends[i].x0, m_ends[i].y0), i));
+            ends.insert(std::make_pair(point_t(m_ends[i].x1, m_ends[i].y1), i));
+        }
+
+        for(size_t start = 0; start < slices.size(); start++) {
+            if(used[start]) {
+                continue;
+            }
+
+            Ring ring;
+            RingPart first = {start, false};
+            ring.parts.push_back(first);
+            used[start] = true;
+
+            point_t begin(m_ends[start].x0, m_ends[start].y0);
+            point_t end(m_ends[start].x1, m_ends[start].y1);
+
+            // append members until the ring is closed or no member fits
+            while(end != begin) {
+                bool found = false;
+                std::pair<endmap::iterator, endmap::iterator> range = ends.equal_range(end);
+                for(endmap::iterator it = range.first; it != range.second; ++it) {
+                    size_t m = it->second;
+                    if(used[m]) {
+                        continue;
+                    }
+
+                    RingPart part = {m, !(m_ends[m].x0 == end.first && m_ends[m].y0 == end.second)};
+                    ring.parts.push_back(part);
+                    used[m] = true;
+                    end = part.reversed ? point_t(m_ends[m].x0, m_ends[m].y0) : point_t(m_ends[m].x1, m_ends[m].y1);
+                    found = true;
+                    break;
+                }
+
+                if(!found) {
+                    break;
+                }
+            }
+
+            // open rings are dropped
+            if(end != begin) {
+                continue;
+            }
+
+            m_rings.push_back(ring);
+        }
+    }
+
+    /**
+     * collect the coordinates of the rings and nest each ring into the
+     * smallest ring containing its first point
+     */
+    void nest(const std::vector<const MemberWays::Slice*>& slices) {
+        m_rx.resize(m_rings.size());
+        m_ry.resize(m_rings.size());
+
+        for(size_t i = 0; i < m_rings.size(); i++) {
+            Ring& ring = m_rings[i];
+            collect(ring, slices, m_rx[i], m_ry[i]);
+
+            ring.valid = m_rx[i].size() >= 4;
+            ring.parent = -1;
+            ring.depth = 0;
+            if(ring.valid) {
+                ring.minx = *std::min_element(m_rx[i].begin(), m_rx[i].end());
+                ring.maxx = *std::max_element(m_rx[i].begin(), m_rx[i].end());
+                ring.miny = *std::min_element(m_ry[i].begin(), m_ry[i].end());
+                ring.maxy = *std::max_element(m_ry[i].begin(), m_ry[i].end());
+            }
+        }
+
+        for(size_t i = 0; i < m_rings.size(); i++) {
+            if(!m_rings[i].valid) {
+                continue;
+            }
+
+            int32_t px = m_rx[i][0], py = m_ry[i][0];
+            double best = 0;
+            for(size_t j = 0; j < m_rings.size(); j++) {
+                const Ring& other = m_rings[j];
+                if(i == j || !other.valid || px < other.minx || px > other.maxx || py < other.miny || py > other.maxy) {
+                    continue;
+                }
+
+                double size = (double)(other.maxx - other.minx) * (other.maxy - other.miny);
+                if((m_rings[i].parent == -1 || size < best) && inside(px, py, m_rx[j], m_ry[j])) {
+                    m_rings[i].parent = j;
+                    best = size;
+                }
+            }
+        }
+
+        for(size_t i = 0; i < m_rings.size(); i++) {
+            for(int p = m_rings[i].parent; p != -1 && m_rings[i].depth < (int)m_rings.size(); p = m_rings[p].parent) {
+                m_rings[i].depth++;
+            }
+        }
+    }
+
+    /**
+     * create the ring i from the coordinates collected by nest()
+     */
+    geos::geom::LinearRing* createRing(size_t i) {
+        geos::geom::GeometryFactory *f = Osmium::Geometry::geos_geometry_factory();
+
+        const std::vector<int32_t>& x = m_rx[i];
+        const std::vector<int32_t>& y = m_ry[i];
+
+        std::vector<geos::geom::Coordinate> *c = new std::vector<geos::geom::Coordinate>();
+        c->reserve(x.size());
+        for(size_t i = 0; i < x.size(); i++) {
+            c->push_back(geos::geom::Coordinate(m_memberWays->fromFix(x[i]), m_memberWays->fromFix(y[i]), DoubleNotANumber));
+        }
+
+        return f->createLinearRing(f->getCoordinateSequenceFactory()->create(c));
+    }
+
+public:
+    MultipolygonBuilder(const MemberWays *memberWays) : m_memberWays(memberWays), m_rings(), m_ends(), m_hasTopology(false), m_rx(), m_ry(), m_builds(0), m_assembled(0) {}
+
+    /**
+     * forget the cached topology, needs to be called when the member list
+     * changes
+     */
+    void reset() {
+        m_hasTopology = false;
+        m_rings.clear();
+        m_ends.clear();
+        m_rx.clear();
+        m_ry.clear();
+    }
+
+    /**
+     * build the polygons of the multipolygon from the slices of its member
+     * ways valid at one point in time (NULL for members that don't exist
+     * then). The polygons are added to parts and owned by the caller.
+     */
+    void build(const std::vector<const MemberWays::Slice*>& slices, std::vector<geos::geom::Geometry*>& parts) {
+        m_builds++;
+        parts.clear();
+
+        std::vector<Ends> ends(slices.size());
+        for(size_t i = 0; i < slices.size(); i++) {
+            ends[i] = endsOf(slices[i]);
+        }
+
+        // the rings need to be chained again when members appeared,
+        // disappeared or their ends moved
+        if(!m_hasTopology || ends != m_ends) {
+            m_ends = ends;
+            assemble(slices);
+            m_hasTopology = true;
+        }
+
+        // any moved node can change which ring contains which
+        nest(slices);
+
+        geos::geom::GeometryFactory *f = Osmium::Geometry::geos_geometry_factory();
+        for(size_t i = 0; i < m_rings.size(); i++) {
+            if(!m_rings[i].valid || m_rings[i].depth % 2 != 0) {
+                continue;
+            }
+
+            try {
+                geos::geom::LinearRing* shell = createRing(i);
+
+                std::vector<geos::geom::Geometry*> *holes = new std::vector<geos::geom::Geometry*>();
+                for(size_t j = 0; j < m_rings.size(); j++) {
+                    if(m_rings[j].valid && m_rings[j].parent == (int)i && m_rings[j].depth % 2 != 0) {
+                        holes->push_back(createRing(j));
+                    }
+                }
+
+                geos::geom::Geometry* polygon = f->createPolygon(shell, holes);
+                polygon->setSRID(900913);
+                parts.push_back(polygon);
+            } catch(geos::util::GEOSException e) {
+                std::cerr << "error creating multipolygon ring: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    void printStatistics() {
+        std::cerr << "multipolygons: built " << m_builds << " geometries, chained the members into rings for " << m_assembled << " of them" << std::endl;
+    }
+};
+
+#endif // IMPORTER_MULTIPOLYGONBUILDER_HPP
@@ -9,15 +9,36 @@
  * it's the main memory consumer and during the import the memory
  * consumption is quite high.
  *
- * Therefor Nodestore is an abstract class, with its main methods being
- * pure virtual.
+ * Therefor Nodestore is a baseclass holding the types and settings
+ * common to all nodestores. Its main methods are not virtual: the classes
+ * using a nodestore are templated on its type, so that the calls in their
+ * innermost loops can be inlined. Each nodestore implements
+ *
+ *   void record(osm_object_id_t id, osm_user_id_t uid, time_t t, double lon, double lat)
+ *   timemap_ptr lookup(osm_object_id_t id, bool &found)
+ *   Nodeinfo lookup(osm_object_id_t id, time_t t, bool &found)
+ *
+ * Each nodestore is templated on a debug policy (see debugpolicy.hpp),
+ * which decides at compile time if the debug settings are checked.
+ *
+ * The coordinates passed to record() are usually lon/lat in WGS84. When
+ * the nodestore is switched to store mercator coordinates, they are
+ * already projected to spherical mercator (in meters) and lookup()
+ * returns them projected, too. Nodestores storing fixed-point integers
+ * use toFix() and fromFix(), which pick the resolution matching the
+ * kind of coordinates stored.
  */
 
 #ifndef IMPORTER_NODESTORE_HPP
 #define IMPORTER_NODESTORE_HPP
 
+#include <cmath>
+#include <limits>
+
+#include "nodestore/snapshot.hpp"
+
 /**
- * Abstract baseclass for all nodestores
+ * Baseclass for all nodestores
  */
 class Nodestore {
 public:
@@ -61,6 +82,67 @@ protected:
      */
     const Nodeinfo nullinfo;
 
+    /**
+     * convert a coordinate to the fixed-point integer stored for it
+     */
+    int32_t toFix(double c) const {
+        return toFix(c, m_mercator);
+    }
+
+    /**
+     * convert a fixed-point integer back to the coordinate
+     */
+    double fromFix(int32_t fix) const {
+        return fromFix(fix, m_mercator);
+    }
+
+    /**
+     * the snapshot flags describing the coordinates stored in this nodestore
+     */
+    uint32_t snapshotFlags() const {
+        return m_mercator ? NodestoreSnapshot::FLAG_MERCATOR : 0;
+    }
+
+    /**
+     * check that a snapshot contains the kind of coordinates stored in this
+     * nodestore and was written from the same input with the same filters
+     */
+    void checkSnapshot(const NodestoreSnapshot::Header *header) const {
+        uint32_t flags = header->flags;
+        if(flags != snapshotFlags()) {
+            std::cerr << "the nodestore snapshot was written " << ((flags & NodestoreSnapshot::FLAG_MERCATOR) ? "with" : "without") << " --project-nodes, it needs to be read the same way" << std::endl;
+            throw std::runtime_error("nodestore snapshot stores different coordinates");
+        }
+
+        const NodestoreSnapshot::Fingerprint& f = header->fingerprint;
+        if(f.inputSize != m_fingerprint.inputSize || f.inputMtime != m_fingerprint.inputMtime) {
+            std::cerr << "the nodestore snapshot was written from another input file (or the file has changed since)" << std::endl;
+            throw std::runtime_error("nodestore snapshot does not match the input file");
+        }
+
+        if(f.onlyReferenced != m_fingerprint.onlyReferenced) {
+            std::cerr << "the nodestore snapshot was written " << (f.onlyReferenced ? "with" : "without") << " --only-referenced, it needs to be read the same way" << std::endl;
+            throw std::runtime_error("nodestore snapshot was written with other filters");
+        }
+
+        if(f.since != m_fingerprint.since || f.until != m_fingerprint.until) {
+            std::cerr << "the nodestore snapshot was written with another --since or --until" << std::endl;
+            throw std::runtime_error("nodestore snapshot was written with other filters");
+        }
+
+        if(f.region != m_fingerprint.region) {
+            std::cerr << "the nodestore snapshot was written with another --bbox or --polygon" << std::endl;
+            throw std::runtime_error("nodestore snapshot was written with other filters");
+        }
+    }
+
+    /**
+     * the input and filters written to and expected in snapshots
+     */
+    const NodestoreSnapshot::Fingerprint& snapshotFingerprint() const {
+        return m_fingerprint;
+    }
+
 private:
     /**
      * should messages because of store-misses be printed?
@@ -70,14 +152,56 @@ private:
      */
     bool m_debug, m_storeerrors;
 
+    /**
+     * are the recorded coordinates projected to mercator?
+     */
+    bool m_mercator;
+
+    NodestoreSnapshot::Fingerprint m_fingerprint;
+
 public:
     /**
      * initialize a new nodestore
      */
-    Nodestore() : nullinfo(), m_storeerrors(false) {}
+    Nodestore() : nullinfo(), m_storeerrors(false), m_mercator(false), m_fingerprint() {}
 
     virtual ~Nodestore() {}
 
+    /**
+     * number of fixed-point units per meter when storing mercator
+     * coordinates, a resolution of one centimeter. the mercator world
+     * spans +/-20037508.34 meters, which fits into an int32
+     */
+    static const int MERCATOR_PRECISION = 100;
+
+    /**
+     * convert a lon/lat or, if mercator is true, a mercator coordinate to
+     * a fixed-point integer
+     */
+    static int32_t toFix(double c, bool mercator) {
+        if(!mercator)
+            return Osmium::OSM::double_to_fix(c);
+
+        // latitudes above ~85.5 degree exceed the int32 range, they are far
+        // outside of the rendered mercator world and are clamped
+        double fix = round(c * MERCATOR_PRECISION);
+        if(fix > std::numeric_limits<int32_t>::max())
+            return std::numeric_limits<int32_t>::max();
+        if(fix < -std::numeric_limits<int32_t>::max())
+            return -std::numeric_limits<int32_t>::max();
+        return (int32_t)fix;
+    }
+
+    /**
+     * convert a fixed-point integer created by toFix back to the coordinate
+     */
+    static double fromFix(int32_t fix, bool mercator) {
+        if(!mercator)
+            return Osmium::OSM::fix_to_double(fix);
+
+        return (double)fix / MERCATOR_PRECISION;
+    }
+
     /**
      * is this nodestore printing debug messages
      */
@@ -107,23 +231,47 @@ public:
     }
 
     /**
-     * record information about a node
+     * is this nodestore storing mercator coordinates
+     */
+    bool isStoringMercator() {
+        return m_mercator;
+    }
+
+    /**
+     * should this nodestore store mercator coordinates instead of lon/lat?
+     * needs to be set before the first node is recorded
+     */
+    void storeMercator(bool shouldStoreMercator) {
+        m_mercator = shouldStoreMercator;
+    }
+
+    /**
+     * set the input file and filters of this run, which are written to
+     * snapshots and need to match when a snapshot is read
+     */
+    void snapshotFingerprint(const NodestoreSnapshot::Fingerprint& fingerprint) {
+        m_fingerprint = fingerprint;
+    }
+
+    /**
+     * write all information stored in the nodestore to a snapshot file
+     */
+    virtual void writeSnapshot(const std::string& filename) = 0;
+
+    /**
+     * fill the nodestore from a snapshot file written by writeSnapshot
      */
-    virtual void record(osm_object_id_t id, osm_user_id_t uid, time_t t, double lon, double lat) = 0;
+    virtual void readSnapshot(const std::string& filename) = 0;
 
     /**
-     * retrieve all information about a node, indexed by time
+     * print information about the memory used by the nodestore
      */
-    virtual timemap_ptr lookup(osm_object_id_t id, bool &found) = 0;
+    virtual void printStatistics() {}
 
     /**
-     * lookup the version of a node that was valid at time_t t
-     *
-     * found is set to true if the node was found, and to false otherwise
-     * if found != true, the returned value is identical to nullinfo and
-     * should not be used.
+     * print information about the lookups done in the nodestore
      */
-    virtual Nodeinfo lookup(osm_object_id_t id, time_t t, bool &found) = 0;
+    virtual void printLookupStatistics() {}
 };
 
 #endif // IMPORTER_NODESTORE_HPP
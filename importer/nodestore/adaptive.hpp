@@ -0,0 +1,626 @@
+/**
+ * The adaptive nodestore is meant for imports where it is not known in
+ * advance if the node history fits into memory. It keeps the nodes in
+ * memory as long as they fit into a memory limit and moves the coldest
+ * parts of them to a file-backed tier when the limit is reached.
+ *
+ * The nodes are stored in segments of SEGMENT_NODES consecutive nodes.
+ * As the input is sorted, a segment covers a continuous range of node-ids
+ * and only the last segment is ever written to. Each segment consists of
+ * three arrays: the ids of its nodes, the index of the first version of
+ * each node and the versions themselves (as NodestoreSnapshot::Record):
+ *
+ *   ids:      n1   n2   n5 ...
+ *   firsts:   0    3    4  ...
+ *   versions: n1v1 n1v2 n1v3 n2v1 n5v1 n5v2 ...
+ *
+ * When the memory used by the segments exceeds the memory limit, the
+ * sealed segment that has been used least recently is written to a
+ * temporary file and mapped back into memory read-only. From then on the
+ * kernel pages its nodes in and out as needed, so lookups into it stay
+ * transparent but may cost a disk read.
+ *
+ * The nodestore counts the lookups going to either tier and samples their
+ * cost, so the statistics printed after the ways show how much slower the
+ * lookups got because of the spilled segments.
+ */
+
+#ifndef IMPORTER_NODESTOREADAPTIVE_HPP
+#define IMPORTER_NODESTOREADAPTIVE_HPP
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "snapshot.hpp"
+
+/**
+ * An anonymous temporary file that data is appended to and mapped back
+ * into memory read-only.
+ */
+class NodestoreSpillFile {
+private:
+    int m_fd;
+    off_t m_size;
+
+    /**
+     * all mappings handed out, unmapped when the file is closed
+     */
+    std::vector< std::pair<void*, size_t> > m_mappings;
+
+    // not copyable
+    NodestoreSpillFile(const NodestoreSpillFile&);
+    NodestoreSpillFile& operator=(const NodestoreSpillFile&);
+
+public:
+    NodestoreSpillFile() : m_fd(-1), m_size(0), m_mappings() {}
+
+    ~NodestoreSpillFile() {
+        close();
+    }
+
+    bool isOpen() {
+        return m_fd != -1;
+    }
+
+    /**
+     * create the file in the directory dir
+     */
+    void open(const std::string& dir) {
+        std::string pattern = dir + "/osm-history-nodestore-XXXXXX";
+        std::vector<char> name(pattern.begin(), pattern.end());
+        name.push_back('\0');
+
+        m_fd = mkstemp(&name[0]);
+        if(m_fd == -1) {
+            std::cerr << "can't create nodestore spill file in " << dir << std::endl;
+            throw std::runtime_error("creating nodestore spill file failed");
+        }
+
+        unlink(&name[0]);
+    }
+
+    /**
+     * append size bytes to the file and return a read-only mapping of them
+     */
+    const void *append(const void *data, size_t size) {
+        if(size == 0)
+            return NULL;
+
+        // mappings need to start at a page boundary
+        off_t pagesize = sysconf(_SC_PAGESIZE);
+        off_t offset = (m_size + pagesize - 1) / pagesize * pagesize;
+
+        const char *pos = static_cast<const char*>(data);
+        for(size_t written = 0; written < size; ) {
+            ssize_t r = pwrite(m_fd, pos + written, size - written, offset + written);
+            if(r <= 0)
+                throw std::runtime_error("writing nodestore spill file failed");
+            written += r;
+        }
+        m_size = offset + size;
+
+        void *mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, m_fd, offset);
+        if(mapping == MAP_FAILED)
+            throw std::runtime_error("can't map nodestore spill file into memory");
+
+        // lookups jump around wildly, reading ahead would only waste i/o
+        madvise(mapping, size, MADV_RANDOM);
+
+        m_mappings.push_back(std::make_pair(mapping, size));
+        return mapping;
+    }
+
+    /**
+     * number of bytes written to the file
+     */
+    size_t size() {
+        return m_size;
+    }
+
+    void close() {
+        for(size_t i = 0; i < m_mappings.size(); i++) {
+            munmap(m_mappings[i].first, m_mappings[i].second);
+        }
+        m_mappings.clear();
+
+        if(m_fd != -1) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        m_size = 0;
+    }
+};
+
+template <class TDebug>
+class NodestoreAdaptive : public Nodestore {
+private:
+    /**
+     * should debug messages be printed? always false with DebugDisabled
+     */
+    bool debug() {
+        return TDebug::enabled && isPrintingDebugMessages();
+    }
+
+    /**
+     * should store errors be printed? always false with DebugDisabled
+     */
+    bool storeErrors() {
+        return TDebug::enabled && isPrintingStoreErrors();
+    }
+
+    typedef NodestoreSnapshot::Record Record;
+
+    /**
+     * number of nodes in one segment
+     */
+    const static size_t SEGMENT_NODES = 1 << 18;
+
+    /**
+     * only every n-th lookup is timed, reading the clock for each of them
+     * would cost more than most lookups
+     */
+    const static uint64_t LOOKUP_SAMPLE_RATE = 1024;
+
+    /**
+     * the in-memory or spilled tier
+     */
+    enum Tier {
+        TIER_MEMORY = 0,
+        TIER_DISK = 1
+    };
+
+    /**
+     * a continuous range of nodes
+     */
+    struct Segment {
+        std::vector<int64_t> ids;
+        std::vector<uint32_t> firsts;
+        std::vector<Record> versions;
+
+        /**
+         * the arrays mapped from the spill file, once the segment was spilled
+         */
+        const int64_t *spilledIds;
+        const uint32_t *spilledFirsts;
+        const Record *spilledVersions;
+        size_t nodeCount, versionCount;
+        bool spilled;
+
+        /**
+         * value of the lookup clock when the segment was used last
+         */
+        uint64_t lastUse;
+
+        Segment() : ids(), firsts(), versions(), spilledIds(NULL), spilledFirsts(NULL), spilledVersions(NULL), nodeCount(0), versionCount(0), spilled(false), lastUse(0) {}
+
+        const int64_t *idData() const {
+            return spilled ? spilledIds : &ids[0];
+        }
+
+        const uint32_t *firstData() const {
+            return spilled ? spilledFirsts : &firsts[0];
+        }
+
+        const Record *versionData() const {
+            return spilled ? spilledVersions : &versions[0];
+        }
+
+        size_t nodes() const {
+            return spilled ? nodeCount : ids.size();
+        }
+
+        size_t numVersions() const {
+            return spilled ? versionCount : versions.size();
+        }
+
+        /**
+         * number of bytes of memory held by the segment
+         */
+        size_t memory() const {
+            return ids.capacity() * sizeof(int64_t) + firsts.capacity() * sizeof(uint32_t) + versions.capacity() * sizeof(Record);
+        }
+    };
+
+    /**
+     * all segments in ascending id order and the first id of each of them
+     */
+    std::vector<Segment*> m_segments;
+    std::vector<int64_t> m_firstIds;
+
+    std::string m_tmpdir;
+    size_t m_memoryLimit;
+
+    /**
+     * memory held by the sealed segments still in memory, the last segment
+     * is accounted separately as it is still growing
+     */
+    size_t m_sealedMemory;
+
+    NodestoreSpillFile m_spill;
+    size_t m_spilledSegments;
+
+    osm_object_id_t m_lastNodeId;
+    bool m_hasNode;
+
+    /**
+     * counts the lookups, used to find the least recently used segment
+     */
+    uint64_t m_clock;
+
+    /**
+     * number of lookups, number of timed lookups and their summed up
+     * duration in nanoseconds, per tier
+     */
+    uint64_t m_lookups[2], m_sampled[2], m_sampledNanos[2];
+
+    static uint64_t nanos() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    Segment *lastSegment() {
+        return m_segments.back();
+    }
+
+    /**
+     * seal the last segment and start a new one
+     */
+    void startSegment(osm_object_id_t firstId) {
+        if(!m_segments.empty()) {
+            Segment *last = lastSegment();
+
+            // release the memory reserved for further nodes
+            std::vector<int64_t>(last->ids).swap(last->ids);
+            std::vector<uint32_t>(last->firsts).swap(last->firsts);
+            std::vector<Record>(last->versions).swap(last->versions);
+
+            m_sealedMemory += last->memory();
+        }
+
+        Segment *segment = new Segment();
+        segment->ids.reserve(SEGMENT_NODES);
+        segment->firsts.reserve(SEGMENT_NODES);
+        m_segments.push_back(segment);
+        m_firstIds.push_back(firstId);
+    }
+
+    /**
+     * move the least recently used sealed segment to the spill file,
+     * returns false if there is none left in memory
+     */
+    bool spillColdestSegment() {
+        Segment *coldest = NULL;
+        for(size_t i = 0; i + 1 < m_segments.size(); i++) {
+            Segment *segment = m_segments[i];
+            if(!segment->spilled && (!coldest || segment->lastUse < coldest->lastUse)) {
+                coldest = segment;
+            }
+        }
+
+        if(!coldest)
+            return false;
+
+        if(!m_spill.isOpen()) {
+            m_spill.open(m_tmpdir);
+        }
+
+        size_t memory = coldest->memory();
+        std::cerr << "nodestore: memory limit of " << (m_memoryLimit >> 20) << " MB reached, spilling nodes #" <<
+            coldest->ids.front() << " to #" << coldest->ids.back() << " (" << (memory >> 20) << " MB) to disk" << std::endl;
+
+        coldest->nodeCount = coldest->ids.size();
+        coldest->versionCount = coldest->versions.size();
+        coldest->spilledIds = static_cast<const int64_t*>(m_spill.append(&coldest->ids[0], coldest->nodeCount * sizeof(int64_t)));
+        coldest->spilledFirsts = static_cast<const uint32_t*>(m_spill.append(&coldest->firsts[0], coldest->nodeCount * sizeof(uint32_t)));
+        coldest->spilledVersions = static_cast<const Record*>(m_spill.append(&coldest->versions[0], coldest->versionCount * sizeof(Record)));
+        coldest->spilled = true;
+
+        std::vector<int64_t>().swap(coldest->ids);
+        std::vector<uint32_t>().swap(coldest->firsts);
+        std::vector<Record>().swap(coldest->versions);
+
+        m_sealedMemory -= memory;
+        m_spilledSegments++;
+        return true;
+    }
+
+    /**
+     * spill segments until the memory used is well below the limit again
+     */
+    void enforceMemoryLimit() {
+        if(memory() <= m_memoryLimit)
+            return;
+
+        while(memory() > m_memoryLimit / 4 * 3) {
+            if(!spillColdestSegment())
+                break;
+        }
+    }
+
+    /**
+     * find the segment and the index of a node inside of it, returns NULL
+     * if the node is not stored
+     */
+    Segment *find(osm_object_id_t id, size_t &index) {
+        std::vector<int64_t>::const_iterator sit = std::upper_bound(m_firstIds.begin(), m_firstIds.end(), (int64_t)id);
+        if(sit == m_firstIds.begin())
+            return NULL;
+
+        Segment *segment = m_segments[sit - m_firstIds.begin() - 1];
+        const int64_t *ids = segment->idData(), *end = ids + segment->nodes();
+        const int64_t *it = std::lower_bound(ids, end, (int64_t)id);
+        if(it == end || *it != id)
+            return NULL;
+
+        segment->lastUse = ++m_clock;
+        index = it - ids;
+        return segment;
+    }
+
+    /**
+     * first and last version of the node at index in segment
+     */
+    void nodeVersions(const Segment *segment, size_t index, const Record *&begin, const Record *&end) {
+        const uint32_t *firsts = segment->firstData();
+        const Record *data = segment->versionData();
+
+        begin = data + firsts[index];
+        end = data + (index + 1 < segment->nodes() ? firsts[index + 1] : segment->numVersions());
+    }
+
+    /**
+     * should the current lookup be timed
+     */
+    bool sampleLookup() {
+        return (m_lookups[TIER_MEMORY] + m_lookups[TIER_DISK]) % LOOKUP_SAMPLE_RATE == 0;
+    }
+
+    void countLookup(const Segment *segment, bool sampled, uint64_t start) {
+        Tier tier = segment->spilled ? TIER_DISK : TIER_MEMORY;
+        m_lookups[tier]++;
+
+        if(sampled) {
+            m_sampled[tier]++;
+            m_sampledNanos[tier] += nanos() - start;
+        }
+    }
+
+    void printTier(const char *name, Tier tier) {
+        std::cerr << "nodestore: " << m_lookups[tier] << " lookups in " << name;
+        if(m_sampled[tier] > 0) {
+            std::cerr << ", " << (m_sampledNanos[tier] / m_sampled[tier]) << " ns per lookup";
+        }
+        std::cerr << std::endl;
+    }
+
+public:
+    NodestoreAdaptive() :
+            Nodestore(),
+            m_segments(),
+            m_firstIds(),
+            m_tmpdir("/tmp"),
+            m_memoryLimit((size_t)1024 << 20),
+            m_sealedMemory(0),
+            m_spill(),
+            m_spilledSegments(0),
+            m_lastNodeId(0),
+            m_hasNode(false),
+            m_clock(0) {
+
+        for(int i = 0; i < 2; i++) {
+            m_lookups[i] = m_sampled[i] = m_sampledNanos[i] = 0;
+        }
+    }
+
+    ~NodestoreAdaptive() {
+        for(size_t i = 0; i < m_segments.size(); i++) {
+            delete m_segments[i];
+        }
+    }
+
+    /**
+     * the memory limit in bytes
+     */
+    size_t memoryLimit() {
+        return m_memoryLimit;
+    }
+
+    /**
+     * set the memory limit in bytes, above which segments are spilled
+     */
+    void memoryLimit(size_t newMemoryLimit) {
+        m_memoryLimit = newMemoryLimit;
+    }
+
+    std::string tmpdir() {
+        return m_tmpdir;
+    }
+
+    /**
+     * set the directory the spill file is created in
+     */
+    void tmpdir(const std::string& newTmpdir) {
+        m_tmpdir = newTmpdir;
+    }
+
+    /**
+     * number of bytes of memory used by the segments in memory
+     */
+    size_t memory() {
+        return m_sealedMemory + (m_segments.empty() ? 0 : lastSegment()->memory());
+    }
+
+    void record(osm_object_id_t id, osm_user_id_t uid, time_t t, double lon, double lat) {
+        // remember: sorting is guaranteed nodes, ways relations in ascending id and then version order
+        if(!m_hasNode || m_lastNodeId != id) {
+            if(m_segments.empty() || lastSegment()->ids.size() >= SEGMENT_NODES) {
+                if(debug()) {
+                    std::cerr << "  -> starting new segment at node #" << id << std::endl;
+                }
+
+                startSegment(id);
+                enforceMemoryLimit();
+            }
+
+            Segment *segment = lastSegment();
+            segment->ids.push_back(id);
+            segment->firsts.push_back(segment->versions.size());
+
+            m_lastNodeId = id;
+            m_hasNode = true;
+        }
+
+        Record record = {(uint32_t)t, uid, toFix(lat), toFix(lon)};
+        lastSegment()->versions.push_back(record);
+
+        if(debug()) {
+            std::cerr << "adding version for node #" << id << " at tstamp " << t << " to segment " << (m_segments.size() - 1) << std::endl;
+        }
+    }
+
+    timemap_ptr lookup(osm_object_id_t id, bool &found) {
+        if(debug()) {
+            std::cerr << "looking up timemap of node #" << id << std::endl;
+        }
+
+        bool sampled = sampleLookup();
+        uint64_t start = sampled ? nanos() : 0;
+
+        size_t index;
+        Segment *segment = find(id, index);
+        if(!segment) {
+            if(storeErrors()) {
+                std::cerr << "no timemap for node #" << id << ", skipping node" << std::endl;
+            }
+            found = false;
+            return timemap_ptr();
+        }
+
+        const Record *begin, *end;
+        nodeVersions(segment, index, begin, end);
+
+        timemap_ptr tMap(new timemap());
+        for(const Record *it = begin; it != end; it++) {
+            Nodeinfo info = {fromFix(it->lat), fromFix(it->lon), it->uid};
+            tMap->insert(timepair(it->t, info));
+        }
+
+        countLookup(segment, sampled, start);
+
+        found = true;
+        return tMap;
+    }
+
+    Nodeinfo lookup(osm_object_id_t id, time_t t, bool &found) {
+        if(debug()) {
+            std::cerr << "looking up information of node #" << id << " at tstamp " << t << std::endl;
+        }
+
+        bool sampled = sampleLookup();
+        uint64_t start = sampled ? nanos() : 0;
+
+        size_t index;
+        Segment *segment = find(id, index);
+        if(!segment) {
+            if(storeErrors()) {
+                std::cerr << "no timemap for node #" << id << ", skipping node" << std::endl;
+            }
+            found = false;
+            return nullinfo;
+        }
+
+        const Record *begin, *end;
+        nodeVersions(segment, index, begin, end);
+
+        // the versions are recorded in the order of the input, which is not
+        // necessarily sorted by time, so look at all of them and find the
+        // youngest one not younger then t, or the oldest one if all are younger
+        const Record *match = NULL, *oldest = begin;
+        for(const Record *it = begin; it != end; it++) {
+            if(it->t <= t && (!match || it->t > match->t)) {
+                match = it;
+            }
+            if(it->t < oldest->t) {
+                oldest = it;
+            }
+        }
+
+        if(!match) {
+            if(storeErrors()) {
+                std::cerr << "reference to node #" << id << " at tstamp " << t << " which is before the youngest available version of that node, using first version" << std::endl;
+            }
+            match = oldest;
+        }
+
+        Nodeinfo info = {fromFix(match->lat), fromFix(match->lon), match->uid};
+        countLookup(segment, sampled, start);
+
+        found = true;
+        return info;
+    }
+
+    void printStatistics() {
+        size_t nodes = 0;
+        for(size_t i = 0; i < m_segments.size(); i++) {
+            nodes += m_segments[i]->nodes();
+        }
+
+        std::cerr << "nodestore: " << nodes << " nodes in " << m_segments.size() << " segments, " <<
+            (memory() >> 20) << " MB in memory, " <<
+            m_spilledSegments << " segments (" << (m_spill.size() >> 20) << " MB) spilled to disk" << std::endl;
+    }
+
+    void printLookupStatistics() {
+        printTier("memory", TIER_MEMORY);
+        if(m_spilledSegments > 0) {
+            printTier("spilled segments", TIER_DISK);
+
+            if(m_sampled[TIER_MEMORY] > 0 && m_sampled[TIER_DISK] > 0) {
+                double memoryCost = (double)m_sampledNanos[TIER_MEMORY] / m_sampled[TIER_MEMORY];
+                double diskCost = (double)m_sampledNanos[TIER_DISK] / m_sampled[TIER_DISK];
+                std::cerr << "nodestore: lookups in spilled segments took " << std::setprecision(3) << (diskCost / memoryCost) << " times as long" << std::endl;
+            }
+        }
+    }
+
+    void writeSnapshot(const std::string& filename) {
+        NodestoreSnapshotWriter writer;
+        writer.open(filename, snapshotFlags(), snapshotFingerprint());
+
+        for(size_t s = 0; s < m_segments.size(); s++) {
+            const Segment *segment = m_segments[s];
+            for(size_t i = 0; i < segment->nodes(); i++) {
+                writer.addNode(segment->idData()[i]);
+
+                const Record *begin, *end;
+                nodeVersions(segment, i, begin, end);
+                for(const Record *it = begin; it != end; it++) {
+                    writer.addVersion(it->t, it->uid, it->lat, it->lon);
+                }
+            }
+        }
+
+        writer.close();
+    }
+
+    void readSnapshot(const std::string& filename) {
+        NodestoreSnapshotReader reader;
+        reader.open(filename);
+        checkSnapshot(reader.header());
+
+        osm_object_id_t id;
+        const NodestoreSnapshot::Record *records;
+        while(reader.nextNode(id, records)) {
+            for(const NodestoreSnapshot::Record *it = records; it->t != 0; it++) {
+                record(id, it->uid, it->t, fromFix(it->lon), fromFix(it->lat));
+            }
+        }
+    }
+};
+
+#endif // IMPORTER_NODESTOREADAPTIVE_HPP
@@ -0,0 +1,157 @@
+/**
+ * The sparse nodestore needs one large, continuous memory area to store
+ * the node versions in. Instead of allocating fixed-size blocks up front,
+ * the arena reserves a large range of virtual address space without
+ * backing it with memory. When more space is needed, the next pages of
+ * that range are committed in place, so the memory never moves and
+ * pointers into it stay valid while it grows.
+ *
+ * The committed pages are marked as candidates for transparent huge pages,
+ * which cuts down the TLB misses caused by the random lookups during the
+ * way phase.
+ */
+
+#ifndef IMPORTER_NODESTOREARENA_HPP
+#define IMPORTER_NODESTOREARENA_HPP
+
+#include <stdexcept>
+
+#include <sys/mman.h>
+
+/**
+ * A growing memory area on top of reserved virtual address space
+ */
+class NodestoreArena {
+private:
+    /**
+     * size of the address space reserved on 64 bit platforms, the kernel
+     * only backs pages that are committed and touched
+     */
+    const static size_t RESERVE_SIZE_64 = (size_t)1 << 40;
+
+    /**
+     * size of the address space reserved on 32 bit platforms
+     */
+    const static size_t RESERVE_SIZE_32 = (size_t)1 << 30;
+
+    /**
+     * the arena never reserves less than this
+     */
+    const static size_t MIN_RESERVE_SIZE = (size_t)64 << 20;
+
+    /**
+     * memory is committed in steps of this size, which is a multiple of
+     * the 2 MB huge page size
+     */
+    const static size_t COMMIT_STEP = (size_t)64 << 20;
+
+    /**
+     * first byte of the reserved address space
+     */
+    char *m_base;
+
+    /**
+     * number of bytes of reserved address space
+     */
+    size_t m_reserved;
+
+    /**
+     * number of bytes committed (readable & writable) from m_base on
+     */
+    size_t m_committed;
+
+    /**
+     * number of bytes handed out from m_base on
+     */
+    size_t m_used;
+
+    void reserve() {
+        size_t size = sizeof(void*) >= 8 ? RESERVE_SIZE_64 : RESERVE_SIZE_32;
+
+        // try smaller reservations if the address space is limited (ie. by ulimit -v)
+        for(; size >= MIN_RESERVE_SIZE; size /= 2) {
+            void *base = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if(base != MAP_FAILED) {
+                m_base = static_cast< char* >(base);
+                m_reserved = size;
+                return;
+            }
+        }
+
+        throw std::runtime_error("can't reserve address space for the nodestore");
+    }
+
+    void commit(size_t size) {
+        // round up to the next commit step
+        size_t target = ((size + COMMIT_STEP - 1) / COMMIT_STEP) * COMMIT_STEP;
+        if(target > m_reserved) {
+            target = m_reserved;
+        }
+
+        if(size > target) {
+            std::cerr << "nodestore needs " << size << " bytes but only " << m_reserved << " bytes of address space could be reserved" << std::endl;
+            throw std::runtime_error("nodestore address space exhausted");
+        }
+
+        if(0 != mprotect(m_base + m_committed, target - m_committed, PROT_READ | PROT_WRITE)) {
+            throw std::runtime_error("can't commit memory for the nodestore");
+        }
+
+#ifdef MADV_HUGEPAGE
+        madvise(m_base + m_committed, target - m_committed, MADV_HUGEPAGE);
+#endif
+
+        m_committed = target;
+    }
+
+public:
+    NodestoreArena() : m_base(NULL), m_reserved(0), m_committed(0), m_used(0) {
+        reserve();
+    }
+
+    ~NodestoreArena() {
+        munmap(m_base, m_reserved);
+    }
+
+    /**
+     * make sure that the next size bytes after the used ones are
+     * committed, without handing them out
+     */
+    void ensure(size_t size) {
+        if(m_used + size > m_committed) {
+            commit(m_used + size);
+        }
+    }
+
+    /**
+     * hand out the next size bytes
+     */
+    char* allocate(size_t size) {
+        ensure(size);
+
+        char *ptr = m_base + m_used;
+        m_used += size;
+        return ptr;
+    }
+
+    /**
+     * pointer to the first byte after the used bytes
+     */
+    char* top() {
+        return m_base + m_used;
+    }
+
+    size_t used() const {
+        return m_used;
+    }
+
+    size_t committed() const {
+        return m_committed;
+    }
+
+    size_t reserved() const {
+        return m_reserved;
+    }
+};
+
+#endif // IMPORTER_NODESTOREARENA_HPP
@@ -0,0 +1,340 @@
+/**
+ * Building the nodestore is the most time consuming part of the node
+ * phase. When the way phase of the same input is run again and again
+ * (for example while tuning the polygon rules or the scheme), the
+ * nodestore can be written to a snapshot file after the nodes have been
+ * read and mapped back in on the next run.
+ *
+ * The snapshot is a versioned binary file. It starts with a fixed-size
+ * header, followed by the node versions of all nodes, grouped by node
+ * and sorted by node-id and time:
+ *
+ *   +--------+------------------------------+--------------------+-----
+ *   | header | n1 | n1v1 n1v2 n1v4 | 0      | n2 | n2v1 | 0       | ...
+ *   +--------+------------------------------+--------------------+-----
+ *
+ * Each node starts with its 8-byte id, followed by one 16-byte Record per
+ * node version and a 4-byte 0 marker. This is the same layout the sparse
+ * nodestore uses in its memory blocks, so it can use the mapped file
+ * directly without copying the node versions around.
+ *
+ * Which nodes and versions are stored depends on the input file and on the
+ * options filtering them (--only-referenced, --since/--until, --bbox and
+ * --polygon). The header records a fingerprint of the input file and of
+ * these options, and a snapshot is refused when it is read by a run with a
+ * different input or different filters.
+ */
+
+#ifndef IMPORTER_NODESTORESNAPSHOT_HPP
+#define IMPORTER_NODESTORESNAPSHOT_HPP
+
+#include <fstream>
+#include <stdexcept>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * the on-disk structures of a nodestore snapshot
+ */
+class NodestoreSnapshot {
+public:
+    /**
+     * version of the file format, increased with each incompatible change
+     */
+    static const uint32_t FORMAT_VERSION = 2;
+
+    /**
+     * flag set when the coordinates are mercator in centimeters instead of
+     * lon/lat in osmium's fixed-point format
+     */
+    static const uint32_t FLAG_MERCATOR = 1;
+
+    /**
+     * the input file and the filters a snapshot was written with
+     */
+    struct Fingerprint {
+        /**
+         * size and modification time of the input file
+         */
+        uint64_t inputSize;
+        int64_t inputMtime;
+
+        /**
+         * the time window of --since and --until, 0 if open
+         */
+        int64_t since, until;
+
+        /**
+         * hash of the --bbox or of the contents of the --polygon file, 0
+         * if the import is not restricted to a region
+         */
+        uint64_t region;
+
+        /**
+         * 1 if only the nodes referenced by ways were stored
+         */
+        uint32_t onlyReferenced;
+
+        uint32_t reserved;
+    };
+
+    /**
+     * the header at the beginning of the file
+     */
+    struct Header {
+        /**
+         * magic bytes identifying the file: "OHRNODES"
+         */
+        char magic[8];
+
+        /**
+         * the FORMAT_VERSION the file was written with
+         */
+        uint32_t version;
+
+        /**
+         * flags describing the stored coordinates (FLAG_MERCATOR)
+         */
+        uint32_t flags;
+
+        /**
+         * number of nodes stored in the file
+         */
+        uint64_t nodes;
+
+        /**
+         * number of node versions stored in the file
+         */
+        uint64_t versions;
+
+        /**
+         * the input and filters the snapshot was written with
+         */
+        Fingerprint fingerprint;
+    };
+
+    /**
+     * one node version, identical to the PackedNodeTimeinfo of the
+     * sparse nodestore
+     */
+    struct Record {
+        uint32_t t;
+        osm_user_id_t uid;
+        int32_t lat;
+        int32_t lon;
+    };
+
+    /**
+     * size of the 0 marker terminating the versions of a node
+     */
+    static const size_t separatorSize = sizeof(((Record *)0)->t);
+
+    static const char *magic() {
+        static const char m[] = "OHRNODES";
+        return m;
+    }
+
+    /**
+     * a 64 bit FNV-1a hash of the data, used for the region of the
+     * fingerprint
+     */
+    static uint64_t hash(const std::string& data) {
+        uint64_t h = 14695981039346656037ULL;
+        for(size_t i = 0; i < data.size(); i++) {
+            h ^= (unsigned char)data[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+};
+
+/**
+ * Writes a nodestore snapshot. Nodes have to be added in ascending id
+ * order and their versions in ascending time order.
+ */
+class NodestoreSnapshotWriter {
+private:
+    std::ofstream m_file;
+    NodestoreSnapshot::Header m_header;
+    bool m_inNode;
+
+    void endNode() {
+        if(!m_inNode)
+            return;
+
+        uint32_t separator = 0;
+        m_file.write(reinterpret_cast<const char*>(&separator), NodestoreSnapshot::separatorSize);
+        m_inNode = false;
+    }
+
+public:
+    NodestoreSnapshotWriter() : m_file(), m_header(), m_inNode(false) {}
+
+    ~NodestoreSnapshotWriter() {
+        close();
+    }
+
+    /**
+     * create the snapshot file and write a preliminary header
+     */
+    void open(const std::string& filename, uint32_t flags, const NodestoreSnapshot::Fingerprint& fingerprint) {
+        m_file.open(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!m_file)
+            throw std::runtime_error("can't open nodestore snapshot for writing");
+
+        memset(&m_header, 0, sizeof(m_header));
+        memcpy(m_header.magic, NodestoreSnapshot::magic(), sizeof(m_header.magic));
+        m_header.version = NodestoreSnapshot::FORMAT_VERSION;
+        m_header.flags = flags;
+        m_header.fingerprint = fingerprint;
+
+        m_file.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+    }
+
+    /**
+     * start a new node, following versions are assigned to it
+     */
+    void addNode(osm_object_id_t id) {
+        endNode();
+
+        int64_t fileId = id;
+        m_file.write(reinterpret_cast<const char*>(&fileId), sizeof(fileId));
+        m_header.nodes++;
+        m_inNode = true;
+    }
+
+    /**
+     * add a version to the current node
+     */
+    void addVersion(uint32_t t, osm_user_id_t uid, int32_t lat, int32_t lon) {
+        NodestoreSnapshot::Record record = {t, uid, lat, lon};
+        m_file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        m_header.versions++;
+    }
+
+    /**
+     * terminate the last node, write the final header and close the file
+     */
+    void close() {
+        if(!m_file.is_open())
+            return;
+
+        endNode();
+
+        m_file.seekp(0);
+        m_file.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+        m_file.close();
+
+        if(m_file.fail())
+            throw std::runtime_error("writing nodestore snapshot failed");
+    }
+};
+
+/**
+ * Maps a nodestore snapshot into memory and iterates over the nodes stored
+ * in it. The mapping stays valid as long as the reader exists, so a
+ * nodestore may keep pointers into it.
+ */
+class NodestoreSnapshotReader {
+private:
+    char *m_base;
+    size_t m_size;
+    const char *m_pos;
+
+public:
+    NodestoreSnapshotReader() : m_base(NULL), m_size(0), m_pos(NULL) {}
+
+    ~NodestoreSnapshotReader() {
+        close();
+    }
+
+    /**
+     * map the snapshot file into memory and check its header
+     */
+    void open(const std::string& filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd == -1)
+            throw std::runtime_error("can't open nodestore snapshot for reading");
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(NodestoreSnapshot::Header)) {
+            ::close(fd);
+            throw std::runtime_error("nodestore snapshot is truncated");
+        }
+
+        m_size = st.st_size;
+        void *base = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if(base == MAP_FAILED)
+            throw std::runtime_error("can't map nodestore snapshot into memory");
+
+        m_base = static_cast<char*>(base);
+        madvise(m_base, m_size, MADV_WILLNEED);
+
+        const NodestoreSnapshot::Header *h = header();
+        if(0 != memcmp(h->magic, NodestoreSnapshot::magic(), sizeof(h->magic))) {
+            close();
+            throw std::runtime_error("file is not a nodestore snapshot");
+        }
+
+        if(h->version != NodestoreSnapshot::FORMAT_VERSION) {
+            std::cerr << "nodestore snapshot has format version " << h->version << ", this importer reads version " << NodestoreSnapshot::FORMAT_VERSION << std::endl;
+            close();
+            throw std::runtime_error("unsupported nodestore snapshot version");
+        }
+
+        m_pos = m_base + sizeof(NodestoreSnapshot::Header);
+    }
+
+    /**
+     * unmap the snapshot
+     */
+    void close() {
+        if(!m_base)
+            return;
+
+        munmap(m_base, m_size);
+        m_base = NULL;
+        m_pos = NULL;
+        m_size = 0;
+    }
+
+    const NodestoreSnapshot::Header *header() const {
+        return reinterpret_cast<const NodestoreSnapshot::Header*>(m_base);
+    }
+
+    /**
+     * fetch the next node from the snapshot. records points to the first
+     * version of the node, the versions are terminated by a 0 marker.
+     * returns false when all nodes have been read.
+     */
+    bool nextNode(osm_object_id_t &id, const NodestoreSnapshot::Record *&records) {
+        const char *end = m_base + m_size;
+        if(m_pos + sizeof(int64_t) > end)
+            return false;
+
+        int64_t fileId;
+        memcpy(&fileId, m_pos, sizeof(fileId));
+        id = fileId;
+
+        records = reinterpret_cast<const NodestoreSnapshot::Record*>(m_pos + sizeof(int64_t));
+
+        const NodestoreSnapshot::Record *it = records;
+        while(reinterpret_cast<const char*>(it) + NodestoreSnapshot::separatorSize <= end && it->t != 0) {
+            it++;
+        }
+
+        if(reinterpret_cast<const char*>(it) + NodestoreSnapshot::separatorSize > end)
+            throw std::runtime_error("nodestore snapshot is truncated");
+
+        m_pos = reinterpret_cast<const char*>(it) + NodestoreSnapshot::separatorSize;
+        return true;
+    }
+};
+
+#endif // IMPORTER_NODESTORESNAPSHOT_HPP
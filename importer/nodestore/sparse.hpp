@@ -1,13 +1,12 @@
 /**
  * The sparse nodestore is  is the newer one. It's build on top of the the Google Sparsetable
- * and a custom memory block management. It's much, much more space efficient but it seems to
+ * and a custom memory arena. It's much, much more space efficient but it seems to
  * take slightly time on startup and it also contains more custom code, so more potential for
  * bugs. Sooner or later Sparse will become the defaul node-store, as it's your only option
  * to import larger extracts or even a whole planet.
  *
- * It used two main memory areas: a sparsetable and one or more malloc'ed memory blocks.
- * Each memory block is BLOCK_SIZE bytes big. Each node-version is stored as a PackedNodeTimeinfo
- * struct (currently 16 bytes) in the memory block. The versions of two nodes are separated using
+ * It used two main memory areas: a sparsetable and a NodestoreArena. Each node-version is
+ * stored as a PackedNodeTimeinfo struct (currently 16 bytes) in the arena. The versions of two nodes are separated using
  * a 4-byte long marker containing only 0 bytes.
  *
  * The sparsetable mapps the node-ids to those memory positions. To fetch all Versions of a node,
@@ -26,16 +25,15 @@
  * To fill this struct, the input is required to be in sorted order (by type, id and version),
  * which is guaranteed by the caller.
  *
- * The first memory block is allocated on startup and filled, until no more node-version fit
- * into it. Then a new memory block is allocated.
+ * The arena only reserves address space on startup and commits memory as the node-versions
+ * are appended to it. It grows in place, so the versions of a node never need to be copied
+ * and a node can have as many versions as fit into memory.
  *
- *   When the current node-id has not been seen before, nothing more is needed: the node is just
- *   placed into the new block and the pointer into this block is stored in the sparsetable.
+ * When the nodestore stores mercator coordinates, lat and lon hold centimeters instead of
+ * osmium's fixed-point degrees.
  *
- *   When the current node-id already has a pointer in the sparsetable, all versions of the node
- *   are copied into the new block. The sparsetable-pointer is updated to the destination-location
- *   in the new memory block. new versions can now be appended into the new block. the space in
- *   the old block is not reused.
+ * When the nodestore is read from a snapshot, the arena is not filled. Instead the sparsetable
+ * points directly into the mapped snapshot file, which uses the same layout.
  */
 
 #ifndef IMPORTER_NODESTORESPARSE_HPP
@@ -44,49 +42,33 @@
 #include <google/sparsetable>
 #include <memory>
 #include "../timestamp.hpp"
+#include "snapshot.hpp"
+#include "arena.hpp"
 
+template <class TDebug>
 class NodestoreSparse : public Nodestore {
 private:
     /**
-     * Size of one allocated memory block
+     * should debug messages be printed? always false with DebugDisabled
      */
-    const static size_t BLOCK_SIZE = 512*1024*1024;
-    const static osm_object_id_t EST_MAX_NODE_ID = 2^31; // soon 2^32
-    const static osm_object_id_t NODE_BUFFER_STEPS = 2^16; // soon 2^32
-
-    typedef std::vector< char* > memoryBlocks_t;
-    typedef std::vector< char* >::const_iterator memoryBlocks_cit;
+    bool debug() {
+        return TDebug::enabled && isPrintingDebugMessages();
+    }
 
     /**
-     * list of all allocated memory blocks
+     * should store errors be printed? always false with DebugDisabled
      */
-    memoryBlocks_t memoryBlocks;
+    bool storeErrors() {
+        return TDebug::enabled && isPrintingStoreErrors();
+    }
 
-    /**
-     * pointer to the first byte of the currently used memory block
-     */
-    char* currentMemoryBlock;
+    const static osm_object_id_t EST_MAX_NODE_ID = 2^31; // soon 2^32
+    const static osm_object_id_t NODE_BUFFER_STEPS = 2^16; // soon 2^32
 
     /**
-     * number of bytes already used in the currentMemoryBlock
+     * memory area the node versions are appended to
      */
-    size_t currentMemoryBlockPosition;
-
-
-    char* allocateNewMemoryBlock() {
-        currentMemoryBlock = static_cast< char* >(malloc(BLOCK_SIZE));
-        currentMemoryBlockPosition = 0;
-        memoryBlocks.push_back(currentMemoryBlock);
-        return currentMemoryBlock;
-    }
-
-    void freeAllMemoryBlocks() {
-        memoryBlocks_cit end = memoryBlocks.end();
-        for(memoryBlocks_cit it = memoryBlocks.begin(); it != end; ++it) {
-            free(*it);
-        }
-        memoryBlocks.clear();
-    }
+    NodestoreArena arena;
 
     /**
      * the information stored for each node, packed into ints
@@ -110,6 +92,7 @@ private:
 
         /**
          * osmium handles lat/lon either as double (8 bytes) or as int32_t (4 byted). So we choose the smaller one.
+         * mercator coordinates are stored in centimeters, which fits into an int32_t as well.
          */
         int32_t lat;
 
@@ -129,93 +112,38 @@ private:
     osm_object_id_t maxNodeId;
     osm_object_id_t lastNodeId;
 
+    /**
+     * snapshot mapped into memory by readSnapshot, the idMap points into it
+     */
+    NodestoreSnapshotReader snapshot;
+
 
 public:
-    NodestoreSparse() : Nodestore(), memoryBlocks(), idMap(EST_MAX_NODE_ID), maxNodeId(EST_MAX_NODE_ID), lastNodeId() {
-        allocateNewMemoryBlock();
-    }
-    ~NodestoreSparse() {
-        freeAllMemoryBlocks();
-    }
+    NodestoreSparse() : Nodestore(), arena(), idMap(EST_MAX_NODE_ID), maxNodeId(EST_MAX_NODE_ID), lastNodeId(), snapshot() {}
+    ~NodestoreSparse() {}
 
     void record(osm_object_id_t id, osm_user_id_t uid, time_t t, double lon, double lat) {
         // remember: sorting is guaranteed nodes, ways relations in ascending id and then version order
         PackedNodeTimeinfo *infoPtr;
 
-        // test if there is enough space for another PackedNodeTimeinfo
-        if(isPrintingDebugMessages()) {
-            std::cerr << "  currentMemoryBlock=" << (void*)currentMemoryBlock << std::endl;
-            std::cerr << "  currentMemoryBlockPosition=" << currentMemoryBlockPosition << std::endl;
-        }
-
-        if(currentMemoryBlockPosition + sizeof(PackedNodeTimeinfo) >= BLOCK_SIZE) {
-            if(isPrintingDebugMessages()) {
-                std::cerr << "  -> memory block is full (pos " << currentMemoryBlockPosition << " + sizeof " << sizeof(PackedNodeTimeinfo) << " >= BLOCK_SIZE " << BLOCK_SIZE << ")" << std::endl;
-            }
-
-            allocateNewMemoryBlock();
-
-            if(isPrintingDebugMessages()) {
-                std::cerr << "  -> allocating new memory block at " << (void*)currentMemoryBlock << std::endl;
-            }
-
-            if(lastNodeId != id) {
-                // a new node, just use a new memory segment
-                if(isPrintingDebugMessages()) {
-                    std::cerr << "  -> node " << id << " has not yet a memory position assigned, nothing more to do" << std::endl;
-                }
-            }
-            else {
-                // same node as before, need to copy old versions into new memory block
-                if(isPrintingDebugMessages()) {
-                    std::cerr << "  -> node " << id << " has already a memory position assigned (" << idMap[id] << ")" << std::endl;
-                }
-
-                PackedNodeTimeinfo* srcPtr = idMap[id];
-                PackedNodeTimeinfo* dstPtr = reinterpret_cast< PackedNodeTimeinfo* >(currentMemoryBlock + currentMemoryBlockPosition);
-
-                if(isPrintingDebugMessages()) {
-                    std::cerr << "  -> copying node versions from old position (" << idMap[id] << ") to new position (" << (void*)currentMemoryBlock << ", offset " << currentMemoryBlockPosition << ")" << std::endl;
-                    std::cerr << "  -> re-assigning memory position " << dstPtr << " (offset: " << currentMemoryBlockPosition << ") to node id #" << id << std::endl;
-                }
-                idMap[id] = dstPtr;
-
-                do {
-                    if(isPrintingDebugMessages()) {
-                        std::cerr << "    -> copying node id #" << id << " from " << srcPtr << " to " << dstPtr << " (offset " << currentMemoryBlockPosition << ")" << std::endl;
-                    }
-
-                    // can to this in one line (without memcpy)?
-                    //memcpy(dstPtr+currentMemoryBlockPosition, srcPtr, sizeof(PackedNodeTimeinfo));
-                    dstPtr->t = srcPtr->t;
-                    dstPtr->uid = srcPtr->uid;
-                    dstPtr->lat = srcPtr->lat;
-                    dstPtr->lon = srcPtr->lon;
-
-                    currentMemoryBlockPosition += sizeof(PackedNodeTimeinfo);
-                    if(currentMemoryBlockPosition >= BLOCK_SIZE) {
-                        std::cerr << "  -> node #" << id << " has more versions then could fit into a block size of " << BLOCK_SIZE << ". It's very unlikely that this ever happens, but you could try to increase the BLOCK_SIZE..." << std::endl;
-                        throw new std::runtime_error("node does not fit into BLOCK_SIZE");
-                    }
-                    dstPtr = reinterpret_cast< PackedNodeTimeinfo* >(currentMemoryBlock + currentMemoryBlockPosition);
-                } while((++srcPtr)->t != 0);
-            }
+        if(debug()) {
+            std::cerr << "  arena used=" << arena.used() << " committed=" << arena.committed() << std::endl;
         }
 
         if(lastNodeId != id) {
             // new node
-            if(currentMemoryBlockPosition > 0) {
-                if(isPrintingDebugMessages()) {
-                    std::cerr << "  -> adding 0-separator of " << nodeSeparatorSize << " at memory position " << currentMemoryBlock + currentMemoryBlockPosition << " (from bytes " << currentMemoryBlockPosition << " to " << currentMemoryBlockPosition+nodeSeparatorSize << ")" << std::endl;
+            if(arena.used() > 0) {
+                if(debug()) {
+                    std::cerr << "  -> skipping 0-separator of " << nodeSeparatorSize << " at memory position " << (void*)arena.top() << " (from bytes " << arena.used() << " to " << arena.used()+nodeSeparatorSize << ")" << std::endl;
                 }
-                currentMemoryBlockPosition += nodeSeparatorSize;
+                arena.allocate(nodeSeparatorSize);
             }
 
             // no memory segment for this node yet
-            infoPtr = reinterpret_cast< PackedNodeTimeinfo* >(currentMemoryBlock + currentMemoryBlockPosition);
+            infoPtr = reinterpret_cast< PackedNodeTimeinfo* >(arena.top());
 
-            if(isPrintingDebugMessages()) {
-                std::cerr << "  -> assigning memory position " << infoPtr << " (offset: " << currentMemoryBlockPosition << ") to node id #" << id << std::endl;
+            if(debug()) {
+                std::cerr << "  -> assigning memory position " << infoPtr << " (offset: " << arena.used() << ") to node id #" << id << std::endl;
             }
 
             if(id > maxNodeId) {
@@ -224,26 +152,26 @@ public:
             }
             idMap[id] = infoPtr;
         }
-        else {
-            // no memory segment for this node yet
-            infoPtr = reinterpret_cast< PackedNodeTimeinfo* >(currentMemoryBlock + currentMemoryBlockPosition);
-        }
 
-        if(isPrintingDebugMessages()) {
-            std::cerr << "  -> storing " << sizeof(PackedNodeTimeinfo) << " bytes of data at memory position " << infoPtr << " (from bytes " << currentMemoryBlockPosition << " to " << currentMemoryBlockPosition+sizeof(PackedNodeTimeinfo) << ")" << std::endl;
+        // make room for this version and the 0-separator behind it. the arena grows
+        // in place, so the earlier versions of this node stay where they are
+        arena.ensure(sizeof(PackedNodeTimeinfo) + nodeSeparatorSize);
+
+        if(debug()) {
+            std::cerr << "  -> storing " << sizeof(PackedNodeTimeinfo) << " bytes of data at memory position " << (void*)arena.top() << " (from bytes " << arena.used() << " to " << arena.used()+sizeof(PackedNodeTimeinfo) << ")" << std::endl;
         }
 
+        infoPtr = reinterpret_cast< PackedNodeTimeinfo* >(arena.allocate(sizeof(PackedNodeTimeinfo)));
         infoPtr->t = t;
         infoPtr->uid = uid;
-        infoPtr->lat = Osmium::OSM::double_to_fix(lat);
-        infoPtr->lon = Osmium::OSM::double_to_fix(lon);
+        infoPtr->lat = toFix(lat);
+        infoPtr->lon = toFix(lon);
 
 
         // mark end of memory for this node
         infoPtr++;
         infoPtr->t = 0;
 
-        currentMemoryBlockPosition += sizeof(PackedNodeTimeinfo);
         lastNodeId = id;
     }
 
@@ -252,12 +180,12 @@ public:
     // because this was more easy to implement in the stl store, but once we
     // change the default from stl to sparse, we can change the return value, too
     timemap_ptr lookup(osm_object_id_t id, bool &found) {
-        if(isPrintingStoreErrors()) {
+        if(storeErrors()) {
             std::cout << "lookup for timemap of node #" << id << std::endl;
         }
 
         if(!idMap.test(id)) {
-            if(isPrintingStoreErrors()) {
+            if(storeErrors()) {
                 std::cerr << "  -> no memory position assigned for node, skipping" << std::endl;
             }
 
@@ -265,7 +193,7 @@ public:
             return timemap_ptr();
         }
 
-        if(isPrintingDebugMessages()) {
+        if(debug()) {
             std::cerr << "  idMap[id]=" << idMap[id] << std::endl;
         }
 
@@ -274,16 +202,16 @@ public:
 
         Nodeinfo info;
         do {
-            if(isPrintingDebugMessages()) {
+            if(debug()) {
                 std::cerr << "  -> found node id #" << id << "at memory position " << infoPtr << " (node-offset " << ((char*)infoPtr-(char*)basePtr) << ")" << std::endl;
             }
-            info.lat = Osmium::OSM::fix_to_double(infoPtr->lat);
-            info.lon = Osmium::OSM::fix_to_double(infoPtr->lon);
+            info.lat = fromFix(infoPtr->lat);
+            info.lon = fromFix(infoPtr->lon);
             info.uid = infoPtr->uid;
             tMap->insert(timepair(infoPtr->t, info));
         } while((++infoPtr)->t != 0);
 
-        if(isPrintingDebugMessages()) {
+        if(debug()) {
             std::cerr << "  -> returning timemap with " << tMap->size() << " items" << std::endl;
         }
 
@@ -292,12 +220,12 @@ public:
     }
 
     Nodeinfo lookup(osm_object_id_t id, time_t t, bool &found) {
-        if(isPrintingStoreErrors()) {
+        if(storeErrors()) {
             std::cout << "lookup for coords of oldest node #" << id << " younger-or-equal then " << t << " (" << Timestamp::format(t) << ")" << std::endl;
         }
 
         if(!idMap.test(id)) {
-            if(isPrintingStoreErrors()) {
+            if(storeErrors()) {
                 std::cerr << "  -> no memory position assigned for node, skipping" << std::endl;
             }
 
@@ -306,7 +234,7 @@ public:
         }
 
         PackedNodeTimeinfo *basePtr = idMap[id], *infoPtr = basePtr;
-        if(isPrintingDebugMessages()) {
+        if(debug()) {
             std::cerr << "  idMap[id]=" << idMap[id] << std::endl;
         }
 
@@ -315,34 +243,34 @@ public:
 
         // find the oldest node-version younger then t
         do {
-            if(isPrintingDebugMessages()) {
+            if(debug()) {
                 std::cerr << "  -> probing node id #" << id << " at " << infoPtr->t << " (" << Timestamp::format(infoPtr->t) << ") at memory position " << infoPtr << " (node-offset " << ((char*)infoPtr-(char*)basePtr) << ")" << std::endl;
             }
 
             if(infoPtr->t <= t && infoPtr->t > infoTime) {
-                info.lat = Osmium::OSM::fix_to_double(infoPtr->lat);
-                info.lon = Osmium::OSM::fix_to_double(infoPtr->lon);
+                info.lat = fromFix(infoPtr->lat);
+                info.lon = fromFix(infoPtr->lon);
                 info.uid = infoPtr->uid;
                 infoTime = infoPtr->t;
 
-                if(isPrintingDebugMessages()) {
+                if(debug()) {
                     std::cerr << "    -> match, copying data" << std::endl;
                 }
             }
         } while((++infoPtr)->t != 0);
 
         if(infoTime == 0) {
-            info.lat = Osmium::OSM::fix_to_double(basePtr->lat);
-            info.lon = Osmium::OSM::fix_to_double(basePtr->lon);
+            info.lat = fromFix(basePtr->lat);
+            info.lon = fromFix(basePtr->lon);
             info.uid = basePtr->uid;
             infoTime = basePtr->t;
 
-            if(isPrintingDebugMessages()) {
+            if(debug()) {
                 std::cerr << "  -> way is younger " << Timestamp::format(t) << " then the youngest available version of the node, using first version from " << infoTime << " (" << Timestamp::format(infoTime) << ")" << std::endl;
             }
         }
         else {
-            if(isPrintingDebugMessages()) {
+            if(debug()) {
                 std::cerr << "  -> returning coords from " << infoTime << " (" << Timestamp::format(infoTime) << ")" << std::endl;
             }
         }
@@ -350,6 +278,56 @@ public:
         found = (infoTime > 0);
         return info;
     }
+
+    void printStatistics() {
+        std::cerr << "nodestore: " << idMap.num_nonempty() << " nodes, " <<
+            (arena.used() >> 20) << " MB used, " <<
+            (arena.committed() >> 20) << " MB committed, " <<
+            (arena.reserved() >> 20) << " MB of address space reserved" << std::endl;
+    }
+
+    void writeSnapshot(const std::string& filename) {
+        NodestoreSnapshotWriter writer;
+        writer.open(filename, snapshotFlags(), snapshotFingerprint());
+
+        typename google::sparsetable< PackedNodeTimeinfo* >::const_nonempty_iterator end = idMap.nonempty_end();
+        for(typename google::sparsetable< PackedNodeTimeinfo* >::const_nonempty_iterator it = idMap.nonempty_begin(); it != end; ++it) {
+            writer.addNode(idMap.get_pos(it));
+
+            PackedNodeTimeinfo *infoPtr = *it;
+            do {
+                writer.addVersion(infoPtr->t, infoPtr->uid, infoPtr->lat, infoPtr->lon);
+            } while((++infoPtr)->t != 0);
+        }
+
+        writer.close();
+    }
+
+    /**
+     * the versions are not copied into the memory blocks, instead the
+     * idMap points directly into the mapped snapshot file. nodes read from
+     * a snapshot must not be recorded again afterwards.
+     */
+    void readSnapshot(const std::string& filename) {
+        snapshot.open(filename);
+        checkSnapshot(snapshot.header());
+
+        osm_object_id_t id;
+        const NodestoreSnapshot::Record *records;
+        while(snapshot.nextNode(id, records)) {
+            if(id > maxNodeId) {
+                idMap.resize(id + NODE_BUFFER_STEPS + 1);
+                maxNodeId = id + NODE_BUFFER_STEPS;
+            }
+
+            // the mapping is read-only, but the store never writes to versions of earlier nodes
+            idMap[id] = reinterpret_cast< PackedNodeTimeinfo* >(const_cast< NodestoreSnapshot::Record* >(records));
+        }
+
+        if(debug()) {
+            std::cerr << "  -> mapped " << snapshot.header()->nodes << " nodes with " << snapshot.header()->versions << " versions from snapshot " << filename << std::endl;
+        }
+    }
 };
 
 #endif // IMPORTER_NODESTORESPARSE_HPP
@@ -1,8 +1,25 @@
 #ifndef IMPORTER_NODESTORESTL_HPP
 #define IMPORTER_NODESTORESTL_HPP
 
+#include "snapshot.hpp"
+
+template <class TDebug>
 class NodestoreStl : public Nodestore {
 private:
+    /**
+     * should debug messages be printed? always false with DebugDisabled
+     */
+    bool debug() {
+        return TDebug::enabled && isPrintingDebugMessages();
+    }
+
+    /**
+     * should store errors be printed? always false with DebugDisabled
+     */
+    bool storeErrors() {
+        return TDebug::enabled && isPrintingStoreErrors();
+    }
+
     /**
      * a map between the node-id and its map of node-versions and -times (timemap)
      */
@@ -39,7 +56,7 @@ public:
         timemap_ptr tmap;
 
         if(it == m_nodemap.end()) {
-            if(isPrintingDebugMessages()) {
+            if(debug()) {
                 std::cerr << "no timemap for node #" << id << ", creating new" << std::endl;
             }
 
@@ -50,19 +67,19 @@ public:
         }
 
         tmap->insert(timepair(t, info));
-        if(isPrintingDebugMessages()) {
+        if(debug()) {
             std::cerr << "adding timepair for node #" << id << " at tstamp " << t << std::endl;
         }
     }
 
     timemap_ptr lookup(osm_object_id_t id, bool &found) {
-        if(isPrintingDebugMessages()) {
+        if(debug()) {
             std::cerr << "looking up timemap of node #" << id << std::endl;
         }
 
         nodemap_it nit = m_nodemap.find(id);
         if(nit == m_nodemap.end()) {
-            if(isPrintingStoreErrors()) {
+            if(storeErrors()) {
                 std::cerr << "no timemap for node #" << id << ", skipping node" << std::endl;
             }
             found = false;
@@ -74,7 +91,7 @@ public:
     }
 
     Nodeinfo lookup(osm_object_id_t id, time_t t, bool &found) {
-        if(isPrintingDebugMessages()) {
+        if(debug()) {
             std::cerr << "looking up information of node #" << id << " at tstamp " << t << std::endl;
         }
 
@@ -85,7 +102,7 @@ public:
         timemap_it tit = tmap->upper_bound(t);
 
         if(tit == tmap->begin()) {
-            if(isPrintingStoreErrors()) {
+            if(storeErrors()) {
                 std::cerr << "reference to node #" << id << " at tstamp " << t << " which is before the youngest available version of that node, using first version" << std::endl;
             }
         } else {
@@ -95,6 +112,41 @@ public:
         found = true;
         return tit->second;
     }
+
+    void printStatistics() {
+        std::cerr << "nodestore: " << m_nodemap.size() << " nodes" << std::endl;
+    }
+
+    void writeSnapshot(const std::string& filename) {
+        NodestoreSnapshotWriter writer;
+        writer.open(filename, snapshotFlags(), snapshotFingerprint());
+
+        nodemap_cit end = m_nodemap.end();
+        for(nodemap_cit nit = m_nodemap.begin(); nit != end; ++nit) {
+            writer.addNode(nit->first);
+
+            timemap_cit tend = nit->second->end();
+            for(timemap_cit tit = nit->second->begin(); tit != tend; ++tit) {
+                writer.addVersion(tit->first, tit->second.uid, toFix(tit->second.lat), toFix(tit->second.lon));
+            }
+        }
+
+        writer.close();
+    }
+
+    void readSnapshot(const std::string& filename) {
+        NodestoreSnapshotReader reader;
+        reader.open(filename);
+        checkSnapshot(reader.header());
+
+        osm_object_id_t id;
+        const NodestoreSnapshot::Record *records;
+        while(reader.nextNode(id, records)) {
+            for(const NodestoreSnapshot::Record *it = records; it->t != 0; it++) {
+                record(id, it->uid, it->t, fromFix(it->lon), fromFix(it->lat));
+            }
+        }
+    }
 };
 
 #endif // IMPORTER_NODESTORESTL_HPP
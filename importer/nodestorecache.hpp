@@ -0,0 +1,262 @@
+/**
+ * The versions and minor versions of a way usually share most of their
+ * nodes, but the geometry of each of them is built from the nodestore
+ * again. The NodestoreCache sits between the nodestore and the classes
+ * building the geometries and minor times. It keeps the timelines of the
+ * nodes referenced by the current way in a small flat table, so after the
+ * first version of a way most lookups are answered from the cpu caches
+ * instead of going through the nodestore.
+ *
+ * The cache is cleared each time the handler starts writing another way.
+ * It provides the same lookup methods as the nodestores (see nodestore.hpp),
+ * so the GeomBuilder can be templated on it. The MinorSweep reads the
+ * cached versions of a node directly instead of copying them into a
+ * timemap.
+ */
+
+#ifndef IMPORTER_NODESTORECACHE_HPP
+#define IMPORTER_NODESTORECACHE_HPP
+
+template <class TNodestore, class TDebug>
+class NodestoreCache {
+public:
+    /**
+     * one version of a cached node
+     */
+    struct Version {
+        time_t t;
+        Nodestore::Nodeinfo info;
+    };
+
+private:
+    /**
+     * a slot of the hash table, pointing to the versions of one node
+     */
+    struct Slot {
+        osm_object_id_t id;
+
+        /**
+         * range of the node's versions in m_versions, begin == end if the
+         * node is not contained in the nodestore
+         */
+        uint32_t begin, end;
+
+        bool used;
+    };
+
+    /**
+     * initial number of slots, enough for most ways. the table grows when
+     * it is half full and shrinks back to this size when it is cleared
+     */
+    const static size_t INITIAL_SLOTS = 1024;
+
+    TNodestore *m_nodestore;
+
+    std::vector<Slot> m_slots;
+    std::vector<Version> m_versions;
+
+    /**
+     * positions of the used slots in m_slots, so clearing the cache only
+     * touches those
+     */
+    std::vector<size_t> m_used;
+
+    /**
+     * id of the way the cached nodes belong to
+     */
+    osm_object_id_t m_wayId;
+    bool m_hasWay;
+
+    uint64_t m_hits, m_misses;
+
+    bool m_storeerrors;
+
+    /**
+     * slot for the id, either the one containing it or the free one it
+     * should be stored in
+     */
+    size_t slot(osm_object_id_t id) {
+        size_t mask = m_slots.size() - 1;
+        size_t i = ((uint64_t)id * 0x9E3779B97F4A7C15ULL) >> 32 & mask;
+        while(m_slots[i].used && m_slots[i].id != id) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void grow() {
+        std::vector<Slot> old(m_slots.size() * 2);
+        old.swap(m_slots);
+        for(size_t i = 0; i < m_used.size(); i++) {
+            const Slot& s = old[m_used[i]];
+            m_used[i] = slot(s.id);
+            m_slots[m_used[i]] = s;
+        }
+    }
+
+    /**
+     * find the cached versions of a node, fetch them from the nodestore
+     * if they are not cached yet
+     */
+    const Slot& fetch(osm_object_id_t id) {
+        size_t i = slot(id);
+        if(m_slots[i].used) {
+            m_hits++;
+            return m_slots[i];
+        }
+
+        m_misses++;
+
+        if((m_used.size() + 1) * 2 > m_slots.size()) {
+            grow();
+            i = slot(id);
+        }
+
+        Slot *s = &m_slots[i];
+        s->id = id;
+        s->used = true;
+        s->begin = s->end = m_versions.size();
+        m_used.push_back(i);
+
+        bool found;
+        Nodestore::timemap_ptr tmap = m_nodestore->lookup(id, found);
+        if(found) {
+            Nodestore::timemap_cit end = tmap->end();
+            for(Nodestore::timemap_cit it = tmap->begin(); it != end; ++it) {
+                Version version = {it->first, it->second};
+                m_versions.push_back(version);
+            }
+            s->end = m_versions.size();
+        }
+
+        return *s;
+    }
+
+public:
+    NodestoreCache(TNodestore *nodestore) :
+            m_nodestore(nodestore),
+            m_slots(INITIAL_SLOTS),
+            m_versions(),
+            m_used(),
+            m_wayId(0),
+            m_hasWay(false),
+            m_hits(0),
+            m_misses(0),
+            m_storeerrors(false) {}
+
+    /**
+     * change the nodestore the nodes are fetched from, this clears the cache
+     */
+    void nodestore(TNodestore *nodestore) {
+        m_nodestore = nodestore;
+        clear();
+    }
+
+    /**
+     * start writing the way with the id, clears the cache if it contains
+     * the nodes of another way
+     */
+    void way(osm_object_id_t id) {
+        if(m_hasWay && m_wayId == id)
+            return;
+
+        clear();
+        m_wayId = id;
+        m_hasWay = true;
+    }
+
+    /**
+     * forget all cached nodes
+     */
+    void clear() {
+        if(m_slots.size() > INITIAL_SLOTS) {
+            // a large way grew the table, don't keep it for all the small ones
+            std::vector<Slot>(INITIAL_SLOTS).swap(m_slots);
+        } else {
+            for(size_t i = 0; i < m_used.size(); i++) {
+                m_slots[m_used[i]] = Slot();
+            }
+        }
+        m_used.clear();
+        m_versions.clear();
+        m_hasWay = false;
+    }
+
+    bool isStoringMercator() {
+        return m_nodestore->isStoringMercator();
+    }
+
+    bool isPrintingStoreErrors() {
+        return m_storeerrors;
+    }
+
+    void printStoreErrors(bool shouldPrintStoreErrors) {
+        m_storeerrors = shouldPrintStoreErrors;
+    }
+
+    /**
+     * the cached versions of a node, sorted by time, in the range
+     * begin - end. returns false if the node is not contained in the
+     * nodestore. the range stays valid until the next node is looked up.
+     */
+    bool versions(osm_object_id_t id, const Version *&begin, const Version *&end) {
+        const Slot& s = fetch(id);
+        if(s.begin == s.end) {
+            begin = end = NULL;
+            return false;
+        }
+
+        begin = &m_versions[s.begin];
+        end = begin + (s.end - s.begin);
+        return true;
+    }
+
+    Nodestore::timemap_ptr lookup(osm_object_id_t id, bool &found) {
+        const Slot& s = fetch(id);
+        found = s.begin != s.end;
+        if(!found) {
+            return Nodestore::timemap_ptr();
+        }
+
+        Nodestore::timemap_ptr tmap(new Nodestore::timemap());
+        for(uint32_t i = s.begin; i < s.end; i++) {
+            tmap->insert(Nodestore::timepair(m_versions[i].t, m_versions[i].info));
+        }
+        return tmap;
+    }
+
+    Nodestore::Nodeinfo lookup(osm_object_id_t id, time_t t, bool &found) {
+        const Slot& s = fetch(id);
+        found = s.begin != s.end;
+        if(!found) {
+            Nodestore::Nodeinfo nullinfo = Nodestore::Nodeinfo();
+            return nullinfo;
+        }
+
+        // the versions are sorted by time, find the youngest one not younger then t
+        uint32_t match = s.begin;
+        for(uint32_t i = s.begin; i < s.end && m_versions[i].t <= t; i++) {
+            match = i;
+        }
+
+        if(TDebug::enabled && m_storeerrors && m_versions[match].t > t) {
+            std::cerr << "reference to node #" << id << " at tstamp " << t << " which is before the youngest available version of that node, using first version" << std::endl;
+        }
+
+        return m_versions[match].info;
+    }
+
+    /**
+     * print the hit rate of the cache
+     */
+    void printStatistics() {
+        uint64_t lookups = m_hits + m_misses;
+        std::cerr << "way node cache: " << m_hits << " hits, " << m_misses << " misses";
+        if(lookups > 0) {
+            std::cerr << " (" << (m_hits * 100 / lookups) << "% hit rate)";
+        }
+        std::cerr << std::endl;
+    }
+};
+
+#endif // IMPORTER_NODESTORECACHE_HPP
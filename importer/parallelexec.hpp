@@ -0,0 +1,77 @@
+/**
+ * Building the indexes of the tables after the import takes a long time,
+ * but each CREATE INDEX only uses one core of the database server. When
+ * there are several independent tables (like the partitions of a table),
+ * their indexes can be built at the same time over several connections.
+ *
+ * The ParallelExec collects independent batches of sql statements with an
+ * estimate of their cost and runs them over a number of connections. The
+ * most expensive batches are distributed first, each to the connection
+ * with the least work so far.
+ */
+
+#ifndef IMPORTER_PARALLELEXEC_HPP
+#define IMPORTER_PARALLELEXEC_HPP
+
+#include "dbconn.hpp"
+
+/**
+ * Runs independent batches of sql statements over several connections
+ */
+class ParallelExec {
+private:
+    /**
+     * the statements of each batch and their cost
+     */
+    std::vector< std::pair<uint64_t, std::string> > m_batches;
+
+public:
+    ParallelExec() : m_batches() {}
+
+    /**
+     * add a batch of statements, which are executed in order on one
+     * connection
+     */
+    void add(const std::string& cmd, uint64_t cost) {
+        m_batches.push_back(std::make_pair(cost, cmd));
+    }
+
+    /**
+     * run all batches over at most jobs connections and wait for them
+     */
+    void run(const std::string& dsn, size_t jobs) {
+        if(m_batches.empty()) {
+            return;
+        }
+
+        jobs = std::max((size_t)1, std::min(jobs, m_batches.size()));
+
+        // the most expensive batches first
+        std::sort(m_batches.begin(), m_batches.end());
+        std::reverse(m_batches.begin(), m_batches.end());
+
+        std::vector<std::string> cmds(jobs);
+        std::vector<uint64_t> load(jobs, 0);
+        for(size_t i = 0; i < m_batches.size(); i++) {
+            size_t j = std::min_element(load.begin(), load.end()) - load.begin();
+            cmds[j] += m_batches[i].second;
+            load[j] += m_batches[i].first + 1;
+        }
+
+        std::vector<DbConn*> conns(jobs);
+        for(size_t j = 0; j < jobs; j++) {
+            conns[j] = new DbConn();
+            conns[j]->open(dsn);
+            conns[j]->send(cmds[j]);
+        }
+
+        for(size_t j = 0; j < jobs; j++) {
+            conns[j]->wait();
+            delete conns[j];
+        }
+
+        m_batches.clear();
+    }
+};
+
+#endif // IMPORTER_PARALLELEXEC_HPP
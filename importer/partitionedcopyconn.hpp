@@ -0,0 +1,256 @@
+/**
+ * Every rendering of a point in time filters the tables by validity, so
+ * one large table with one large index has to be searched for every
+ * frame. With partitioning, the rows of a table are split by the year of
+ * their valid_from into child tables inheriting from it, eg. hist_line_y2009,
+ * each with a CHECK constraint on that year. Postgres then skips the
+ * children starting after the rendered date (constraint exclusion), and
+ * the indexes of the children can be built in parallel.
+ *
+ * The importer routes each row to the COPY pipe of its child table, the
+ * children are created when the first row of a year arrives. The parent
+ * table stays empty.
+ *
+ * When clustered, the rows are collected in a ClusterSorter and only
+ * copied into the table (or its partitions) in sorted order when it is
+ * closed.
+ *
+ * With the validity range, a tsrange column [valid_from, valid_to) is
+ * appended to each row, which is indexed together with the geometry so
+ * that the views can query it with @> (see scheme/00-before-range.sql).
+ */
+
+#ifndef IMPORTER_PARTITIONEDCOPYCONN_HPP
+#define IMPORTER_PARTITIONEDCOPYCONN_HPP
+
+#include "dbcopyconn.hpp"
+#include "clustersorter.hpp"
+#include "timestamp.hpp"
+
+/**
+ * COPY pipe into a table, or into the yearly partitions of a table
+ */
+class PartitionedCopyConn {
+private:
+    /**
+     * a child table and its COPY pipe
+     */
+    struct Partition {
+        DbCopyConn *conn;
+        uint64_t rows;
+    };
+
+    std::string m_dsn, m_prefix, m_table;
+
+    /**
+     * the connection the child tables are created with
+     */
+    DbConn *m_general;
+
+    bool m_partitioned, m_validityRange;
+
+    /**
+     * the pipe into the table itself, if it is not partitioned
+     */
+    DbCopyConn m_conn;
+
+    std::map<int, Partition> m_partitions;
+
+    /**
+     * the sorter collecting the rows, if the table is clustered
+     */
+    ClusterSorter *m_sorter;
+
+    static int yearOf(time_t t) {
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        return tm.tm_year + 1900;
+    }
+
+    /**
+     * the partition of a year, created if it does not exist yet
+     */
+    Partition& partition(int year) {
+        std::map<int, Partition>::iterator it = m_partitions.find(year);
+        if(it != m_partitions.end()) {
+            return it->second;
+        }
+
+        std::string parent = m_prefix + m_table;
+        std::string child = m_prefix + partitionTable(year);
+
+        // the geometry columns are inherited with their type modifier
+        // (PostGIS 2) or their CHECK constraints (PostGIS 1),
+        // Populate_Geometry_Columns registers them from those
+        std::stringstream cmd;
+        cmd << "DROP TABLE IF EXISTS " << child << " CASCADE;" <<
+            "CREATE TABLE " << child << " (CHECK (valid_from >= '" << year << "-01-01' AND valid_from < '" << year + 1 << "-01-01')) INHERITS (" << parent << ");" <<
+            "SELECT Populate_Geometry_Columns('" << child << "'::regclass);";
+        m_general->exec(cmd.str());
+
+        Partition p;
+        p.conn = new DbCopyConn();
+        p.conn->open(m_dsn, m_prefix, partitionTable(year));
+        p.rows = 0;
+        return m_partitions[year] = p;
+    }
+
+    /**
+     * collect a row in the sorter or write it right away
+     */
+    void add(time_t valid_from, uint32_t cell, const std::string& data) {
+        if(m_sorter) {
+            m_sorter->add(cell, valid_from, data);
+        } else {
+            write(valid_from, data);
+        }
+    }
+
+    /**
+     * copy a row into the pipe of the table or of its partition
+     */
+    void write(time_t valid_from, const std::string& data) {
+        if(!m_partitioned) {
+            m_conn.copy(data);
+            return;
+        }
+
+        Partition& p = partition(yearOf(valid_from));
+        p.conn->copy(data);
+        p.rows++;
+    }
+
+public:
+    PartitionedCopyConn() : m_dsn(), m_prefix(), m_table(), m_general(NULL), m_partitioned(false), m_validityRange(false), m_conn(), m_partitions(), m_sorter(NULL) {}
+
+    ~PartitionedCopyConn() {
+        for(std::map<int, Partition>::iterator it = m_partitions.begin(); it != m_partitions.end(); ++it) {
+            delete it->second.conn;
+        }
+        delete m_sorter;
+    }
+
+    bool isPartitioned() const {
+        return m_partitioned;
+    }
+
+    /**
+     * split the rows into yearly partitions, needs to be set before open
+     */
+    void partitioned(bool shouldPartition) {
+        m_partitioned = shouldPartition;
+    }
+
+    bool hasValidityRange() const {
+        return m_validityRange;
+    }
+
+    /**
+     * append the validity as a tsrange column to each row
+     */
+    void validityRange(bool shouldWriteRange) {
+        m_validityRange = shouldWriteRange;
+    }
+
+    /**
+     * sort the rows by their Hilbert cell and valid_from before copying
+     * them, spilling into tmpdir with at most memoryLimit bytes of keys
+     * in memory
+     */
+    void cluster(const std::string& tmpdir, size_t memoryLimit) {
+        delete m_sorter;
+        m_sorter = new ClusterSorter(tmpdir, memoryLimit);
+    }
+
+    /**
+     * name of the partition of a year, without the prefix
+     */
+    std::string partitionTable(int year) const {
+        std::stringstream name;
+        name << m_table << "_y" << year;
+        return name.str();
+    }
+
+    /**
+     * open the COPY pipe into the table. when partitioned, the pipes into
+     * the partitions are opened as they are needed, and the partitions are
+     * created with the general connection.
+     */
+    void open(DbConn& general, const std::string& dsn, const std::string& prefix, const std::string& table) {
+        m_general = &general;
+        m_dsn = dsn;
+        m_prefix = prefix;
+        m_table = table;
+
+        if(!m_partitioned) {
+            m_conn.open(dsn, prefix, table);
+        }
+    }
+
+    /**
+     * copy a row which is valid from valid_from to valid_to (0 if it is
+     * still valid) into the pipe
+     */
+    void copy(time_t valid_from, time_t valid_to, const std::string& data) {
+        copy(valid_from, valid_to, ClusterSorter::NO_CELL, data);
+    }
+
+    /**
+     * copy a row with the Hilbert cell of its geometry, which is valid from
+     * valid_from to valid_to (0 if it is still valid) into the pipe. when
+     * clustered, the row is only collected.
+     */
+    void copy(time_t valid_from, time_t valid_to, uint32_t cell, const std::string& data) {
+        if(m_validityRange) {
+            // the row ends with a newline, the range becomes the last column
+            std::string row(data, 0, data.size() - 1);
+            row += "\t[" + Timestamp::format(valid_from) + ',' + (valid_to ? Timestamp::format(valid_to) : "") + ")\n";
+
+            add(valid_from, cell, row);
+        } else {
+            add(valid_from, cell, data);
+        }
+    }
+
+    /**
+     * finish all COPY pipes
+     */
+    void close() {
+        if(m_sorter) {
+            std::cerr << "writing " << m_sorter->size() << " clustered rows into " << m_prefix << m_table << "..." << std::endl;
+            m_sorter->sort();
+
+            time_t valid_from;
+            std::string data;
+            while(m_sorter->next(valid_from, data)) {
+                write(valid_from, data);
+            }
+
+            delete m_sorter;
+            m_sorter = NULL;
+        }
+
+        if(!m_partitioned) {
+            m_conn.close();
+            return;
+        }
+
+        for(std::map<int, Partition>::iterator it = m_partitions.begin(); it != m_partitions.end(); ++it) {
+            it->second.conn->close();
+        }
+    }
+
+    /**
+     * the names of the partitions (with the prefix) and the number of rows
+     * copied into each of them
+     */
+    std::vector< std::pair<std::string, uint64_t> > partitions() const {
+        std::vector< std::pair<std::string, uint64_t> > result;
+        for(std::map<int, Partition>::const_iterator it = m_partitions.begin(); it != m_partitions.end(); ++it) {
+            result.push_back(std::make_pair(m_prefix + partitionTable(it->first), it->second.rows));
+        }
+        return result;
+    }
+};
+
+#endif // IMPORTER_PARTITIONEDCOPYCONN_HPP
@@ -69,6 +69,16 @@ public:
         // no, this could never be a polygon
         return false;
     }
+
+    /**
+     * checks the TagList of a relation to decide if it is a multipolygon,
+     * which is assembled into areas from its member ways. boundary
+     * relations are assembled the same way.
+     */
+    static bool isMultipolygon(const Osmium::OSM::TagList& tags) {
+        const char *type = tags.get_value_by_key("type");
+        return type && (0 == strcmp(type, "multipolygon") || 0 == strcmp(type, "boundary"));
+    }
 };
 
 #endif // IMPORTER_POLYGONIDENTIFYER_HPP
@@ -0,0 +1,215 @@
+/**
+ * Large polygons (forests, lakes, administrative areas) have a bounding
+ * box that matches nearly every query, so they dilute the spatial index
+ * and have to be fetched and clipped for each rendered frame. The
+ * PolygonSplitter cuts polygons with more then a given number of vertices
+ * or a larger extent into pieces along a grid.
+ *
+ * The grid is a quadtree over the mercator world, like the tiles of a
+ * slippy map: a polygon that is too large is intersected with the four
+ * quarters of the cell it lies in, and each piece that is still too large
+ * is split again. Because the cells are aligned to the quadtree, the cuts
+ * of all polygons and of all versions of a polygon lie on the same lines.
+ */
+
+#ifndef IMPORTER_POLYGONSPLITTER_HPP
+#define IMPORTER_POLYGONSPLITTER_HPP
+
+#include <memory>
+
+#include <geos/geom/Envelope.h>
+
+/**
+ * Splits large polygons into grid aligned parts
+ */
+class PolygonSplitter {
+private:
+    /**
+     * the pieces are not split any further then this quadtree level (cells
+     * of about 2.4 meters)
+     */
+    const static int MAX_DEPTH = 24;
+
+    size_t m_maxVertices;
+    double m_maxExtent;
+
+    uint64_t m_split, m_parts;
+
+    /**
+     * half the size of the mercator world in meters
+     */
+    static double worldSize() {
+        return M_PI * 6378137.0;
+    }
+
+    /**
+     * is the polygon too large?
+     */
+    bool tooLarge(const geos::geom::Geometry* geom) const {
+        if(m_maxVertices > 0 && geom->getNumPoints() > m_maxVertices) {
+            return true;
+        }
+
+        if(m_maxExtent > 0) {
+            const geos::geom::Envelope* env = geom->getEnvelopeInternal();
+            if(env->getWidth() > m_maxExtent || env->getHeight() > m_maxExtent) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * add the polygons of a geometry to the parts. takes ownership of the
+     * geometry.
+     */
+    void collect(geos::geom::Geometry* geom, std::vector<geos::geom::Geometry*>& parts) {
+        std::auto_ptr<geos::geom::Geometry> owned(geom);
+        if(geom->getGeometryTypeId() == geos::geom::GEOS_POLYGON) {
+            if(!geom->isEmpty()) {
+                geom->setSRID(900913);
+                parts.push_back(owned.release());
+            }
+            return;
+        }
+
+        // intersections may return multipolygons or collections, which can
+        // contain lines or points where the polygon touches a cell border
+        for(size_t i = 0; i < geom->getNumGeometries(); i++) {
+            const geos::geom::Geometry* part = geom->getGeometryN(i);
+            if(part->getGeometryTypeId() == geos::geom::GEOS_POLYGON && !part->isEmpty()) {
+                geos::geom::Geometry* copy = part->clone();
+                copy->setSRID(900913);
+                parts.push_back(copy);
+            }
+        }
+    }
+
+    /**
+     * split the geometry, which lies in the cell, into parts. takes
+     * ownership of the geometry, which is also freed when geos throws.
+     */
+    void split(geos::geom::Geometry* geom, double minx, double miny, double size, int depth, std::vector<geos::geom::Geometry*>& parts) {
+        if(depth >= MAX_DEPTH || !tooLarge(geom)) {
+            collect(geom, parts);
+            return;
+        }
+
+        std::auto_ptr<geos::geom::Geometry> owned(geom);
+
+        // descend into the quarters of the cell
+        geos::geom::GeometryFactory *f = Osmium::Geometry::geos_geometry_factory();
+        const geos::geom::Envelope* env = geom->getEnvelopeInternal();
+        double half = size / 2;
+        for(int q = 0; q < 4; q++) {
+            double x = minx + (q % 2) * half, y = miny + (q / 2) * half;
+            geos::geom::Envelope cell(x, x + half, y, y + half);
+            if(!cell.intersects(env)) {
+                continue;
+            }
+
+            std::auto_ptr<geos::geom::Geometry> box(f->toGeometry(&cell));
+            std::auto_ptr<geos::geom::Geometry> piece(geom->intersection(box.get()));
+
+            if(piece->isEmpty()) {
+                continue;
+            }
+
+            // the intersection may return several polygons, split them one by one
+            if(piece->getGeometryTypeId() == geos::geom::GEOS_POLYGON) {
+                split(piece.release(), x, y, half, depth + 1, parts);
+            } else {
+                std::vector<geos::geom::Geometry*> pieces;
+                collect(piece.release(), pieces);
+
+                size_t i = 0;
+                try {
+                    for(; i < pieces.size(); i++) {
+                        split(pieces[i], x, y, half, depth + 1, parts);
+                    }
+                } catch(...) {
+                    // pieces[i] was freed by split, the ones after it were not split yet
+                    for(i++; i < pieces.size(); i++) {
+                        delete pieces[i];
+                    }
+                    throw;
+                }
+            }
+        }
+    }
+
+public:
+    PolygonSplitter() : m_maxVertices(0), m_maxExtent(0), m_split(0), m_parts(0) {}
+
+    /**
+     * are polygons split at all?
+     */
+    bool isSplitting() const {
+        return m_maxVertices > 0 || m_maxExtent > 0;
+    }
+
+    size_t maxVertices() const {
+        return m_maxVertices;
+    }
+
+    /**
+     * split polygons with more vertices, 0 disables the limit
+     */
+    void maxVertices(size_t vertices) {
+        m_maxVertices = vertices;
+    }
+
+    double maxExtent() const {
+        return m_maxExtent;
+    }
+
+    /**
+     * split polygons wider or higher then this many projected meters, 0
+     * disables the limit
+     */
+    void maxExtent(double meters) {
+        m_maxExtent = meters;
+    }
+
+    /**
+     * split the polygon into parts, which are owned by the caller
+     * afterwards. returns false, and no parts, if the polygon does not
+     * need to be split or can't be split.
+     */
+    bool split(const geos::geom::Geometry* geom, std::vector<geos::geom::Geometry*>& parts) {
+        parts.clear();
+
+        if(!isSplitting() || !tooLarge(geom)) {
+            return false;
+        }
+
+        try {
+            split(geom->clone(), -worldSize(), -worldSize(), 2 * worldSize(), 0, parts);
+        } catch(geos::util::GEOSException e) {
+            std::cerr << "error splitting polygon: " << e.what() << std::endl;
+            for(size_t i = 0; i < parts.size(); i++) {
+                delete parts[i];
+            }
+            parts.clear();
+            return false;
+        }
+
+        if(parts.empty()) {
+            return false;
+        }
+
+        m_split++;
+        m_parts += parts.size();
+        return true;
+    }
+
+    /**
+     * print how many polygons were split
+     */
+    void printStatistics() {
+        std::cerr << "split " << m_split << " large polygons into " << m_parts << " parts" << std::endl;
+    }
+};
+
+#endif // IMPORTER_POLYGONSPLITTER_HPP
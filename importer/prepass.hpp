@@ -0,0 +1,265 @@
+/**
+ * Some import options need information from a later part of the input
+ * file while the nodes are read, for example which nodes are referenced
+ * by any way. The input file is sorted by type, so this information is
+ * collected by reading the file once before the actual import, using the
+ * PrepassHandler.
+ *
+ * When the import is restricted to a region, a multipolygon crossing the
+ * border of the region needs all of its member ways, also those outside
+ * of it, or its rings can't be closed. Which ways these are is only known
+ * after the relations, so the ways are read a second time to add them and
+ * their nodes to the region.
+ */
+
+#ifndef IMPORTER_PREPASS_HPP
+#define IMPORTER_PREPASS_HPP
+
+#include "idset.hpp"
+#include "polygonidentifyer.hpp"
+#include "region.hpp"
+
+/**
+ * Collects information needed during the import in a first pass over
+ * the input file
+ */
+class PrepassHandler : public Osmium::Handler::Base {
+private:
+    /**
+     * set of all nodes referenced by any version of any way or NULL, if
+     * this information is not needed
+     */
+    IdSet *m_referencedNodes;
+
+    /**
+     * set of all ways that are members of any version of any multipolygon
+     * relation or NULL, if this information is not needed
+     */
+    IdSet *m_multipolygonMembers;
+
+    /**
+     * the region the import is restricted to or NULL, and the sets of the
+     * nodes and ways belonging to it
+     */
+    const Region *m_region;
+    IdSet *m_regionNodes, *m_regionWays;
+
+    /**
+     * nodes with any version inside of the region
+     */
+    IdSet m_insideNodes;
+
+    /**
+     * the nodes referenced by the versions of the current way, added to the
+     * region nodes once it is known if any version touches the region
+     */
+    osm_object_id_t m_wayId;
+    std::vector<osm_object_id_t> m_wayNodes;
+
+    /**
+     * the way members of the versions of the current multipolygon relation
+     * and if any of them belongs to the region
+     */
+    osm_object_id_t m_relationId;
+    std::vector<osm_object_id_t> m_relationWays;
+    bool m_relationInRegion;
+
+    /**
+     * the ways outside of the region which are members of a multipolygon
+     * crossing its border, added to the region in the second pass
+     */
+    IdSet m_borderMembers;
+
+    /**
+     * is the file read for the second time?
+     */
+    bool m_secondPass;
+
+    /**
+     * if the versions of the last way belong to the region, add all nodes
+     * referenced by them to the region nodes
+     */
+    void flushWayNodes() {
+        if(m_regionWays->test(m_wayId)) {
+            for(size_t i = 0; i < m_wayNodes.size(); i++) {
+                m_regionNodes->set(m_wayNodes[i]);
+            }
+        }
+        m_wayNodes.clear();
+    }
+
+    /**
+     * if any version of the last multipolygon relation has a member in the
+     * region, remember its members outside of the region
+     */
+    void flushRelationWays() {
+        if(m_relationInRegion) {
+            for(size_t i = 0; i < m_relationWays.size(); i++) {
+                if(!m_regionWays->test(m_relationWays[i])) {
+                    m_borderMembers.set(m_relationWays[i]);
+                }
+            }
+        }
+        m_relationWays.clear();
+        m_relationInRegion = false;
+    }
+
+public:
+    PrepassHandler() : m_referencedNodes(NULL), m_multipolygonMembers(NULL), m_region(NULL), m_regionNodes(NULL), m_regionWays(NULL), m_insideNodes(), m_wayId(-1), m_wayNodes(), m_relationId(-1), m_relationWays(), m_relationInRegion(false), m_borderMembers(), m_secondPass(false) {}
+
+    /**
+     * collect the ids of all nodes referenced by any way into the set
+     */
+    void collectReferencedNodes(IdSet *referencedNodes) {
+        m_referencedNodes = referencedNodes;
+    }
+
+    /**
+     * collect the ids of all ways that are members of a multipolygon
+     * relation into the set
+     */
+    void collectMultipolygonMembers(IdSet *multipolygonMembers) {
+        m_multipolygonMembers = multipolygonMembers;
+    }
+
+    /**
+     * collect the nodes and ways belonging to the region into the sets. a
+     * way belongs to the region if any version of it references a node
+     * that was inside of the region at any time, all nodes referenced by
+     * any version of such a way belong to it as well.
+     */
+    void collectRegion(const Region *region, IdSet *regionNodes, IdSet *regionWays) {
+        m_region = region;
+        m_regionNodes = regionNodes;
+        m_regionWays = regionWays;
+    }
+
+    /**
+     * does the file need to be read a second time, to add the members of
+     * multipolygons crossing the border of the region?
+     */
+    bool needsSecondPass() const {
+        return m_region && m_multipolygonMembers && m_borderMembers.size() > 0;
+    }
+
+    /**
+     * prepare reading the file a second time
+     */
+    void secondPass() {
+        m_secondPass = true;
+    }
+
+    void node(const shared_ptr<Osmium::OSM::Node const>& node) {
+        if(m_secondPass || !m_region || !node->visible() || !node->position().defined()) {
+            return;
+        }
+
+        if(m_region->contains(node->lon(), node->lat())) {
+            m_insideNodes.set(node->id());
+            m_regionNodes->set(node->id());
+        }
+    }
+
+    void after_nodes() {
+        if(m_region && !m_secondPass) {
+            std::cerr << "prepass: " << m_insideNodes.size() << " nodes lie inside of the region" << std::endl;
+        }
+    }
+
+    void way(const shared_ptr<Osmium::OSM::Way const>& way) {
+        if(m_secondPass) {
+            if(m_borderMembers.test(way->id())) {
+                m_regionWays->set(way->id());
+
+                Osmium::OSM::WayNodeList::const_iterator end = way->nodes().end();
+                for(Osmium::OSM::WayNodeList::const_iterator it = way->nodes().begin(); it != end; ++it) {
+                    m_regionNodes->set(it->ref());
+                }
+            }
+            return;
+        }
+
+        if(m_region) {
+            if(way->id() != m_wayId) {
+                flushWayNodes();
+                m_wayId = way->id();
+            }
+
+            Osmium::OSM::WayNodeList::const_iterator end = way->nodes().end();
+            for(Osmium::OSM::WayNodeList::const_iterator it = way->nodes().begin(); it != end; ++it) {
+                if(m_insideNodes.test(it->ref())) {
+                    m_regionWays->set(way->id());
+                }
+                m_wayNodes.push_back(it->ref());
+            }
+        }
+
+        if(m_referencedNodes) {
+            Osmium::OSM::WayNodeList::const_iterator end = way->nodes().end();
+            for(Osmium::OSM::WayNodeList::const_iterator it = way->nodes().begin(); it != end; ++it) {
+                m_referencedNodes->set(it->ref());
+            }
+        }
+    }
+
+    void after_ways() {
+        if(m_secondPass) {
+            m_borderMembers.clear();
+            std::cerr << "prepass: " << m_regionWays->size() << " ways and " << m_regionNodes->size() << " nodes belong to the region, including the members of multipolygons crossing its border" << std::endl;
+            throw Osmium::Handler::StopReading();
+        }
+
+        if(m_region) {
+            flushWayNodes();
+            m_insideNodes.clear();
+            std::cerr << "prepass: " << m_regionWays->size() << " ways and " << m_regionNodes->size() << " nodes belong to the region" << std::endl;
+        }
+
+        if(m_referencedNodes) {
+            std::cerr << "prepass: " << m_referencedNodes->size() << " nodes are referenced by ways (" << (m_referencedNodes->memory() >> 10) << " kB)" << std::endl;
+        }
+
+        // the relations are only needed for the multipolygons
+        if(!m_multipolygonMembers) {
+            throw Osmium::Handler::StopReading();
+        }
+    }
+
+    void relation(const shared_ptr<Osmium::OSM::Relation const>& relation) {
+        if(!m_multipolygonMembers || !PolygonIdentifyer::isMultipolygon(relation->tags())) {
+            return;
+        }
+
+        if(m_region && relation->id() != m_relationId) {
+            flushRelationWays();
+            m_relationId = relation->id();
+        }
+
+        Osmium::OSM::RelationMemberList::const_iterator end = relation->members().end();
+        for(Osmium::OSM::RelationMemberList::const_iterator it = relation->members().begin(); it != end; ++it) {
+            if(it->type() == 'w') {
+                m_multipolygonMembers->set(it->ref());
+
+                if(m_region) {
+                    m_relationWays.push_back(it->ref());
+                    if(m_regionWays->test(it->ref())) {
+                        m_relationInRegion = true;
+                    }
+                }
+            }
+        }
+    }
+
+    void after_relations() {
+        if(m_region && m_multipolygonMembers) {
+            flushRelationWays();
+            std::cerr << "prepass: " << m_borderMembers.size() << " ways outside of the region are members of multipolygons crossing its border" << std::endl;
+        }
+
+        if(m_multipolygonMembers) {
+            std::cerr << "prepass: " << m_multipolygonMembers->size() << " ways are members of multipolygon relations (" << (m_multipolygonMembers->memory() >> 10) << " kB)" << std::endl;
+        }
+    }
+};
+
+#endif // IMPORTER_PREPASS_HPP
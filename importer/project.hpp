@@ -1,49 +1,115 @@
+/**
+ * All geometries are stored in spherical mercator (EPSG:900913). This is
+ * a closed-form projection, so instead of passing each coordinate through
+ * proj4's generic datum machinery, the formulas are evaluated directly:
+ *
+ *   x = R * lon
+ *   y = R * ln(tan(pi/4 + lat/2))
+ *
+ * with lon and lat in radians and R = 6378137 m. The results equal the
+ * output of pj_transform with the former 900913 definition up to the
+ * rounding of the last bits.
+ *
+ * The inverse is used to write the lon/lat tables next to the mercator
+ * ones from the same geometries.
+ *
+ * Whole coordinate arrays can be projected at once. The kernel of that
+ * loop has no branches and no calls other than tan and log, so the
+ * compiler can vectorize it when the math library provides vector
+ * versions of them.
+ */
+
 #ifndef IMPORTER_PROJECT_HPP
 #define IMPORTER_PROJECT_HPP
 
-#include <proj_api.h>
+#include <cmath>
+#include <limits>
 
 class Project {
 private:
-    projPJ pj_900913, pj_4326;
+    /**
+     * radius of the sphere used by spherical mercator
+     */
+    static double radius() {
+        return 6378137.0;
+    }
+
+    /**
+     * factor converting degrees to radians
+     */
+    static double degToRad() {
+        return M_PI / 180.0;
+    }
 
-    Project() {
-        //if(!(pj_900913 = pj_init_plus("+init=epsg:900913"))) {
-        if(!(pj_900913 = pj_init_plus("+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +no_defs"))) {
-            throw std::runtime_error("can't initialize proj4 with 900913");
+    /**
+     * check a lon/lat pair the same way proj4 did: latitudes at or beyond
+     * the poles and longitudes further then 10 radians from the meridian
+     * can't be projected. longitudes beyond the antimeridian are wrapped
+     * around. returns false if the coordinate can't be projected.
+     */
+    static bool check(double *lon, double *lat) {
+        if(!(fabs(*lat) * degToRad() < M_PI_2 - 1e-10) || !(fabs(*lon) * degToRad() <= 10.0)) {
+            std::cerr << "error transforming POINT(" << *lon << " " << *lat << ") from 4326 to 900913)" << std::endl;
+            return false;
         }
-        if(!(pj_4326 = pj_init_plus("+init=epsg:4326"))) {
-            throw std::runtime_error("can't initialize proj4 with 4326");
+
+        if(fabs(*lon) > 180.0) {
+            *lon -= 360.0 * floor((*lon + 180.0) / 360.0);
         }
-    }
 
-    virtual ~Project() {
-        pj_free(pj_900913);
-        pj_free(pj_4326);
+        return true;
     }
 
-    static Project& instance() {
-        static Project the_instance;
-        return the_instance;
-    }
-    
-    bool _toMercator(double *lon, double *lat) {
-        double inlon = *lon, inlat = *lat;
-        *lon *= DEG_TO_RAD;
-        *lat *= DEG_TO_RAD;
-
-        int r = pj_transform(pj_4326, pj_900913, 1, 1, lon, lat, NULL);
-        if(r != 0) {
-            std::cerr << "error transforming POINT(" << inlon << " " << inlat << ") from 4326 to 900913)" << std::endl;
+public:
+    /**
+     * project a single coordinate from lon/lat to mercator in place. if the
+     * coordinate can't be projected, an error is printed, it is set to 0/0
+     * and false is returned.
+     */
+    static bool toMercator(double *lon, double *lat) {
+        if(!check(lon, lat)) {
             *lon = *lat = 0;
             return false;
         }
+
+        *lon = radius() * degToRad() * *lon;
+        *lat = radius() * log(tan(M_PI_4 + degToRad() / 2 * *lat));
         return true;
     }
 
-public:
-    static bool toMercator(double *lon, double *lat) {
-        return Project::instance()._toMercator(lon, lat);
+    /**
+     * project count coordinates from lon/lat to mercator in place. for each
+     * coordinate that can't be projected an error is printed and it is set
+     * to NaN/NaN. returns the number of those coordinates.
+     */
+    static size_t toMercator(double *lon, double *lat, size_t count) {
+        size_t errors = 0;
+
+        // catch the (rare) invalid coordinates first, so the kernel below
+        // can run without branches
+        for(size_t i = 0; i < count; i++) {
+            if(!check(&lon[i], &lat[i])) {
+                lon[i] = lat[i] = std::numeric_limits<double>::quiet_NaN();
+                errors++;
+            }
+        }
+
+        const double xscale = radius() * degToRad();
+        const double yscale = degToRad() / 2;
+        for(size_t i = 0; i < count; i++) {
+            lon[i] = xscale * lon[i];
+            lat[i] = radius() * log(tan(M_PI_4 + yscale * lat[i]));
+        }
+
+        return errors;
+    }
+
+    /**
+     * project a single coordinate from mercator back to lon/lat in place
+     */
+    static void toLatLng(double *x, double *y) {
+        *x = *x / radius() / degToRad();
+        *y = (2 * atan(exp(*y / radius())) - M_PI_2) / degToRad();
     }
 };
 
@@ -0,0 +1,191 @@
+/**
+ * To render one city out of a country sized history file, the importer
+ * can restrict itself to a region given as a bounding box or as a polygon
+ * file in the osmosis polygon format. Which nodes and ways belong to the
+ * region is decided in the prepass, the Region only answers if a position
+ * lies inside of it.
+ *
+ * A polygon file contains a name, followed by one or more sections of
+ * lon/lat pairs, each ended by END. Sections with a name starting with !
+ * are holes. The file itself is ended by another END.
+ */
+
+#ifndef IMPORTER_REGION_HPP
+#define IMPORTER_REGION_HPP
+
+#include <fstream>
+
+/**
+ * A bounding box or polygon in lon/lat
+ */
+class Region {
+private:
+    /**
+     * a ring of the polygon
+     */
+    struct Ring {
+        std::vector<double> lon, lat;
+        bool hole;
+    };
+
+    std::vector<Ring> m_rings;
+
+    /**
+     * the bounding box of the region, which is all of it if there are
+     * no rings
+     */
+    double m_minlon, m_minlat, m_maxlon, m_maxlat;
+
+    /**
+     * is the position inside of the ring? (crossing number test)
+     */
+    static bool inside(const Ring& ring, double lon, double lat) {
+        bool in = false;
+        for(size_t i = 0, j = ring.lon.size() - 1; i < ring.lon.size(); j = i++) {
+            if((ring.lat[i] > lat) != (ring.lat[j] > lat) &&
+                    lon < (ring.lon[j] - ring.lon[i]) * (lat - ring.lat[i]) / (ring.lat[j] - ring.lat[i]) + ring.lon[i]) {
+                in = !in;
+            }
+        }
+        return in;
+    }
+
+public:
+    Region() : m_rings(), m_minlon(-180), m_minlat(-90), m_maxlon(180), m_maxlat(90) {}
+
+    /**
+     * set the region to a bounding box given as minlon,minlat,maxlon,maxlat.
+     * returns false if the box can't be parsed.
+     */
+    bool parseBbox(const std::string& bbox) {
+        double minlon, minlat, maxlon, maxlat;
+        char c1, c2, c3, rest;
+        if(sscanf(bbox.c_str(), "%lf%c%lf%c%lf%c%lf%c", &minlon, &c1, &minlat, &c2, &maxlon, &c3, &maxlat, &rest) != 7 || c1 != ',' || c2 != ',' || c3 != ',') {
+            return false;
+        }
+
+        if(minlon >= maxlon || minlat >= maxlat) {
+            return false;
+        }
+
+        m_rings.clear();
+        m_minlon = minlon;
+        m_minlat = minlat;
+        m_maxlon = maxlon;
+        m_maxlat = maxlat;
+        return true;
+    }
+
+    /**
+     * set the region to the polygon read from a file in the osmosis polygon
+     * format. returns false if the file can't be read or parsed.
+     */
+    bool readPoly(const std::string& filename) {
+        std::ifstream file(filename.c_str());
+        if(!file) {
+            return false;
+        }
+
+        std::vector<Ring> rings;
+        std::string line;
+
+        // the name of the polygon
+        if(!std::getline(file, line)) {
+            return false;
+        }
+
+        while(std::getline(file, line)) {
+            std::istringstream name(line);
+            std::string section;
+            name >> section;
+
+            if(section == "END") {
+                break;
+            }
+
+            if(section.empty()) {
+                continue;
+            }
+
+            Ring ring;
+            ring.hole = (section[0] == '!');
+
+            bool ended = false;
+            while(std::getline(file, line)) {
+                std::istringstream coords(line);
+                std::string first;
+                coords >> first;
+
+                if(first == "END") {
+                    ended = true;
+                    break;
+                }
+
+                if(first.empty()) {
+                    continue;
+                }
+
+                double lon, lat;
+                std::istringstream lonstream(first);
+                if(!(lonstream >> lon) || !(coords >> lat)) {
+                    return false;
+                }
+
+                ring.lon.push_back(lon);
+                ring.lat.push_back(lat);
+            }
+
+            if(!ended || ring.lon.size() < 3) {
+                return false;
+            }
+
+            rings.push_back(ring);
+        }
+
+        if(rings.empty()) {
+            return false;
+        }
+
+        m_rings = rings;
+        m_minlon = m_minlat = 1000;
+        m_maxlon = m_maxlat = -1000;
+        for(size_t r = 0; r < m_rings.size(); r++) {
+            if(m_rings[r].hole) {
+                continue;
+            }
+
+            m_minlon = std::min(m_minlon, *std::min_element(m_rings[r].lon.begin(), m_rings[r].lon.end()));
+            m_maxlon = std::max(m_maxlon, *std::max_element(m_rings[r].lon.begin(), m_rings[r].lon.end()));
+            m_minlat = std::min(m_minlat, *std::min_element(m_rings[r].lat.begin(), m_rings[r].lat.end()));
+            m_maxlat = std::max(m_maxlat, *std::max_element(m_rings[r].lat.begin(), m_rings[r].lat.end()));
+        }
+        return true;
+    }
+
+    /**
+     * is the position inside of the region?
+     */
+    bool contains(double lon, double lat) const {
+        if(lon < m_minlon || lon > m_maxlon || lat < m_minlat || lat > m_maxlat) {
+            return false;
+        }
+
+        if(m_rings.empty()) {
+            return true;
+        }
+
+        // inside of an outer ring and not inside of a hole
+        bool in = false;
+        for(size_t r = 0; r < m_rings.size(); r++) {
+            if(inside(m_rings[r], lon, lat)) {
+                if(m_rings[r].hole) {
+                    return false;
+                }
+                in = true;
+            }
+        }
+        return in;
+    }
+};
+
+#endif // IMPORTER_REGION_HPP
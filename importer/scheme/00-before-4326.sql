@@ -0,0 +1,141 @@
+-- the tables written with --latlng-tables, the same as the ones in
+-- 00-before.sql but with lat/lng geometries. requires hstore_new, postgis
+
+DROP TABLE IF EXISTS hist_point_4326 CASCADE;
+CREATE TABLE hist_point_4326 (
+    id bigint,
+    version smallint,
+    visible boolean,
+    user_id integer,
+    user_name text,
+    valid_from timestamp without time zone,
+    valid_to timestamp without time zone,
+    tags hstore
+);
+SELECT AddGeometryColumn(
+    -- table name
+    'hist_point_4326',
+
+    -- column name
+    'geom',
+
+    -- SRID (4326 = WGS84 lat/lng)
+    4326,
+
+    -- type
+    'POINT',
+
+    -- dimensions
+    2
+);
+
+
+DROP TABLE IF EXISTS hist_line_4326 CASCADE;
+CREATE TABLE hist_line_4326 (
+    id bigint,
+    version smallint,
+    minor smallint,
+    visible boolean,
+    user_id integer,
+    user_name text,
+    valid_from timestamp without time zone,
+    valid_to timestamp without time zone,
+    tags hstore,
+    z_order integer
+);
+SELECT AddGeometryColumn(
+    -- table name
+    'hist_line_4326',
+
+    -- column name
+    'geom',
+
+    -- SRID (4326 = WGS84 lat/lng)
+    4326,
+
+    -- type
+    'LINESTRING',
+
+    -- dimensions
+    2
+);
+
+
+DROP TABLE IF EXISTS hist_roads_4326 CASCADE;
+CREATE TABLE hist_roads_4326 (
+    id bigint,
+    version smallint,
+    minor smallint,
+    visible boolean,
+    user_id integer,
+    user_name text,
+    valid_from timestamp without time zone,
+    valid_to timestamp without time zone,
+    tags hstore,
+    z_order integer
+);
+SELECT AddGeometryColumn(
+    -- table name
+    'hist_roads_4326',
+
+    -- column name
+    'geom',
+
+    -- SRID (4326 = WGS84 lat/lng)
+    4326,
+
+    -- type
+    'LINESTRING',
+
+    -- dimensions
+    2
+);
+
+
+DROP TABLE IF EXISTS hist_polygon_4326 CASCADE;
+CREATE TABLE hist_polygon_4326 (
+    id bigint,
+    version smallint,
+    minor smallint,
+    visible boolean,
+    user_id integer,
+    user_name text,
+    valid_from timestamp without time zone,
+    valid_to timestamp without time zone,
+    tags hstore,
+    z_order integer,
+    area real,
+    part smallint
+);
+SELECT AddGeometryColumn(
+    -- table name
+    'hist_polygon_4326',
+
+    -- column name
+    'geom',
+
+    -- SRID (4326 = WGS84 lat/lng)
+    4326,
+
+    -- type
+    'POLYGON',
+
+    -- dimensions
+    2
+);
+SELECT AddGeometryColumn(
+    -- table name
+    'hist_polygon_4326',
+
+    -- column name
+    'center',
+
+    -- SRID (4326 = WGS84 lat/lng)
+    4326,
+
+    -- type
+    'POINT',
+
+    -- dimensions
+    2
+);
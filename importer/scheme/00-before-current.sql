@@ -0,0 +1,106 @@
+-- the live state written with --current-tables: the versions which are
+-- still valid, in tables with the columns of an osm2pgsql database (with
+-- --hstore). requires hstore_new, postgis
+
+DROP TABLE IF EXISTS hist_current_point CASCADE;
+CREATE TABLE hist_current_point (
+    osm_id bigint,
+    tags hstore
+);
+SELECT AddGeometryColumn(
+    -- table name
+    'hist_current_point',
+
+    -- column name
+    'way',
+
+    -- SRID (900913 = Spherical Mercator)
+    900913,
+
+    -- type
+    'POINT',
+
+    -- dimensions
+    2
+);
+
+
+DROP TABLE IF EXISTS hist_current_line CASCADE;
+CREATE TABLE hist_current_line (
+    osm_id bigint,
+    tags hstore,
+    z_order integer
+);
+SELECT AddGeometryColumn(
+    -- table name
+    'hist_current_line',
+
+    -- column name
+    'way',
+
+    -- SRID (900913 = Spherical Mercator)
+    900913,
+
+    -- type
+    'LINESTRING',
+
+    -- dimensions
+    2
+);
+
+
+DROP TABLE IF EXISTS hist_current_roads CASCADE;
+CREATE TABLE hist_current_roads (
+    osm_id bigint,
+    tags hstore,
+    z_order integer
+);
+SELECT AddGeometryColumn(
+    -- table name
+    'hist_current_roads',
+
+    -- column name
+    'way',
+
+    -- SRID (900913 = Spherical Mercator)
+    900913,
+
+    -- type
+    'LINESTRING',
+
+    -- dimensions
+    2
+);
+
+
+DROP TABLE IF EXISTS hist_current_polygon CASCADE;
+CREATE TABLE hist_current_polygon (
+    osm_id bigint,
+    tags hstore,
+    z_order integer,
+    way_area real
+);
+SELECT AddGeometryColumn(
+    -- table name
+    'hist_current_polygon',
+
+    -- column name
+    'way',
+
+    -- SRID (900913 = Spherical Mercator)
+    900913,
+
+    -- type
+    'POLYGON',
+
+    -- dimensions
+    2
+);
+
+
+-- the time of the last change in the imported data, the current tables
+-- show the state at any later date
+DROP TABLE IF EXISTS hist_current_meta;
+CREATE TABLE hist_current_meta (
+    last_timestamp timestamp without time zone
+);
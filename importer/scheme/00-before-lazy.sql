@@ -0,0 +1,34 @@
+-- the ways written with --lazy, instead of hist_line, hist_roads and
+-- hist_polygon. requires 00-before.sql
+
+DROP TABLE IF EXISTS hist_way CASCADE;
+CREATE TABLE hist_way (
+    id bigint,
+    version smallint,
+    visible boolean,
+    user_id integer,
+    user_name text,
+    valid_from timestamp without time zone,
+    valid_to timestamp without time zone,
+    tags hstore,
+    z_order integer,
+    polygon boolean,
+    nodes bigint[]
+);
+SELECT AddGeometryColumn(
+    -- table name
+    'hist_way',
+
+    -- column name (the bounding box of all node positions while the
+    -- version was valid)
+    'bbox',
+
+    -- SRID (900913 = Spherical Mercator)
+    900913,
+
+    -- type
+    'POLYGON',
+
+    -- dimensions
+    2
+);
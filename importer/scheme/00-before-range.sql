@@ -0,0 +1,8 @@
+-- the validity as a tsrange column [valid_from, valid_to), written with
+-- --validity-range. an open range means the version is still valid, a
+-- deleted version has an empty range. requires PostgreSQL 9.2
+
+ALTER TABLE hist_point ADD COLUMN validity tsrange;
+ALTER TABLE hist_line ADD COLUMN validity tsrange;
+ALTER TABLE hist_roads ADD COLUMN validity tsrange;
+ALTER TABLE hist_polygon ADD COLUMN validity tsrange;
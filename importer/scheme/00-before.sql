@@ -60,6 +60,39 @@ SELECT AddGeometryColumn(
 );
 
 
+-- major roads, railways and administrative boundaries for rendering
+-- at low zoom levels, a subset of hist_line (osm2pgsql calls it roads)
+DROP TABLE IF EXISTS hist_roads CASCADE;
+CREATE TABLE hist_roads (
+    id bigint,
+    version smallint,
+    minor smallint,
+    visible boolean,
+    user_id integer,
+    user_name text,
+    valid_from timestamp without time zone,
+    valid_to timestamp without time zone,
+    tags hstore,
+    z_order integer
+);
+SELECT AddGeometryColumn(
+    -- table name
+    'hist_roads',
+
+    -- column name
+    'geom',
+
+    -- SRID (900913 = Spherical Mercator)
+    900913,
+
+    -- type
+    'LINESTRING',
+
+    -- dimensions
+    2
+);
+
+
 DROP TABLE IF EXISTS hist_polygon CASCADE;
 CREATE TABLE hist_polygon (
     id bigint,
@@ -72,7 +105,8 @@ CREATE TABLE hist_polygon (
     valid_to timestamp without time zone,
     tags hstore,
     z_order integer,
-    area real
+    area real,
+    part smallint
 );
 SELECT AddGeometryColumn(
     -- table name
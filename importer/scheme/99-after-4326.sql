@@ -0,0 +1,11 @@
+ALTER TABLE hist_point_4326 ADD PRIMARY KEY (id, version);
+CREATE INDEX hist_point_4326_geom_and_time_index ON hist_point_4326 USING GIST (geom, valid_from, valid_to);
+
+ALTER TABLE hist_line_4326 ADD PRIMARY KEY (id, version, minor);
+CREATE INDEX hist_line_4326_geom_and_time_index ON hist_line_4326 USING GIST (geom, valid_from, valid_to);
+
+ALTER TABLE hist_roads_4326 ADD PRIMARY KEY (id, version, minor);
+CREATE INDEX hist_roads_4326_geom_and_time_index ON hist_roads_4326 USING GIST (geom, valid_from, valid_to);
+
+ALTER TABLE hist_polygon_4326 ADD PRIMARY KEY (id, version, minor, part);
+CREATE INDEX hist_polygon_4326_geom_and_time_index ON hist_polygon_4326 USING GIST (geom, valid_from, valid_to);
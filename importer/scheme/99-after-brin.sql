@@ -0,0 +1,15 @@
+-- BRIN indexes instead of the GiST indexes of 99-after.sql, used with --index brin.
+-- they are much smaller and faster to build, but only useful when the rows are
+-- clustered (--cluster hilbert). needs PostgreSQL 9.5 and PostGIS 2.3 or later.
+
+ALTER TABLE hist_point ADD PRIMARY KEY (id, version);
+CREATE INDEX hist_point_geom_and_time_index ON hist_point USING BRIN (geom, valid_from, valid_to);
+
+ALTER TABLE hist_line ADD PRIMARY KEY (id, version, minor);
+CREATE INDEX hist_line_geom_and_time_index ON hist_line USING BRIN (geom, valid_from, valid_to);
+
+ALTER TABLE hist_roads ADD PRIMARY KEY (id, version, minor);
+CREATE INDEX hist_roads_geom_and_time_index ON hist_roads USING BRIN (geom, valid_from, valid_to);
+
+ALTER TABLE hist_polygon ADD PRIMARY KEY (id, version, minor, part);
+CREATE INDEX hist_polygon_geom_and_time_index ON hist_polygon USING BRIN (geom, valid_from, valid_to);
@@ -0,0 +1,9 @@
+CREATE INDEX hist_current_point_index ON hist_current_point USING GIST (way);
+CREATE INDEX hist_current_line_index ON hist_current_line USING GIST (way);
+CREATE INDEX hist_current_roads_index ON hist_current_roads USING GIST (way);
+CREATE INDEX hist_current_polygon_index ON hist_current_polygon USING GIST (way);
+
+ANALYZE hist_current_point;
+ANALYZE hist_current_line;
+ANALYZE hist_current_roads;
+ANALYZE hist_current_polygon;
@@ -0,0 +1,49 @@
+ALTER TABLE hist_way ADD PRIMARY KEY (id, version);
+CREATE INDEX hist_way_bbox_and_time_index ON hist_way USING GIST (bbox, valid_from, valid_to);
+
+-- the geometries are assembled from the node versions valid at a time
+CREATE INDEX hist_point_id_and_time_index ON hist_point (id, valid_from);
+
+-- the geometries of all ways visible at a point in time whose bounding box
+-- intersects the given one. closed ways that look like polygons are
+-- returned as polygons, all others as linestrings. like the nodestore of
+-- the importer, each node is placed at its last visible position at that
+-- time, or at its first visible position if the way is older then the node.
+CREATE OR REPLACE FUNCTION hist_way_geometries(geometry, timestamp without time zone)
+RETURNS TABLE(
+    id bigint,
+    version smallint,
+    user_id integer,
+    user_name text,
+    valid_from timestamp without time zone,
+    valid_to timestamp without time zone,
+    tags hstore,
+    z_order integer,
+    geom geometry
+) AS $$
+    SELECT id, version, user_id, user_name, valid_from, valid_to, tags, z_order,
+        CASE WHEN polygon AND ST_IsClosed(line) AND ST_NPoints(line) >= 4 THEN ST_MakePolygon(line) ELSE line END
+    FROM (
+        SELECT w.id, w.version, w.user_id, w.user_name, w.valid_from, w.valid_to, w.tags, w.z_order, w.polygon,
+            ST_MakeLine(ARRAY(
+                SELECT g FROM (
+                    SELECT i, COALESCE((
+                        SELECT p.geom FROM hist_point p
+                        WHERE p.id = w.nodes[i] AND p.visible AND p.valid_from <= $2
+                        ORDER BY p.valid_from DESC LIMIT 1
+                    ), (
+                        SELECT p.geom FROM hist_point p
+                        WHERE p.id = w.nodes[i] AND p.visible
+                        ORDER BY p.valid_from LIMIT 1
+                    )) AS g
+                    FROM generate_subscripts(w.nodes, 1) AS i
+                ) AS n
+                WHERE g IS NOT NULL
+                ORDER BY i
+            )) AS line
+        FROM hist_way w
+        WHERE w.visible AND w.bbox && $1
+            AND w.valid_from <= $2 AND (w.valid_to IS NULL OR w.valid_to > $2)
+    ) AS ways
+    WHERE line IS NOT NULL AND ST_NPoints(line) >= 2;
+$$ LANGUAGE SQL STABLE;
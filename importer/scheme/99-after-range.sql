@@ -0,0 +1,8 @@
+-- the range and the geometry in one GiST index, for views querying
+-- validity @> timestamp. range types bring their own GiST operator
+-- class, so this does not need btree_gist.
+
+CREATE INDEX hist_point_geom_and_validity_index ON hist_point USING GIST (geom, validity);
+CREATE INDEX hist_line_geom_and_validity_index ON hist_line USING GIST (geom, validity);
+CREATE INDEX hist_roads_geom_and_validity_index ON hist_roads USING GIST (geom, validity);
+CREATE INDEX hist_polygon_geom_and_validity_index ON hist_polygon USING GIST (geom, validity);
@@ -4,5 +4,8 @@ CREATE INDEX hist_point_geom_and_time_index ON hist_point USING GIST (geom, vali
 ALTER TABLE hist_line ADD PRIMARY KEY (id, version, minor);
 CREATE INDEX hist_line_geom_and_time_index ON hist_line USING GIST (geom, valid_from, valid_to);
 
-ALTER TABLE hist_polygon ADD PRIMARY KEY (id, version, minor);
+ALTER TABLE hist_roads ADD PRIMARY KEY (id, version, minor);
+CREATE INDEX hist_roads_geom_and_time_index ON hist_roads USING GIST (geom, valid_from, valid_to);
+
+ALTER TABLE hist_polygon ADD PRIMARY KEY (id, version, minor, part);
 CREATE INDEX hist_polygon_geom_and_time_index ON hist_polygon USING GIST (geom, valid_from, valid_to);
@@ -1,3 +1,51 @@
+-- partitions written with --partition, which need to be dropped before
+-- the tables they inherit from
+DO $$
+DECLARE t record;
+BEGIN
+    FOR t IN SELECT tablename FROM pg_tables WHERE schemaname = 'public' AND tablename ~ '^hist_(point|line|roads|polygon)_y[0-9]+$' LOOP
+        PERFORM DropGeometryTable(t.tablename::varchar);
+    END LOOP;
+END$$;
+
 SELECT DropGeometryTable('hist_point');
 SELECT DropGeometryTable('hist_line');
+SELECT DropGeometryTable('hist_roads');
 SELECT DropGeometryTable('hist_polygon');
+
+-- generalized tables written with --generalize
+DO $$
+DECLARE t record;
+BEGIN
+    FOR t IN SELECT tablename FROM pg_tables WHERE schemaname = 'public' AND tablename ~ '^hist_(line|roads|polygon)_z[0-9]+$' LOOP
+        PERFORM DropGeometryTable(t.tablename::varchar);
+    END LOOP;
+END$$;
+
+-- the way-table and function written with --lazy
+DO $$
+BEGIN
+    IF EXISTS (SELECT 1 FROM pg_tables WHERE schemaname = 'public' AND tablename = 'hist_way') THEN
+        PERFORM DropGeometryTable('hist_way');
+    END IF;
+END$$;
+DROP FUNCTION IF EXISTS hist_way_geometries(geometry, timestamp without time zone);
+
+-- lat/lng tables written with --latlng-tables
+DO $$
+DECLARE t record;
+BEGIN
+    FOR t IN SELECT tablename FROM pg_tables WHERE schemaname = 'public' AND tablename IN ('hist_point_4326', 'hist_line_4326', 'hist_roads_4326', 'hist_polygon_4326') LOOP
+        PERFORM DropGeometryTable(t.tablename::varchar);
+    END LOOP;
+END$$;
+
+-- current tables written with --current-tables
+DO $$
+DECLARE t record;
+BEGIN
+    FOR t IN SELECT tablename FROM pg_tables WHERE schemaname = 'public' AND tablename IN ('hist_current_point', 'hist_current_line', 'hist_current_roads', 'hist_current_polygon') LOOP
+        PERFORM DropGeometryTable(t.tablename::varchar);
+    END LOOP;
+END$$;
+DROP TABLE IF EXISTS hist_current_meta;
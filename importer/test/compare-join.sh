@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# import each of the test files with the sparse nodestore and with the
+# external join and compare the resulting tables, which need to be identical
+#
+# usage: test/compare-join.sh DSN
+# run from the importer directory, the tables with the prefix hist_ in the
+# database are overwritten.
+#
+
+DSN="$1"
+if [ -z "$DSN" ]; then
+	echo "usage: $0 DSN"
+	exit 1
+fi
+
+OUT=`mktemp -d`
+trap 'rm -rf "$OUT"' EXIT
+
+# dump the tables of the last import, sorted by their primary keys
+dump() {
+	psql -q -A -t -d "$DSN" -c "COPY (SELECT * FROM hist_point ORDER BY id, version) TO STDOUT" >"$1.point" &&
+	psql -q -A -t -d "$DSN" -c "COPY (SELECT * FROM hist_line ORDER BY id, version, minor) TO STDOUT" >"$1.line" &&
+	psql -q -A -t -d "$DSN" -c "COPY (SELECT * FROM hist_roads ORDER BY id, version, minor) TO STDOUT" >"$1.roads" &&
+	psql -q -A -t -d "$DSN" -c "COPY (SELECT * FROM hist_polygon ORDER BY id, version, minor, part) TO STDOUT" >"$1.polygon"
+}
+
+FAILED=0
+for FILE in test/*.osh; do
+	NAME=`basename "$FILE" .osh`
+
+	./osm-history-importer --dsn "$DSN" --nodestore sparse "$FILE" >/dev/null 2>&1 &&
+		dump "$OUT/$NAME.sparse" &&
+	./osm-history-importer --dsn "$DSN" --join external "$FILE" >/dev/null 2>&1 &&
+		dump "$OUT/$NAME.external"
+
+	if [ $? -ne 0 ]; then
+		echo "$NAME: import failed"
+		FAILED=1
+		continue
+	fi
+
+	SAME=1
+	for TABLE in point line roads polygon; do
+		if ! cmp -s "$OUT/$NAME.sparse.$TABLE" "$OUT/$NAME.external.$TABLE"; then
+			echo "$NAME: hist_$TABLE differs"
+			diff "$OUT/$NAME.sparse.$TABLE" "$OUT/$NAME.external.$TABLE" | head -n 10
+			SAME=0
+			FAILED=1
+		fi
+	done
+
+	if [ $SAME -eq 1 ]; then
+		echo "$NAME: identical"
+	fi
+done
+
+exit $FAILED
@@ -0,0 +1,115 @@
+/**
+ * compares the closed-form projection of project.hpp with the output of
+ * proj4 for the former 900913 definition on a fixed grid of coordinates.
+ *
+ * the scalar and the batch path of Project::toMercator need to be within
+ * 1 micrometer of proj4, Project::toLatLng within 1e-9 degree of the
+ * inverse. coordinates proj4 rejects (at and beyond the poles, more than
+ * 10 radians from the meridian) need to be rejected as well: the scalar
+ * path returns false and sets them to 0/0, the batch path marks them with
+ * NaN/NaN.
+ *
+ * build and run with `make test-project`
+ */
+
+#include <iostream>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+#include <stdexcept>
+
+#include <proj_api.h>
+
+#include "../project.hpp"
+
+/**
+ * allowed difference to proj4 in meters and in degrees
+ */
+static const double MERCATOR_TOLERANCE = 1e-6;
+static const double LATLNG_TOLERANCE = 1e-9;
+
+static int failures = 0;
+
+static void fail(const char *what, double lon, double lat, double expected, double got) {
+    fprintf(stderr, "FAIL %s at %.10g/%.10g: expected %.10f, got %.10f\n", what, lon, lat, expected, got);
+    failures++;
+}
+
+int main() {
+    projPJ pj_900913 = pj_init_plus("+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +no_defs");
+    projPJ pj_4326 = pj_init_plus("+init=epsg:4326");
+    if(!pj_900913 || !pj_4326) {
+        std::cerr << "can't initialize proj4" << std::endl;
+        return 1;
+    }
+
+    // the grid, including longitudes beyond the antimeridian, which are
+    // wrapped, and coordinates which can't be projected
+    std::vector<double> lons, lats;
+    for(double lon = -200; lon <= 200; lon += 7.5) {
+        for(double lat = -89.5; lat <= 89.5; lat += 2.5) {
+            lons.push_back(lon);
+            lats.push_back(lat);
+        }
+        lons.push_back(lon); lats.push_back(89.99);
+        lons.push_back(lon); lats.push_back(90);
+        lons.push_back(lon); lats.push_back(-90);
+        lons.push_back(lon); lats.push_back(95);
+    }
+    lons.push_back(600); lats.push_back(10);
+    lons.push_back(-600); lats.push_back(-10);
+
+    std::vector<double> batchLon(lons), batchLat(lats);
+    size_t batchErrors = Project::toMercator(&batchLon[0], &batchLat[0], lons.size());
+
+    size_t expectedErrors = 0;
+    for(size_t i = 0; i < lons.size(); i++) {
+        double refX = lons[i] * DEG_TO_RAD, refY = lats[i] * DEG_TO_RAD;
+        bool refValid = (pj_transform(pj_4326, pj_900913, 1, 1, &refX, &refY, NULL) == 0) && !std::isinf(refY);
+
+        double x = lons[i], y = lats[i];
+        bool valid = Project::toMercator(&x, &y);
+
+        if(!refValid) {
+            expectedErrors++;
+            if(valid || x != 0 || y != 0) {
+                fail("scalar rejection", lons[i], lats[i], 0, y);
+            }
+            if(!std::isnan(batchLon[i]) || !std::isnan(batchLat[i])) {
+                fail("batch NaN marker", lons[i], lats[i], 0, batchLat[i]);
+            }
+            continue;
+        }
+
+        if(!valid) {
+            fail("scalar acceptance", lons[i], lats[i], refY, y);
+            continue;
+        }
+
+        if(fabs(x - refX) > MERCATOR_TOLERANCE) fail("scalar x", lons[i], lats[i], refX, x);
+        if(fabs(y - refY) > MERCATOR_TOLERANCE) fail("scalar y", lons[i], lats[i], refY, y);
+        if(fabs(batchLon[i] - refX) > MERCATOR_TOLERANCE) fail("batch x", lons[i], lats[i], refX, batchLon[i]);
+        if(fabs(batchLat[i] - refY) > MERCATOR_TOLERANCE) fail("batch y", lons[i], lats[i], refY, batchLat[i]);
+
+        // and back to lon/lat
+        double invLon = refX, invLat = refY;
+        pj_transform(pj_900913, pj_4326, 1, 1, &invLon, &invLat, NULL);
+        invLon /= DEG_TO_RAD;
+        invLat /= DEG_TO_RAD;
+
+        Project::toLatLng(&x, &y);
+        if(fabs(x - invLon) > LATLNG_TOLERANCE) fail("inverse lon", lons[i], lats[i], invLon, x);
+        if(fabs(y - invLat) > LATLNG_TOLERANCE) fail("inverse lat", lons[i], lats[i], invLat, y);
+    }
+
+    if(batchErrors != expectedErrors) {
+        std::cerr << "FAIL batch error count: expected " << expectedErrors << ", got " << batchErrors << std::endl;
+        failures++;
+    }
+
+    pj_free(pj_900913);
+    pj_free(pj_4326);
+
+    std::cerr << lons.size() << " coordinates, " << expectedErrors << " rejected by proj4, " << failures << " failures" << std::endl;
+    return failures ? 1 : 0;
+}
@@ -66,6 +66,31 @@ public:
         // return the formatted timestamp
         return format(time);
     }
+
+    /**
+     * parse a date (yyyy-mm-dd) or a timestamp (yyyy-mm-ddThh:mm:ssZ, the
+     * T may be a space and the Z may be missing) in UTC. returns false if
+     * the string can't be parsed.
+     */
+    static bool parse(const std::string& str, time_t &time) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+
+        char sep, rest[2];
+        int n = sscanf(str.c_str(), "%4d-%2d-%2d%c%2d:%2d:%2d%1s", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &sep, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, rest);
+        if(n != 3 && !(n == 7 && (sep == 'T' || sep == ' ')) && !(n == 8 && (sep == 'T' || sep == ' ') && rest[0] == 'Z')) {
+            return false;
+        }
+
+        if(tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 60) {
+            return false;
+        }
+
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        time = timegm(&tm);
+        return true;
+    }
 };
 
 #endif // IMPORTER_TIMESTAMP_HPP
@@ -0,0 +1,178 @@
+/**
+ * Many renderings only cover the last few years of the history, or only
+ * need one state per quarter. The TimeWindow restricts the import to the
+ * versions valid between --since and --until: versions ending before the
+ * window or starting after it are dropped and the validity of the others
+ * is clipped to the window.
+ *
+ * With --sample-every, only the states valid at the start of each interval
+ * (see granularity.hpp) inside of the window are kept. The validity of a
+ * version is snapped to these instants, so it starts at the first instant
+ * it is valid at and ends at the first instant it is not valid at anymore.
+ * Versions not valid at any instant are dropped, and a rendering at any
+ * point in time shows the state of the instant before it.
+ */
+
+#ifndef IMPORTER_TIMEWINDOW_HPP
+#define IMPORTER_TIMEWINDOW_HPP
+
+#include "granularity.hpp"
+
+/**
+ * Clips validity ranges to a window of time
+ */
+class TimeWindow {
+private:
+    /**
+     * the window, 0 if it is open on that side
+     */
+    time_t m_since, m_until;
+
+    bool m_sampling;
+    Granularity::Unit m_sample;
+
+    uint64_t m_dropped, m_clipped;
+
+    /**
+     * clip the range to the window without snapping it to the sample
+     * instants
+     */
+    bool clipToWindow(time_t& from, time_t& to) const {
+        // a deletion is kept if it happened inside of the window
+        if(to != 0 && to == from) {
+            return from >= m_since && (m_until == 0 || from < m_until);
+        }
+
+        if(from < m_since) {
+            from = m_since;
+        }
+
+        if(m_until != 0 && (to == 0 || to > m_until)) {
+            to = m_until;
+        }
+
+        return to == 0 || from < to;
+    }
+
+    /**
+     * the first sample instant at or after t
+     */
+    time_t sampleAtOrAfter(time_t t) const {
+        time_t start = Granularity::bucket(t, m_sample);
+        return start == t ? t : Granularity::next(t, m_sample);
+    }
+
+    /**
+     * clip the range to the window and snap it to the sample instants
+     */
+    bool snap(time_t& from, time_t& to) const {
+        bool deletion = (to != 0 && to == from);
+
+        if(!clipToWindow(from, to)) {
+            return false;
+        }
+
+        if(m_sampling) {
+            from = sampleAtOrAfter(from);
+            if(to != 0) {
+                to = sampleAtOrAfter(to);
+            }
+
+            if((m_until != 0 && from >= m_until) || (!deletion && to != 0 && from >= to)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+public:
+    TimeWindow() : m_since(0), m_until(0), m_sampling(false), m_sample(Granularity::SECOND), m_dropped(0), m_clipped(0) {}
+
+    /**
+     * is the import restricted at all?
+     */
+    bool isRestricting() const {
+        return m_since != 0 || m_until != 0 || m_sampling;
+    }
+
+    time_t since() const {
+        return m_since;
+    }
+
+    /**
+     * drop everything before this time, 0 to import from the beginning
+     */
+    void since(time_t t) {
+        m_since = t;
+    }
+
+    time_t until() const {
+        return m_until;
+    }
+
+    /**
+     * drop everything from this time on, 0 to import until the end
+     */
+    void until(time_t t) {
+        m_until = t;
+    }
+
+    bool isSampling() const {
+        return m_sampling;
+    }
+
+    /**
+     * only keep the states valid at the start of each interval of the unit
+     */
+    void sampleEvery(Granularity::Unit unit) {
+        m_sampling = true;
+        m_sample = unit;
+    }
+
+    /**
+     * does the range from..to (to is 0 if it is still valid) overlap with
+     * the window? instants are not considered.
+     */
+    bool overlaps(time_t from, time_t to) const {
+        return clipToWindow(from, to);
+    }
+
+    /**
+     * clip the range from..to (to is 0 if it is still valid) to the window
+     * and snap it to the sample instants. a range with from == to marks a
+     * deletion. returns false if the range should be dropped.
+     */
+    bool clip(time_t& from, time_t& to) {
+        if(!isRestricting()) {
+            return true;
+        }
+
+        time_t origFrom = from, origTo = to;
+        if(!snap(from, to)) {
+            m_dropped++;
+            return false;
+        }
+
+        if(from != origFrom || to != origTo) {
+            m_clipped++;
+        }
+        return true;
+    }
+
+    /**
+     * would the range be kept by clip?
+     */
+    bool keeps(time_t from, time_t to) const {
+        return !isRestricting() || snap(from, to);
+    }
+
+    /**
+     * print how many rows were dropped and clipped
+     */
+    void printStatistics() {
+        std::cerr << "time window: dropped " << m_dropped << " rows, clipped the validity of " << m_clipped << " rows" << std::endl;
+    }
+};
+
+#endif // IMPORTER_TIMEWINDOW_HPP
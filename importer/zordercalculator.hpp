@@ -60,13 +60,21 @@ public:
      * calculates the z-order of a highway
      */
     static long int calculateZOrder(const Osmium::OSM::TagList& tags) {
+        bool lowzoom;
+        return calculateZOrder(tags, lowzoom);
+    }
+
+    /**
+     * calculates the z-order of a highway and if it should be additionally
+     * placed in the lowzoom-line-table (osm2pgsql calls it "roads")
+     */
+    static long int calculateZOrder(const Osmium::OSM::TagList& tags, bool &lowzoom) {
         // the calculated z-order
         long int z_order = 0;
 
         // flag, signaling if this way should be additionally placed in
-        // the lowzoom-line-table (osm2pgsql calls it "roads")
-        // NOTE: this is curently not used
-        int lowzoom = false;
+        // the lowzoom-line-table
+        lowzoom = false;
 
         // shorthands to the values of different keys, contributing to
         // the z-order calculation
@@ -0,0 +1,134 @@
+#!/usr/bin/python
+#
+# compare the two index designs on the validity of a database imported with
+# --validity-range: the GiST index on (geom, valid_from, valid_to) queried with
+# BETWEEN and the GiST index on (geom, validity) queried with @>
+#
+
+import psycopg2
+from optparse import OptionParser
+import sys, time, math
+
+def main():
+    parser = OptionParser()
+    parser.add_option("-b", "--bbox", action="append", type="string", dest="bboxes", default=[],
+                      help="a bounding box in the format l,b,r,t to query, can be given several times [default: a box around the center of the data at each of the zoom levels 6, 10, 14]")
+
+    parser.add_option("-d", "--date", action="append", type="string", dest="dates", default=[],
+                      help="a date to query, format 'YYYY-MM-DD HH:II:SS', can be given several times [default: 5 dates evenly spread over the history in the database]")
+
+    parser.add_option("-r", "--repeat", action="store", type="int", dest="repeat", default=5,
+                      help="how often each query is run, the median time is reported [default: %default]")
+
+    parser.add_option("-D", "--db", action="store", type="string", dest="dsn", default="",
+                      help="database connection string")
+
+    parser.add_option("-P", "--dbprefix", action="store", type="string", dest="dbprefix", default="hist",
+                      help="database table prefix of imported tables [default: %default]")
+
+    (options, args) = parser.parse_args()
+
+    con = psycopg2.connect(options.dsn)
+    cur = con.cursor()
+
+    if not has_validity(cur, options.dbprefix):
+        print "%s_line has no validity column, import the database with --validity-range" % (options.dbprefix)
+        sys.exit(1)
+
+    try:
+        boxes = [map(float, bbox.split(",")) for bbox in options.bboxes] or default_boxes(cur, options.dbprefix)
+    except ValueError, err:
+        print "invalid syntax in bbox argument"
+        print
+        parser.print_help()
+        sys.exit(1)
+
+    dates = options.dates or default_dates(cur, options.dbprefix)
+
+    designs = [
+        ("geom, valid_from, valid_to", "'%s' BETWEEN valid_from AND COALESCE(valid_to, '9999-12-31')"),
+        ("geom, validity", "validity @> '%s'::timestamp"),
+    ]
+
+    totals = [0.0] * len(designs)
+    print "%-8s %-19s %-45s %10s %14s %14s" % ("table", "date", "bbox", "rows", designs[0][0], designs[1][0])
+    for table in ("point", "line", "roads", "polygon"):
+        for date in dates:
+            for box in boxes:
+                e = lonlat2merc(box)
+                where = "geom && ST_SetSRID('BOX3D(%f %f, %f %f)'::box3d, 900913)" % (e[0], e[1], e[2], e[3])
+
+                times = []
+                for (index, condition) in designs:
+                    query = "SELECT count(*) FROM %s_%s WHERE %s AND %s" % (options.dbprefix, table, where, condition % (date))
+                    (rows, t) = run(cur, query, options.repeat)
+                    times.append(t)
+
+                for i in range(len(designs)):
+                    totals[i] += times[i]
+
+                print "%-8s %-19s %-45s %10u %12.1fms %12.1fms" % (table, date, ",".join(["%.4f" % c for c in box]), rows, times[0] * 1000, times[1] * 1000)
+
+    print
+    for i in range(len(designs)):
+        print "total with the index on (%s): %.1fms" % (designs[i][0], totals[i] * 1000)
+
+    print
+    for (index, condition) in designs:
+        print "plan for the index on (%s):" % (index)
+        e = lonlat2merc(boxes[0])
+        cur.execute("EXPLAIN SELECT count(*) FROM %s_line WHERE geom && ST_SetSRID('BOX3D(%f %f, %f %f)'::box3d, 900913) AND %s" % (options.dbprefix, e[0], e[1], e[2], e[3], condition % (dates[0])))
+        for row in cur.fetchall():
+            print "  " + row[0]
+
+    cur.close()
+    con.close()
+
+def run(cur, query, repeat):
+    # run the query repeat times, return its result and the median time
+    times = []
+    for i in range(repeat):
+        start = time.time()
+        cur.execute(query)
+        rows = cur.fetchone()[0]
+        times.append(time.time() - start)
+
+    times.sort()
+    return (rows, times[len(times) / 2])
+
+def has_validity(cur, dbprefix):
+    cur.execute("SELECT count(*) FROM information_schema.columns WHERE table_name = %s AND column_name = 'validity'", ('%s_line' % (dbprefix),))
+    return cur.fetchone()[0] > 0
+
+def default_dates(cur, dbprefix):
+    # five dates between the first and the last change in the database
+    cur.execute("SELECT min(valid_from), max(valid_from) FROM %s_point" % (dbprefix))
+    (first, last) = cur.fetchone()
+    step = (last - first) / 5
+    return [(first + step * (i + 1) - step / 2).strftime("%Y-%m-%d %H:%M:%S") for i in range(5)]
+
+def default_boxes(cur, dbprefix):
+    # boxes of the size of a 800x600 image at the zoom levels 6, 10 and 14
+    # around the center of the data
+    cur.execute("SELECT ST_X(c), ST_Y(c) FROM (SELECT ST_Transform(ST_SetSRID(ST_Centroid(ST_Extent(geom)), 900913), 4326) AS c FROM %s_point) AS center" % (dbprefix))
+    (lon, lat) = cur.fetchone()
+
+    boxes = []
+    for zoom in (6, 10, 14):
+        # degrees per pixel of the image
+        dpp = 360.0 / 256 / 2 ** zoom
+        boxes.append([lon - 400 * dpp, lat - 300 * dpp * math.cos(math.radians(lat)), lon + 400 * dpp, lat + 300 * dpp * math.cos(math.radians(lat))])
+    return boxes
+
+def lonlat2merc(box):
+    # project a l,b,r,t box to mercator
+    def merc(lon, lat):
+        return (lon * 20037508.34 / 180, math.log(math.tan((90 + lat) * math.pi / 360)) / (math.pi / 180) * 20037508.34 / 180)
+
+    (l, b) = merc(box[0], box[1])
+    (r, t) = merc(box[2], box[3])
+    return (l, b, r, t)
+
+
+if __name__ == "__main__":
+    main()
@@ -43,6 +43,18 @@ def main():
     parser.add_option("-e", "--extra-view-columns", action="store", type="string", dest="extracolumns", default="", 
                       help="if you need only some additional columns, you can use this flag to add them to the default set of columns")
     
+    parser.add_option("-n", "--no-generalized", action="store_false", dest="generalized", default=True, 
+                      help="don't use the generalized tables written by the importer with --generalize, even if they exist for the rendered zoom level")
+    
+    parser.add_option("--lazy", action="store_true", dest="lazy", default=False, 
+                      help="the database was imported with --lazy, assemble the way geometries from the node history")
+    
+    parser.add_option("--no-current", action="store_false", dest="current", default=True, 
+                      help="don't use the current tables written by the importer with --current-tables, even if the date is after the last change in the database")
+    
+    parser.add_option("--validity-range", action="store_true", dest="validityrange", default=False, 
+                      help="the database was imported with --validity-range, query the validity column with @> instead of comparing valid_from and valid_to")
+    
     
     parser.add_option("-A", "--anistart", action="store", type="string", dest="anistart", 
                       help="start-date of the animation. if not specified, the script tries to infer the date of the first node in the requested bbox using a direct database connection")
@@ -5,7 +5,7 @@
 
 import psycopg2
 from optparse import OptionParser
-import sys, os, subprocess
+import sys, os, subprocess, math
 import cStringIO
 import mapnik
 
@@ -55,6 +55,18 @@ def main():
     parser.add_option("-e", "--extra-view-columns", action="store", type="string", dest="extracolumns", default="", 
                       help="if you need only some additional columns, you can use this flag to add them to the default set of columns")
     
+    parser.add_option("-n", "--no-generalized", action="store_false", dest="generalized", default=True, 
+                      help="don't use the generalized tables written by the importer with --generalize, even if they exist for the rendered zoom level")
+    
+    parser.add_option("--lazy", action="store_true", dest="lazy", default=False, 
+                      help="the database was imported with --lazy, assemble the way geometries from the node history")
+    
+    parser.add_option("--no-current", action="store_false", dest="current", default=True, 
+                      help="don't use the current tables written by the importer with --current-tables, even if the date is after the last change in the database")
+    
+    parser.add_option("--validity-range", action="store_true", dest="validityrange", default=False, 
+                      help="the database was imported with --validity-range, query the validity column with @> instead of comparing valid_from and valid_to")
+    
     
     parser.add_option("-D", "--db", action="store", type="string", dest="dsn", default="", 
                       help="database connection string used for view creation")
@@ -104,7 +116,18 @@ def render(options):
         if(options.extracolumns):
             columns += options.extracolumns.split(',')
         
-        create_views(options.dsn, options.dbprefix, options.viewprefix, options.viewhstore, columns, options.date)
+        if(options.current and is_current(options.dsn, options.dbprefix, options.date)):
+            create_current_views(options.dsn, options.dbprefix, options.viewprefix, options.viewhstore, columns)
+        
+        elif(options.lazy):
+            create_lazy_views(options.dsn, options.dbprefix, options.viewprefix, options.viewhstore, columns, options.date, bbox2merc(options.bbox), options.validityrange)
+        
+        else:
+            generalized = ""
+            if(options.generalized):
+                generalized = find_generalized(options.dsn, options.dbprefix, options.zoom or size2zoom(options.bbox, options.size))
+            
+            create_views(options.dsn, options.dbprefix, options.viewprefix, options.viewhstore, columns, options.date, generalized, options.validityrange)
     
     # create map
     m = mapnik.Map(options.size[0], options.size[1])
@@ -231,7 +254,68 @@ def zoom2size(bbox, zoom):
     
     return (wp, hp)
 
-def create_views(dsn, dbprefix, viewprefix, hstore, columns, date):
+def bbox2merc(bbox):
+    prj = mapnik.Projection("+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +no_defs +over")
+    return mapnik.forward_(mapnik.Box2d(*bbox), prj)
+
+def size2zoom(bbox, size):
+    e = bbox2merc(bbox)
+    
+    # meters per pixel of the image compared to those of a 256 pixel tile at zoom 0
+    mpp = (e.maxx - e.minx) / size[0]
+    return int(math.ceil(math.log(2 * math.pi * 6378137 / 256 / mpp, 2) - 0.01))
+
+def find_generalized(dsn, dbprefix, zoom):
+    # the importer writes tables like hist_line_z9 with --generalize, which are
+    # detailed enough for zoom 9 and below. use the least detailed one that
+    # is still detailed enough for the requested zoom
+    con = psycopg2.connect(dsn)
+    cur = con.cursor()
+    
+    cur.execute("SELECT tablename FROM pg_tables WHERE schemaname = 'public' AND tablename ~ %s", ('^%s_line_z[0-9]+$' % (dbprefix),))
+    levels = [int(row[0].rsplit("_z", 1)[1]) for row in cur.fetchall()]
+    
+    cur.close()
+    con.close()
+    
+    levels = [level for level in levels if level >= zoom]
+    if not levels:
+        return ""
+    
+    print "using the tables generalized for zoom %u" % (min(levels))
+    return "_z%u" % (min(levels))
+
+def is_current(dsn, dbprefix, date):
+    # the importer writes the versions which are still valid to tables like
+    # hist_current_line with --current-tables. they show the state at any
+    # date after the last change in the database
+    con = psycopg2.connect(dsn)
+    cur = con.cursor()
+    
+    cur.execute("SELECT count(*) FROM pg_tables WHERE schemaname = 'public' AND tablename = %s", ('%s_current_meta' % (dbprefix),))
+    current = False
+    if cur.fetchone()[0] > 0:
+        cur.execute("SELECT %%s::timestamp >= last_timestamp FROM %s_current_meta" % (dbprefix), (date,))
+        row = cur.fetchone()
+        current = row is not None and row[0]
+    
+    cur.close()
+    con.close()
+    
+    if current:
+        print "the date is after the last change in the database, using the current tables"
+    return current
+
+def valid_at(date, validityrange=False):
+    # the condition selecting the versions valid at the date. the tsrange
+    # written by the importer with --validity-range is indexed together with
+    # the geometry, in the full and in the generalized tables
+    if(validityrange):
+        return "validity @> '%s'::timestamp" % (date)
+    
+    return "'%s' BETWEEN valid_from AND COALESCE(valid_to, '9999-12-31')" % (date)
+
+def create_views(dsn, dbprefix, viewprefix, hstore, columns, date, generalized="", validityrange=False):
     con = psycopg2.connect(dsn)
     cur = con.cursor()
     
@@ -242,19 +326,85 @@ def create_views(dsn, dbprefix, viewprefix, hstore, columns, date):
     cur.execute("DELETE FROM geometry_columns WHERE f_table_catalog = '' AND f_table_schema = 'public' AND f_table_name IN ('%s_point', '%s_line', '%s_roads', '%s_polygon');" % (viewprefix, viewprefix, viewprefix, viewprefix))
     
     cur.execute("DROP VIEW IF EXISTS %s_point" % (viewprefix))
-    cur.execute("CREATE OR REPLACE VIEW %s_point AS SELECT id AS osm_id, %s geom AS way FROM %s_point WHERE '%s' BETWEEN valid_from AND COALESCE(valid_to, '9999-12-31');" % (viewprefix, columselect, dbprefix, date))
+    cur.execute("CREATE OR REPLACE VIEW %s_point AS SELECT id AS osm_id, %s geom AS way FROM %s_point WHERE %s;" % (viewprefix, columselect, dbprefix, valid_at(date, validityrange)))
+    cur.execute("INSERT INTO geometry_columns (f_table_catalog, f_table_schema, f_table_name, f_geometry_column, coord_dimension, srid, type) VALUES ('', 'public', '%s_point', 'way', 2, 900913, 'POINT');" % (viewprefix))
+    
+    cur.execute("DROP VIEW IF EXISTS %s_line" % (viewprefix))
+    cur.execute("CREATE OR REPLACE VIEW %s_line AS SELECT id AS osm_id, %s z_order, geom AS way FROM %s_line%s WHERE %s;" % (viewprefix, columselect, dbprefix, generalized, valid_at(date, validityrange)))
+    cur.execute("INSERT INTO geometry_columns (f_table_catalog, f_table_schema, f_table_name, f_geometry_column, coord_dimension, srid, type) VALUES ('', 'public', '%s_line', 'way', 2, 900913, 'LINESTRING');" % (viewprefix))
+    
+    cur.execute("DROP VIEW IF EXISTS %s_roads" % (viewprefix))
+    cur.execute("CREATE OR REPLACE VIEW %s_roads AS SELECT id AS osm_id, %s z_order, geom AS way FROM %s_roads%s WHERE %s;" % (viewprefix, columselect, dbprefix, generalized, valid_at(date, validityrange)))
+    cur.execute("INSERT INTO geometry_columns (f_table_catalog, f_table_schema, f_table_name, f_geometry_column, coord_dimension, srid, type) VALUES ('', 'public', '%s_roads', 'way', 2, 900913, 'LINESTRING');" % (viewprefix))
+    
+    cur.execute("DROP VIEW IF EXISTS %s_polygon" % (viewprefix))
+    cur.execute("CREATE OR REPLACE VIEW %s_polygon AS SELECT id AS osm_id, %s z_order, area AS way_area, geom AS way FROM %s_polygon%s WHERE %s;" % (viewprefix, columselect, dbprefix, generalized, valid_at(date, validityrange)))
+    cur.execute("INSERT INTO geometry_columns (f_table_catalog, f_table_schema, f_table_name, f_geometry_column, coord_dimension, srid, type) VALUES ('', 'public', '%s_polygon', 'way', 2, 900913, 'POLYGON');" % (viewprefix))
+    
+    con.commit()
+    cur.close()
+    con.close()
+
+def create_current_views(dsn, dbprefix, viewprefix, hstore, columns):
+    con = psycopg2.connect(dsn)
+    cur = con.cursor()
+    
+    columselect = ""
+    for column in columns:
+        columselect += "tags->'%s' AS \"%s\", " % (column, column)
+    
+    cur.execute("DELETE FROM geometry_columns WHERE f_table_catalog = '' AND f_table_schema = 'public' AND f_table_name IN ('%s_point', '%s_line', '%s_roads', '%s_polygon');" % (viewprefix, viewprefix, viewprefix, viewprefix))
+    
+    cur.execute("DROP VIEW IF EXISTS %s_point" % (viewprefix))
+    cur.execute("CREATE OR REPLACE VIEW %s_point AS SELECT osm_id, %s way FROM %s_current_point;" % (viewprefix, columselect, dbprefix))
+    cur.execute("INSERT INTO geometry_columns (f_table_catalog, f_table_schema, f_table_name, f_geometry_column, coord_dimension, srid, type) VALUES ('', 'public', '%s_point', 'way', 2, 900913, 'POINT');" % (viewprefix))
+    
+    cur.execute("DROP VIEW IF EXISTS %s_line" % (viewprefix))
+    cur.execute("CREATE OR REPLACE VIEW %s_line AS SELECT osm_id, %s z_order, way FROM %s_current_line;" % (viewprefix, columselect, dbprefix))
+    cur.execute("INSERT INTO geometry_columns (f_table_catalog, f_table_schema, f_table_name, f_geometry_column, coord_dimension, srid, type) VALUES ('', 'public', '%s_line', 'way', 2, 900913, 'LINESTRING');" % (viewprefix))
+    
+    cur.execute("DROP VIEW IF EXISTS %s_roads" % (viewprefix))
+    cur.execute("CREATE OR REPLACE VIEW %s_roads AS SELECT osm_id, %s z_order, way FROM %s_current_roads;" % (viewprefix, columselect, dbprefix))
+    cur.execute("INSERT INTO geometry_columns (f_table_catalog, f_table_schema, f_table_name, f_geometry_column, coord_dimension, srid, type) VALUES ('', 'public', '%s_roads', 'way', 2, 900913, 'LINESTRING');" % (viewprefix))
+    
+    cur.execute("DROP VIEW IF EXISTS %s_polygon" % (viewprefix))
+    cur.execute("CREATE OR REPLACE VIEW %s_polygon AS SELECT osm_id, %s z_order, way_area, way FROM %s_current_polygon;" % (viewprefix, columselect, dbprefix))
+    cur.execute("INSERT INTO geometry_columns (f_table_catalog, f_table_schema, f_table_name, f_geometry_column, coord_dimension, srid, type) VALUES ('', 'public', '%s_polygon', 'way', 2, 900913, 'POLYGON');" % (viewprefix))
+    
+    con.commit()
+    cur.close()
+    con.close()
+
+def create_lazy_views(dsn, dbprefix, viewprefix, hstore, columns, date, e, validityrange=False):
+    # with --lazy the importer writes only the node lists of the ways, the
+    # geometries of the ways in the rendered area are assembled from the
+    # node history by hist_way_geometries (see scheme/99-after-lazy.sql)
+    con = psycopg2.connect(dsn)
+    cur = con.cursor()
+    
+    columselect = ""
+    for column in columns:
+        columselect += "tags->'%s' AS \"%s\", " % (column, column)
+    
+    ways = "hist_way_geometries(ST_SetSRID('BOX3D(%f %f, %f %f)'::box3d, 900913), '%s')" % (e.minx, e.miny, e.maxx, e.maxy, date)
+    
+    cur.execute("DELETE FROM geometry_columns WHERE f_table_catalog = '' AND f_table_schema = 'public' AND f_table_name IN ('%s_point', '%s_line', '%s_roads', '%s_polygon');" % (viewprefix, viewprefix, viewprefix, viewprefix))
+    
+    cur.execute("DROP VIEW IF EXISTS %s_point" % (viewprefix))
+    cur.execute("CREATE OR REPLACE VIEW %s_point AS SELECT id AS osm_id, %s geom AS way FROM %s_point WHERE %s;" % (viewprefix, columselect, dbprefix, valid_at(date, validityrange)))
     cur.execute("INSERT INTO geometry_columns (f_table_catalog, f_table_schema, f_table_name, f_geometry_column, coord_dimension, srid, type) VALUES ('', 'public', '%s_point', 'way', 2, 900913, 'POINT');" % (viewprefix))
     
     cur.execute("DROP VIEW IF EXISTS %s_line" % (viewprefix))
-    cur.execute("CREATE OR REPLACE VIEW %s_line AS SELECT id AS osm_id, %s z_order, geom AS way FROM %s_line WHERE '%s' BETWEEN valid_from AND COALESCE(valid_to, '9999-12-31');" % (viewprefix, columselect, dbprefix, date))
+    cur.execute("CREATE OR REPLACE VIEW %s_line AS SELECT id AS osm_id, %s z_order, geom AS way FROM %s WHERE GeometryType(geom) = 'LINESTRING';" % (viewprefix, columselect, ways))
     cur.execute("INSERT INTO geometry_columns (f_table_catalog, f_table_schema, f_table_name, f_geometry_column, coord_dimension, srid, type) VALUES ('', 'public', '%s_line', 'way', 2, 900913, 'LINESTRING');" % (viewprefix))
     
+    # there is no separate roads-table, the style filters the lines anyway
     cur.execute("DROP VIEW IF EXISTS %s_roads" % (viewprefix))
-    cur.execute("CREATE OR REPLACE VIEW %s_roads AS SELECT id AS osm_id, %s z_order, geom AS way FROM %s_line WHERE '%s' BETWEEN valid_from AND COALESCE(valid_to, '9999-12-31');" % (viewprefix, columselect, dbprefix, date))
+    cur.execute("CREATE OR REPLACE VIEW %s_roads AS SELECT * FROM %s_line;" % (viewprefix, viewprefix))
     cur.execute("INSERT INTO geometry_columns (f_table_catalog, f_table_schema, f_table_name, f_geometry_column, coord_dimension, srid, type) VALUES ('', 'public', '%s_roads', 'way', 2, 900913, 'LINESTRING');" % (viewprefix))
     
     cur.execute("DROP VIEW IF EXISTS %s_polygon" % (viewprefix))
-    cur.execute("CREATE OR REPLACE VIEW %s_polygon AS SELECT id AS osm_id, %s z_order, area AS way_area, geom AS way FROM %s_polygon WHERE '%s' BETWEEN valid_from AND COALESCE(valid_to, '9999-12-31');" % (viewprefix, columselect, dbprefix, date))
+    cur.execute("CREATE OR REPLACE VIEW %s_polygon AS SELECT id AS osm_id, %s z_order, ST_Area(geom) AS way_area, geom AS way FROM %s WHERE GeometryType(geom) = 'POLYGON';" % (viewprefix, columselect, ways))
     cur.execute("INSERT INTO geometry_columns (f_table_catalog, f_table_schema, f_table_name, f_geometry_column, coord_dimension, srid, type) VALUES ('', 'public', '%s_polygon', 'way', 2, 900913, 'POLYGON');" % (viewprefix))
     
     con.commit()